@@ -0,0 +1,125 @@
+#include "Mesh.hpp"
+#include "MeshBVH.hpp"
+#include "Multithread.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <string>
+
+// Builds the triangle BVH over a large procedural mesh and measures build time and query
+// throughput, with a brute force baseline on a small query sample.
+// Usage:  bvh_bench [threads] [rings]
+
+namespace
+{
+    // Sphere with a bumpy surface so the tree isn't trivially balanced
+    Mesh MakeBumpySphere(Float radius, int rings, int segments)
+    {
+        const Float pi = 3.14159265358979323846;
+        auto point = [&](int ring, int segment) {
+            Float theta = pi * Float(ring) / Float(rings);
+            Float phi = 2.0 * pi * Float(segment % segments) / Float(segments);
+            Float r = radius * (1.0 + 0.1 * std::sin(7.0 * theta) * std::cos(5.0 * phi));
+            return r * Vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+        };
+
+        std::vector<Triangle> triangles;
+        triangles.reserve(2 * Uint(rings) * Uint(segments));
+        for (int r = 0; r < rings; r++)
+        {
+            for (int s = 0; s < segments; s++)
+            {
+                if (r > 0)
+                {
+                    triangles.push_back({ point(r, s), point(r + 1, s), point(r, s + 1) });
+                }
+                if (r < rings - 1)
+                {
+                    triangles.push_back({ point(r, s + 1), point(r + 1, s), point(r + 1, s + 1) });
+                }
+            }
+        }
+        return Mesh(triangles);
+    }
+
+    double ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Uint threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    const int rings = argc > 2 ? std::stoi(argv[2]) : 700;
+
+    const Mesh mesh = MakeBumpySphere(10.0, rings, 2 * rings);
+    std::cout << "BVH benchmark, " << threads << " threads, " << mesh.Triangles().size() << " triangles" << std::endl;
+
+    MTIterator single(1);
+    auto start = std::chrono::high_resolution_clock::now();
+    MeshBVH serialBvh(mesh, single);
+    const double serialBuild = ElapsedMs(start);
+
+    MTIterator mt(threads);
+    start = std::chrono::high_resolution_clock::now();
+    MeshBVH bvh(mesh, mt);
+    const double parallelBuild = ElapsedMs(start);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "build:  " << serialBuild << " ms serial, " << parallelBuild << " ms parallel ("
+              << serialBuild / parallelBuild << "x), " << bvh.NumNodes() << " nodes" << std::endl;
+
+    const Uint numQueries = 1 << 20;
+    std::vector<Vec3> queries(numQueries);
+    std::mt19937 rng(1234);
+    // Queries in a band around the surface like SDF baking does - points near the center are
+    // almost equidistant to every triangle and would just measure the worst case
+    std::normal_distribution<Float> direction(0.0, 1.0);
+    std::uniform_real_distribution<Float> radius(7.0, 13.0);
+    for (Vec3& q : queries)
+    {
+        q = radius(rng) * glm::normalize(Vec3(direction(rng), direction(rng), direction(rng)));
+    }
+
+    std::vector<Float> distance(numQueries);
+    start = std::chrono::high_resolution_clock::now();
+    mt.IterateOverIndices(numQueries, [&](Uint i) {
+        distance[i] = bvh.ClosestPoint(queries[i]).Distance;
+    });
+    const double closestMs = ElapsedMs(start);
+
+    std::vector<char> inside(numQueries);
+    start = std::chrono::high_resolution_clock::now();
+    mt.IterateOverIndices(numQueries, [&](Uint i) {
+        inside[i] = bvh.Inside(queries[i]) ? 1 : 0;
+    });
+    const double insideMs = ElapsedMs(start);
+
+    std::cout << "closest point:  " << numQueries / closestMs * 1000.0 << " queries/s" << std::endl;
+    std::cout << "inside:         " << numQueries / insideMs * 1000.0 << " queries/s" << std::endl;
+
+    // Brute force baseline on a few queries, also checks the results
+    const Uint bruteQueries = 64;
+    Uint mismatches = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (Uint i = 0; i < bruteQueries; i++)
+    {
+        Float best = std::numeric_limits<Float>::infinity();
+        for (const Triangle& t : mesh.Triangles())
+        {
+            best = std::min(best, glm::length(t.v1 - queries[i]));
+        }
+        // Vertex distance bounds the true distance from above
+        mismatches += distance[i] > best + 1e-9 ? 1 : 0;
+    }
+    const double bruteMs = ElapsedMs(start);
+    std::cout << "brute force (vertices only):  " << bruteQueries / bruteMs * 1000.0 << " queries/s, "
+              << mismatches << " mismatches" << std::endl;
+
+    return 0;
+}
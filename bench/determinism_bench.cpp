@@ -0,0 +1,64 @@
+#include "CPUSolver.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+// Measures the overhead of the deterministic mode against the fast transfer modes on a falling
+// block of snow.
+// Usage:  determinism_bench [threads] [frames]
+
+namespace
+{
+    double TimeFrames(SimulationParameters params, Uint frames)
+    {
+        CPUSolver solver(IVec3(48, 48, 48), 0.001, params);
+        for (int x = 0; x < 40; x++)
+        {
+            for (int y = 0; y < 40; y++)
+            {
+                for (int z = 0; z < 40; z++)
+                {
+                    solver.AddParticle(Vec3(14.0 + x * 0.5, 14.0 + y * 0.5, 10.0 + z * 0.5), Vec3(0.0, 0.0, -10.0), 1.0);
+                }
+            }
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (Uint f = 0; f < frames; f++)
+        {
+            solver.NextFrame();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::milli>(end - start).count() / Float(frames);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Uint threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    const Uint frames = argc > 2 ? std::stoul(argv[2]) : 3;
+
+    std::cout << "Determinism benchmark, " << threads << " threads, " << frames << " frames of 10 substeps, 64000 particles" << std::endl;
+
+    SimulationParameters params;
+    params.NUM_THREADS = threads;
+
+    params.P2G_MODE = P2GMode::Scatter;
+    const double scatterMs = TimeFrames(params, frames);
+    params.P2G_MODE = P2GMode::Partitioned;
+    const double partitionedMs = TimeFrames(params, frames);
+    params.DETERMINISTIC = true;
+    const double deterministicMs = TimeFrames(params, frames);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "scatter:        " << scatterMs << " ms/frame" << std::endl
+              << "partitioned:    " << partitionedMs << " ms/frame" << std::endl
+              << "deterministic:  " << deterministicMs << " ms/frame ("
+              << 100.0 * (deterministicMs / std::min(scatterMs, partitionedMs) - 1.0) << "% over the fastest)" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "CPUSolver.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+
+// Grid and particle arrays on regular pages against huge pages (see HugePages), on particles
+// scattered at random over the domain - the access pattern of a simulation that has been mixing
+// for a while, where consecutive particles hit cells far apart.  Reports the particle to grid
+// (rasterize + grid forces) and grid to particle (deformation update + particle velocities)
+// times per frame, with their data TLB misses where the hardware counters are available, and how
+// much of the memory actually ended up on huge pages.
+// Usage:  hugepage_bench [threads] [frames] [grid side in cells] [particles]
+
+namespace
+{
+    struct Result
+    {
+        Float P2GMs = 0.0;
+        Float G2PMs = 0.0;
+        Float P2GTLBMisses = 0.0;
+        Float G2PTLBMisses = 0.0;
+        bool TLBAvailable = false;
+        Uint HugePageKB = 0;
+    };
+
+    // Anonymous memory of the process on transparent or reserved huge pages
+    Uint hugePageKB()
+    {
+        std::ifstream smaps("/proc/self/smaps_rollup");
+        std::string line;
+        Uint total = 0;
+        while (std::getline(smaps, line))
+        {
+            if (line.compare(0, 14, "AnonHugePages:") == 0 || line.compare(0, 16, "Private_Hugetlb:") == 0)
+            {
+                total += std::stoull(line.substr(line.find(':') + 1));
+            }
+        }
+        return total;
+    }
+
+    Result run(HugePages pages, Uint threads, Uint frames, int side, Uint numParticles)
+    {
+        SimulationParameters params;
+        params.NUM_THREADS = threads;
+        params.HUGE_PAGES = pages;
+        params.PERF_COUNTERS = true;
+
+        CPUSolver solver(IVec3(side), 0.001, params);
+
+        // Same particles for every mode
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<Float> coord(0.125 * side, 0.875 * side);
+        std::vector<ParticleSeed> seeds(numParticles);
+        for (ParticleSeed& seed : seeds)
+        {
+            seed = { Vec3(coord(rng), coord(rng), coord(rng)), Vec3(0.0), 0.1 };
+        }
+        solver.AddParticles(seeds.data(), seeds.size());
+
+        // The first frame also estimates the volumes, it isn't timed
+        solver.NextFrame();
+        const SolverStats before = solver.GetStats();
+        for (Uint f = 0; f < frames; f++)
+        {
+            solver.NextFrame();
+        }
+        const SolverStats& after = solver.GetStats();
+
+        const Uint tlb = Uint(PerfCounter::TLBMisses);
+        auto phaseMs = [&](SolverPhase phase) {
+            return 1000.0 * (after.Phases[Uint(phase)].Seconds - before.Phases[Uint(phase)].Seconds) / Float(frames);
+        };
+        auto phaseMisses = [&](SolverPhase phase) {
+            return Float(after.Phases[Uint(phase)].Counters[tlb] - before.Phases[Uint(phase)].Counters[tlb]) / Float(frames);
+        };
+
+        Result result;
+        result.P2GMs = phaseMs(SolverPhase::Rasterize) + phaseMs(SolverPhase::GridForces);
+        result.G2PMs = phaseMs(SolverPhase::DeformationUpdate) + phaseMs(SolverPhase::ParticleVelocities);
+        result.P2GTLBMisses = phaseMisses(SolverPhase::Rasterize) + phaseMisses(SolverPhase::GridForces);
+        result.G2PTLBMisses = phaseMisses(SolverPhase::DeformationUpdate) + phaseMisses(SolverPhase::ParticleVelocities);
+        result.TLBAvailable = after.CountersAvailable[tlb];
+        result.HugePageKB = hugePageKB();
+        return result;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Uint threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    const Uint frames = argc > 2 ? std::stoul(argv[2]) : 2;
+    const int side = argc > 3 ? std::stoi(argv[3]) : 64;
+    const Uint numParticles = argc > 4 ? std::stoul(argv[4]) : 100000;
+
+    // Keeps the progress summaries out of the table
+    Log::SetConsoleLevel(LogLevel::Warning);
+
+    std::cout << "Huge page benchmark, " << numParticles << " particles on " << side << "^3 cells, "
+              << threads << " threads, ms and dTLB misses per frame" << std::endl;
+    std::cout << std::left << std::setw(13) << "pages" << std::right << std::setw(12) << "on huge MB"
+              << std::setw(10) << "P2G ms" << std::setw(10) << "G2P ms" << std::setw(14) << "P2G misses"
+              << std::setw(14) << "G2P misses" << std::endl;
+
+    const std::pair<HugePages, const char*> modes[] = {
+        { HugePages::Off, "off" },
+        { HugePages::Transparent, "transparent" },
+        { HugePages::Reserved, "reserved" },
+    };
+
+    Result off;
+    for (const auto& mode : modes)
+    {
+        const Result r = run(mode.first, threads, frames, side, numParticles);
+        if (mode.first == HugePages::Off)
+        {
+            off = r;
+        }
+
+        std::cout << std::left << std::setw(13) << mode.second << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << Float(r.HugePageKB) / 1024.0 << std::setprecision(2)
+                  << std::setw(10) << r.P2GMs << std::setw(10) << r.G2PMs;
+        if (r.TLBAvailable)
+        {
+            std::cout << std::scientific << std::setprecision(2) << std::setw(14) << r.P2GTLBMisses
+                      << std::setw(14) << r.G2PTLBMisses;
+        }
+        else
+        {
+            std::cout << std::setw(14) << "n/a" << std::setw(14) << "n/a";
+        }
+
+        if (mode.first != HugePages::Off && r.P2GMs > 0.0 && r.G2PMs > 0.0)
+        {
+            std::cout << std::fixed << std::setprecision(2) << "   speedup P2G " << off.P2GMs / r.P2GMs
+                      << "x, G2P " << off.G2PMs / r.G2PMs << "x";
+        }
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "Grid.hpp"
+#include "ParticleSystem.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+
+// Compares the scatter, gather and partitioned P2G engines on a block of snow at several
+// particle per cell densities.  The speedup is scatter over the faster of the other two.
+// Usage:  p2g_bench [threads] [repetitions]
+
+namespace
+{
+    const IVec3 GRID_DIMS(64, 64, 64);
+    const int BLOCK_SIZE = 32; // Side of the occupied block of cells
+
+    double TimeRasterization(const SimulationParameters& params, ParticleSystem& ps, MTIterator& mt, Uint reps)
+    {
+        Grid grid(params, GRID_DIMS);
+        ps.CacheParticleGrads(grid, mt);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (Uint i = 0; i < reps; i++)
+        {
+            grid.RasterizeParticlesToGrid(ps, mt);
+            grid.ResetGrid();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::milli>(end - start).count() / Float(reps);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Uint threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    const Uint reps = argc > 2 ? std::stoul(argv[2]) : 5;
+
+    MTIterator mt(threads);
+
+    SimulationParameters scatterParams;
+    scatterParams.P2G_MODE = P2GMode::Scatter;
+    SimulationParameters gatherParams;
+    gatherParams.P2G_MODE = P2GMode::Gather;
+    SimulationParameters partitionedParams;
+    partitionedParams.P2G_MODE = P2GMode::Partitioned;
+
+    std::cout << "P2G benchmark, " << threads << " threads, " << reps << " repetitions" << std::endl;
+    std::cout << std::setw(6) << "ppc"
+              << std::setw(12) << "particles"
+              << std::setw(14) << "scatter (ms)"
+              << std::setw(14) << "gather (ms)"
+              << std::setw(18) << "partitioned (ms)"
+              << std::setw(10) << "speedup" << std::endl;
+
+    for (Uint ppc : { 1, 4, 8, 16, 32 })
+    {
+        ParticleSystem ps(scatterParams);
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<Float> jitter(0.0, 1.0);
+
+        const Vec3 offset((GRID_DIMS.x - BLOCK_SIZE) / 2, (GRID_DIMS.y - BLOCK_SIZE) / 2, (GRID_DIMS.z - BLOCK_SIZE) / 2);
+        for (int i = 0; i < BLOCK_SIZE; i++)
+        {
+            for (int j = 0; j < BLOCK_SIZE; j++)
+            {
+                for (int k = 0; k < BLOCK_SIZE; k++)
+                {
+                    for (Uint n = 0; n < ppc; n++)
+                    {
+                        Vec3 pos = offset + Vec3(i + jitter(rng), j + jitter(rng), k + jitter(rng));
+                        ps.AddParticle(pos, Vec3(1.0, 0.0, -1.0), 1.0);
+                    }
+                }
+            }
+        }
+
+        double scatterMs = TimeRasterization(scatterParams, ps, mt, reps);
+        double gatherMs = TimeRasterization(gatherParams, ps, mt, reps);
+        double partitionedMs = TimeRasterization(partitionedParams, ps, mt, reps);
+
+        std::cout << std::setw(6) << ppc
+                  << std::setw(12) << ps.GetParticles().size()
+                  << std::setw(14) << std::fixed << std::setprecision(2) << scatterMs
+                  << std::setw(14) << gatherMs
+                  << std::setw(18) << partitionedMs
+                  << std::setw(10) << scatterMs / std::min(gatherMs, partitionedMs) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "CPUSolver.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// Thread scaling of the solver, per phase (see SolverStats::Phases), on a block of snow falling
+// onto the floor.  Runs at 1, 2, 4, ... up to the given number of threads:
+//  - strong scaling:  the same block at every thread count, efficiency T(1) / (n * T(n))
+//  - weak scaling:    the block (and grid) grows along x with the thread count so every thread
+//                     keeps the same number of particles, efficiency T(1) / T(n)
+// Phases below 100% are the ones that keep the solver from scaling.
+// Usage:  scaling_bench [max threads] [frames] [block side in particles]
+
+namespace
+{
+    const Float SPACING = 0.5; // 8 particles per cell
+    const int MARGIN = 4;      // Cells around the block
+
+    using PhaseTimes = std::array<Float, NUM_SOLVER_PHASES + 1>; // ms per frame, the last is the total
+
+    // Times frames frames of a block of side x side x side particles, stretched stretch times along x
+    PhaseTimes timeBlock(Uint threads, Uint frames, int side, int stretch)
+    {
+        SimulationParameters params;
+        params.NUM_THREADS = threads;
+        params.P2G_MODE = P2GMode::Partitioned;
+
+        const int cells = int(side * SPACING) + 1;
+        const IVec3 dims(cells * stretch + 2 * MARGIN, cells + 2 * MARGIN, cells + 2 * MARGIN);
+        CPUSolver solver(dims, 0.001, params);
+
+        std::vector<ParticleSeed> seeds;
+        seeds.reserve(Uint(side) * side * side * stretch);
+        for (int x = 0; x < side * stretch; x++)
+        {
+            for (int y = 0; y < side; y++)
+            {
+                for (int z = 0; z < side; z++)
+                {
+                    const Vec3 pos = Vec3(MARGIN) + Vec3(x, y, z) * SPACING + Vec3(0.0, 0.0, 1.0);
+                    seeds.push_back({ pos, Vec3(0.0, 0.0, -5.0), 1.0 });
+                }
+            }
+        }
+        solver.AddParticles(seeds.data(), seeds.size());
+
+        // The first frame also estimates the volumes, it isn't timed
+        solver.NextFrame();
+        const SolverStats before = solver.GetStats();
+        for (Uint f = 0; f < frames; f++)
+        {
+            solver.NextFrame();
+        }
+        const SolverStats& after = solver.GetStats();
+
+        PhaseTimes times;
+        times.fill(0.0);
+        for (Uint p = 0; p < NUM_SOLVER_PHASES; p++)
+        {
+            times[p] = 1000.0 * (after.Phases[p].Seconds - before.Phases[p].Seconds) / Float(frames);
+            times[NUM_SOLVER_PHASES] += times[p];
+        }
+        return times;
+    }
+
+    void printTable(const std::string& title, const std::vector<Uint>& threadCounts, const std::vector<PhaseTimes>& times, bool weak)
+    {
+        std::cout << std::endl << title << std::endl;
+        std::cout << std::left << std::setw(22) << "phase" << std::right;
+        for (Uint t : threadCounts)
+        {
+            std::cout << std::setw(10) << (std::to_string(t) + " thr") << std::setw(7) << "eff";
+        }
+        std::cout << std::endl;
+
+        for (Uint p = 0; p <= NUM_SOLVER_PHASES; p++)
+        {
+            Float longest = 0.0;
+            for (const PhaseTimes& t : times)
+            {
+                longest = std::max(longest, t[p]);
+            }
+            if (longest < 0.005)
+            {
+                continue; // Phases that don't run in this scene
+            }
+
+            const Float base = times[0][p];
+
+            std::cout << std::left << std::setw(22) << (p < NUM_SOLVER_PHASES ? SolverPhaseName(SolverPhase(p)) : "total") << std::right;
+            for (Uint i = 0; i < threadCounts.size(); i++)
+            {
+                const Float ms = times[i][p];
+                const Float efficiency = ms > 0.0 ? base / (ms * (weak ? 1.0 : Float(threadCounts[i]))) : 0.0;
+                std::cout << std::fixed << std::setprecision(2) << std::setw(10) << ms
+                          << std::setprecision(0) << std::setw(6) << 100.0 * efficiency << "%";
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Uint maxThreads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    const Uint frames = argc > 2 ? std::stoul(argv[2]) : 2;
+    const int side = argc > 3 ? std::stoi(argv[3]) : 32;
+
+    std::vector<Uint> threadCounts;
+    for (Uint t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(std::max<Uint>(maxThreads, 1));
+
+    const Uint particles = Uint(side) * side * side;
+    std::cout << "Scaling benchmark, " << frames << " frames of 10 substeps, ms per frame and parallel efficiency" << std::endl;
+
+    std::vector<PhaseTimes> strong;
+    for (Uint t : threadCounts)
+    {
+        strong.push_back(timeBlock(t, frames, side, 1));
+    }
+    printTable("Strong scaling, " + std::to_string(particles) + " particles", threadCounts, strong, false);
+
+    std::vector<PhaseTimes> weak;
+    for (Uint t : threadCounts)
+    {
+        weak.push_back(timeBlock(t, frames, side, int(t)));
+    }
+    printTable("Weak scaling, " + std::to_string(particles) + " particles per thread", threadCounts, weak, true);
+
+    return 0;
+}
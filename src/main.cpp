@@ -1,76 +1,143 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <random>
-#include <ctime>
+#include <vector>
 
 #include "CPUSolver.hpp"
 #include "OvdbConverter.hpp"
+#include "Scene.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
 
-// Our interfacing is done through file (currently)
-int main(int argc, char* argv[]) {
-    std::srand(std::time(nullptr));
-    SimulationParameters sp;
-    sp.H = 1.0; // 1m grid size 
-    
-    CPUSolver solver(
-        IVec3(300, 180, 180),
-        1.0 / 24.0,
-        sp
-    );
-
-    // Add a cube of snow
-    Vec3 center = Vec3(40, 90, 90);
-    for (int x = -30; x < 30; x++) {
-        for (int y = -30; y < 30; y++) {
-            for (int z = -30; z < 30; z++) {
-                if (Float(x) * Float(x) + Float(y) * Float(y) + Float(z) * Float(z) > 9.0) {
-                    continue;
-                }
+// Runs one job.  A resumed job takes its state (particles, parameters, grid) from the checkpoint
+// and only the colliders and output settings from the scene.
+static void runScene(const std::string& scenePath, const std::string& resumePath)
+{
+    Scene scene = LoadScene(scenePath);
 
-                float r1 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-                float r2 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-                float r3 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-                
-                solver.AddParticle(
-                    center + Vec3(Float(x) / 2.0, Float(y) / 2.0, Float(z) /2.0),
-                    Vec3(Float(250.0), Float(0.0), Float(0.0)),
-                    200.0 // 1g per particle
-                );
-            }
+    std::unique_ptr<CPUSolver> solver;
+    if (!resumePath.empty())
+    {
+        solver = CPUSolver::FromCheckpoint(resumePath);
+        LOG_INFO("resuming from frame " << solver->GetFrameNum());
+    }
+    else
+    {
+        solver = std::make_unique<CPUSolver>(scene.GridDims, scene.FrameLength, scene.Params);
+        for (const std::shared_ptr<Emitter>& emitter : scene.Emitters)
+        {
+            solver->Emit(*emitter);
         }
     }
 
-    center = Vec3(130, 90, 90);
-    for (int x = -3; x < 0; x++) {
-        for (int y = -90; y < 90; y++) {
-            for (int z = -90; z < 90; z++) {
-                
-                solver.AddParticle(
-                    center + Vec3(Float(x) / 2.0, Float(y) / 2.0, Float(z) / 2.0),
-                    Vec3(Float(-15.0), Float(1.0), Float(-0.5)),
-                    1.0 // 1g per particle
-                );
+    for (const Collider& collider : scene.Colliders)
+    {
+        solver->AddCollider(collider);
+    }
+
+    const SceneOutput& output = scene.Output;
+    if (!output.TracePath.empty())
+    {
+        Trace::Open(output.TracePath);
+    }
+
+    solver->SetProgressTarget(scene.NumFrames);
+    for (Uint i = solver->GetFrameNum(); i < scene.NumFrames; i++)
+    {
+        LOG_INFO("outputting frame " << i);
+        if (!output.TracePath.empty())
+        {
+            Trace::SetEnabled(i >= output.TraceFirstFrame && i <= output.TraceLastFrame);
+        }
+        solver->NextFrame();
+
+        if (!output.PositionsPrefix.empty() || !output.VdbPrefix.empty())
+        {
+            std::shared_ptr<SimulationOutput> simoutput = solver->GetOutput();
+            if (!output.PositionsPrefix.empty())
+            {
+                TraceScope scope("write positions", "io");
+                std::ofstream outfile(output.PositionsPrefix + std::to_string(i) + ".txt");
+                for (const Particle& p : simoutput->GetParticles()) {
+                    outfile << p.pos[0] << " " << p.pos[1] << " " << p.pos[2] << std::endl;
+                }
             }
+            if (!output.VdbPrefix.empty())
+            {
+                TraceScope scope("write vdb", "io");
+                OvdbConverter converter(simoutput);
+                converter.Output(output.VdbPrefix + std::to_string(i) + ".vdb");
+            }
+        }
+
+        if (output.CheckpointInterval > 0 && (i + 1) % output.CheckpointInterval == 0)
+        {
+            solver->Checkpoint(output.CheckpointPath);
         }
+
+        // The per thread buffers are only written out between frames
+        Trace::Flush();
     }
 
-    std::shared_ptr<SimulationOutput> simoutput;
+    solver->WaitForCheckpoint();
+    if (!output.TracePath.empty())
+    {
+        Trace::Close();
+    }
+    LogPhaseStats(solver->GetStats(), LogLevel::Info);
+    LOG_INFO("memory " << DescribeMemoryUsage(solver->GetMemoryUsage())
+             << (solver->GetWeightCache() == WeightCache::Compact ? ", compact weight cache" : ""));
+}
 
-    for (int i = 0; i < 48; i++)
+// Our interfacing is done through file (currently).  Every scene file is one job (see Scene.hpp),
+// jobs run one after another.
+// Usage:  main [--verbose | --quiet] <scene file>...
+//         main [--verbose | --quiet] --resume <checkpoint> <scene file>
+int main(int argc, char* argv[]) {
+    std::string resumePath;
+    std::vector<std::string> scenes;
+    for (int i = 1; i < argc; i++)
     {
-        std::cout << "outputting frame " + std::to_string(i) << std::endl;
-        std::ofstream outfile("out" + std::to_string(i) + ".txt");
-        solver.NextFrame();
-        simoutput = solver.GetOutput();
-        for (Particle p : simoutput->GetParticles()) {
-            outfile << p.pos[0] << " " << p.pos[1] << " " << p.pos[2] << std::endl;
+        const std::string arg = argv[i];
+        if (arg == "--resume" && i + 1 < argc)
+        {
+            resumePath = argv[++i];
+        }
+        else if (arg == "--verbose")
+        {
+            Log::SetLevel(LogLevel::Debug);
+            Log::SetConsoleLevel(LogLevel::Debug);
+        }
+        else if (arg == "--quiet")
+        {
+            Log::SetConsoleLevel(LogLevel::Warning);
         }
-        OvdbConverter converter(simoutput);
-        converter.Output("sim_" + std::to_string(i) + ".vdb");
+        else
+        {
+            scenes.push_back(arg);
+        }
+    }
+
+    if (scenes.empty() || (!resumePath.empty() && scenes.size() != 1))
+    {
+        std::cerr << "usage: " << argv[0] << " [--verbose | --quiet] <scene file>..." << std::endl;
+        std::cerr << "       " << argv[0] << " [--verbose | --quiet] --resume <checkpoint> <scene file>" << std::endl;
+        return 1;
+    }
 
-        outfile.close();
+    int failed = 0;
+    for (const std::string& scene : scenes)
+    {
+        try
+        {
+            runScene(scene, resumePath);
+        }
+        catch (const std::exception& e)
+        {
+            LOG_ERROR(scene << " failed: " << e.what());
+            failed++;
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    return failed == 0 ? 0 : 1;
+}
@@ -4,89 +4,549 @@
 #include <cmath> 
 
 #include "Math.hpp"
+#include "Checkpoint.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
 
 
 CPUSolver::CPUSolver(const IVec3& gridDimensions, Float frameLength, const SimulationParameters& params) :
-    mGrid(std::make_unique<Grid>(params, gridDimensions)),
-    mParticleSystem(std::make_unique<ParticleSystem>(params)),
+    mParams(params),
+    mFrameLength(frameLength),
+    mParticleSystem(std::make_unique<ParticleSystem>(mParams)),
+    mStepNum(0),
+    mMt(mParams.NUM_THREADS, mParams.NUMA_PLACEMENT),
+    mPhase(SolverPhase::Count),
+    mPhaseTraceStart(0.0),
+    mSnapshotBytes(0)
+{
+    if (mParams.NUMA_PLACEMENT)
+    {
+        LOG_INFO("NUMA placement over " << NumaTopology::Get().NumNodes() << " node(s)");
+    }
+
+    checkGridBudget(gridDimensions);
+    mGrid = std::make_unique<Grid>(mParams, gridDimensions);
+
+    if (mParams.SLEEPING)
+    {
+        mSleepBlocks = std::make_unique<SleepBlocks>(mParams, gridDimensions);
+    }
+}
+
+CPUSolver::CPUSolver(const IVec3& gridDimensions, Float frameLength, const SimulationParameters& params, std::shared_ptr<Transport> transport) :
+    mParams(params),
     mFrameLength(frameLength),
+    mParticleSystem(std::make_unique<ParticleSystem>(mParams)),
+    mDecomposition(std::make_unique<DomainDecomposition>(transport, gridDimensions, params.H)),
     mStepNum(0),
-    mMt(12) // TODO:  make customization - 12 threads for now
+    mMt(mParams.NUM_THREADS, mParams.NUMA_PLACEMENT),
+    mPhase(SolverPhase::Count),
+    mPhaseTraceStart(0.0),
+    mSnapshotBytes(0)
+{
+    if (mParams.SLEEPING)
+    {
+        // Activity would have to be exchanged across the slab boundaries
+        throw std::runtime_error("Sleeping isn't supported in decomposed simulations");
+    }
+
+    if (mParams.NUMA_PLACEMENT)
+    {
+        LOG_INFO("NUMA placement over " << NumaTopology::Get().NumNodes() << " node(s)");
+    }
+
+    checkGridBudget(mDecomposition->SlabDims());
+    mGrid = std::make_unique<Grid>(mParams, mDecomposition->SlabDims(), mDecomposition->SlabOrigin(), gridDimensions);
+}
+
+CPUSolver::~CPUSolver()
+{
+    if (mCheckpointThread.joinable())
+    {
+        mCheckpointThread.join();
+    }
+}
+
+std::unique_ptr<CPUSolver> CPUSolver::FromCheckpoint(const std::string& path)
 {
+    MappedFile file(path);
+    const CheckpointHeader header = ReadCheckpointHeader(file);
+
+    std::unique_ptr<CPUSolver> solver = std::make_unique<CPUSolver>(
+        IVec3(header.GridDims[0], header.GridDims[1], header.GridDims[2]),
+        header.FrameLength,
+        header.Params
+    );
+
+    solver->mStepNum = header.StepNum;
+    solver->mProgress.Start(solver->mStepNum, 0, solver->stepsPerFrame());
+    solver->fitMemoryBudget(header.NumParticles);
+    solver->mParticleSystem->RestoreParticles(
+        reinterpret_cast<const ParticleState*>(file.Data() + header.ParticleOffset), header.NumParticles, solver->mMt
+    );
+
+    if (solver->mSleepBlocks && header.NumSleepBlocks > 0)
+    {
+        solver->mSleepBlocks->RestoreQuietSteps(
+            reinterpret_cast<const Uint*>(file.Data() + header.SleepBlockOffset), header.NumSleepBlocks
+        );
+    }
+
+    solver->mStats.StepNum = solver->mStepNum;
+    solver->mStats.NumParticles = header.NumParticles;
+
+    return solver;
+}
+
+void CPUSolver::Checkpoint(const std::string& path)
+{
+    if (mDecomposition)
+    {
+        throw std::runtime_error("Checkpoints of decomposed simulations aren't supported");
+    }
+
+    WaitForCheckpoint();
+
+    const Uint numParticles = mParticleSystem->GetParticles().size();
+    const Uint copyBytes = numParticles * sizeof(ParticleState);
+    if (memoryBudget() > 0 && GetMemoryUsage().Total() + copyBytes > memoryBudget())
+    {
+        // No room for a copy, the particles are packed from the particle system while it's written
+        LOG_INFO("No memory budget left for a copy of the particles, writing the checkpoint before continuing");
+        TraceScope writeScope("write checkpoint", "io");
+        CheckpointData data;
+        data.Header = MakeCheckpointHeader(mParams, mGrid->Dims(), mFrameLength, mStepNum);
+        data.Source = mParticleSystem.get();
+        if (mSleepBlocks)
+        {
+            data.SleepBlockQuietSteps = mSleepBlocks->GetQuietSteps();
+        }
+        WriteCheckpoint(path, data);
+        return;
+    }
+
+    // Packing the particle state is the only part done on the simulation thread
+    TraceScope copyScope("checkpoint copy", "io");
+    std::shared_ptr<CheckpointData> data = std::make_shared<CheckpointData>();
+    data->Header = MakeCheckpointHeader(mParams, mGrid->Dims(), mFrameLength, mStepNum);
+    data->Particles.resize(numParticles);
+    mMt.IterateOverChunks(numParticles, [&](Uint low, Uint high, Uint threadIdx) {
+        mParticleSystem->SaveParticles(low, high - low, data->Particles.data() + low);
+    });
+    if (mSleepBlocks)
+    {
+        data->SleepBlockQuietSteps = mSleepBlocks->GetQuietSteps();
+    }
+    mSnapshotBytes = data->Particles.capacity() * sizeof(ParticleState);
+
+    mCheckpointThread = std::thread([this, path, data]() {
+        Trace::SetThreadLane(Trace::IO_LANE);
+        try
+        {
+            TraceScope writeScope("write checkpoint", "io");
+            WriteCheckpoint(path, *data);
+        }
+        catch (...)
+        {
+            mCheckpointError = std::current_exception();
+        }
+    });
+}
+
+void CPUSolver::WaitForCheckpoint()
+{
+    if (mCheckpointThread.joinable())
+    {
+        mCheckpointThread.join();
+    }
+    mSnapshotBytes = 0;
+
+    if (mCheckpointError)
+    {
+        std::exception_ptr error = mCheckpointError;
+        mCheckpointError = nullptr;
+        std::rethrow_exception(error);
+    }
 }
 
 void CPUSolver::Step(Float timestep)
 {
-    std::cout << "Beginning step " << mStepNum << "." << std::endl;
+    LOG_TRACE("Beginning step " << mStepNum);
 
-    mParticleSystem->CacheParticleGrads(*mGrid, mMt);
+    StepDiagnostics* diagnostics = mParams.DIAGNOSTICS ? &mStats.Diagnostics : nullptr;
+
+    beginPhase(SolverPhase::Weights);
+    mParticleSystem->CacheParticleGrads(*mGrid, mMt, diagnostics ? &diagnostics->ParticlesBefore : nullptr, mSleepBlocks.get());
+    if (mSleepBlocks)
+        mSleepBlocks->CacheContributions(*mParticleSystem, mMt);
 
     // @1:  Rasterize particle data to the grid
-    mGrid->RasterizeParticlesToGrid(*mParticleSystem, mMt);
+    beginPhase(SolverPhase::Rasterize);
+    mGrid->RasterizeParticlesToGrid(*mParticleSystem, mMt, mSleepBlocks.get());
+    if (mDecomposition)
+        mDecomposition->ExchangeGhostCells(*mGrid, GhostField::MassMomentum);
 
     // @2:  Compute particle volumes and densities
     if(mStepNum == 0)
+    {
+        beginPhase(SolverPhase::Volumes);
         mParticleSystem->EstimateParticleVolumes(*mGrid, mMt);
+    }
 
     // @3: Compute grid forces
-    mGrid->ComputeGridForces(*mParticleSystem, mMt);
+    beginPhase(SolverPhase::GridForces);
+    mGrid->ComputeGridForces(*mParticleSystem, mMt, mSleepBlocks.get());
+    if (mDecomposition)
+        mDecomposition->ExchangeGhostCells(*mGrid, GhostField::Force);
 
     // @4: Compute grid forces
-    mGrid->UpdateGridVelocities(timestep, mMt);
+    beginPhase(SolverPhase::GridVelocities);
+    mGrid->UpdateGridVelocities(timestep, mMt, diagnostics ? &diagnostics->Grid : nullptr);
 
     // @5:  Grid based body collisions
-    mGrid->DoGridBasedCollisions(timestep, mMt);
+    beginPhase(SolverPhase::GridCollisions);
+    const Float time = Float(mStepNum) * timestep;
+    for (Collider& collider : mColliders)
+    {
+        collider.SetTime(time);
+    }
+    mGrid->DoGridBasedCollisions(timestep, mColliders, mMt);
+    mGrid->ApplyBoundaryConditions(mMt);
 
     // @6:  Solve linear system
+    beginPhase(SolverPhase::LinearSolve);
     mGrid->SolveLinearSystem(timestep, mMt);
 
     // @7: Update deformation gradient
+    beginPhase(SolverPhase::DeformationUpdate);
     mParticleSystem->UpdateDeformationGradients(timestep, *mGrid, mMt);
 
     // @8: Update Particle Velocities
-    mParticleSystem->UpdateVelocities(*mGrid, mMt);
+    beginPhase(SolverPhase::ParticleVelocities);
+    mParticleSystem->UpdateVelocities(*mGrid, mMt, diagnostics ? &diagnostics->ParticlesAfter : nullptr);
 
     // @9: Particle-based body collisions  
-    mParticleSystem->BodyCollisions(timestep, mMt);
+    beginPhase(SolverPhase::ParticleCollisions);
+    mParticleSystem->BodyCollisions(timestep, mColliders, mSleepBlocks.get(), mMt);
 
     // @10:  Update particle positions
+    beginPhase(SolverPhase::Positions);
     mParticleSystem->UpdatePositions(timestep, mMt);
+    if (mDecomposition)
+        mDecomposition->MigrateParticles(*mParticleSystem);
 
-    // We've transferred everything to the particles.  Reset the accumulators.
+    // We've transferred everything to the particles.  Invalidate the accumulators (lazily cleared).
+    beginPhase(SolverPhase::Housekeeping);
     mGrid->ResetGrid();
 
+    // Put resting regions to sleep (and wake up the ones that got disturbed)
+    Uint sleeping = mSleepBlocks ? mSleepBlocks->Update(*mParticleSystem, mMt) : 0;
+
     mStepNum++;
+
+    const Uint numParticles = mParticleSystem->GetParticles().size();
+    mStats.StepNum = mStepNum;
+    mStats.NumParticles = numParticles;
+    mStats.SleepingParticles = sleeping;
+    mStats.SleepingFraction = numParticles > 0 ? Float(sleeping) / Float(numParticles) : 0.0;
+
+#if SNOW_VALIDATION != SNOW_VALIDATION_OFF
+    const Uint validationInterval = SNOW_VALIDATION == SNOW_VALIDATION_FULL ? 1 : mParams.VALIDATION_SUBSTEPS;
+    if (validationInterval > 0 && mStepNum % validationInterval == 0)
+    {
+        beginPhase(SolverPhase::Validation);
+        validateParticles();
+    }
+#endif
+    endPhases();
+
+    if (diagnostics && !std::isfinite(diagnostics->ParticlesAfter.KineticEnergy + diagnostics->ParticlesAfter.ElasticEnergy))
+    {
+        LOG_WARNING("Step " << mStepNum << ": the particle energy isn't finite anymore, the simulation is unstable");
+    }
+
+    if (mStepCallback)
+    {
+        mStepCallback(mStats);
+    }
 }
 
-void CPUSolver::NextFrame()
+void CPUSolver::validateParticles()
+{
+    const Uint invalid = mParticleSystem->FindInvalidParticle(mMt);
+    if (invalid < mParticleSystem->GetParticles().size())
+    {
+        const Particle& p = mParticleSystem->GetParticles()[invalid];
+        std::ostringstream message;
+        message << "Step " << mStepNum << ": particle " << invalid << " isn't finite anymore (pos "
+                << p.pos.x << " " << p.pos.y << " " << p.pos.z << ", velocity "
+                << p.velocity.x << " " << p.velocity.y << " " << p.velocity.z << ")";
+        LOG_ERROR(message.str());
+        throw std::runtime_error(message.str());
+    }
+}
+
+void CPUSolver::beginPhase(SolverPhase phase)
+{
+    if (mPhase != SolverPhase::Count)
+    {
+        endPhases();
+    }
+    else
+    {
+        if (mParams.PERF_COUNTERS && (!mPerfCounters || mPerfCountersThread != std::this_thread::get_id()))
+        {
+            mPerfCounters = std::make_unique<PerfCounters>();
+            mPerfCountersThread = std::this_thread::get_id();
+            for (Uint c = 0; c < PerfCounters::NUM_COUNTERS; c++)
+            {
+                mStats.CountersAvailable[c] = mPerfCounters->Available(PerfCounter(c));
+            }
+            if (!mPerfCounters->AnyAvailable())
+            {
+                LOG_WARNING("Hardware performance counters aren't available, only timing the phases");
+            }
+        }
+
+        if (mPerfCounters)
+        {
+            mPhaseCounters = mPerfCounters->Read();
+        }
+        mPhaseStart = std::chrono::steady_clock::now();
+    }
+
+    mPhase = phase;
+    if (Trace::Enabled())
+    {
+        Trace::SetCurrentName(SolverPhaseName(phase));
+        mPhaseTraceStart = Trace::Now();
+    }
+}
+
+void CPUSolver::endPhases()
+{
+    if (mPhase == SolverPhase::Count)
+    {
+        return;
+    }
+
+    PhaseStats& stats = mStats.Phases[Uint(mPhase)];
+
+    if (mPerfCounters)
+    {
+        const PerfCounters::Values counters = mPerfCounters->Read();
+        for (Uint c = 0; c < PerfCounters::NUM_COUNTERS; c++)
+        {
+            // Scaled counters that are being multiplexed can step back a little
+            stats.Counters[c] += counters[c] > mPhaseCounters[c] ? counters[c] - mPhaseCounters[c] : 0;
+        }
+        mPhaseCounters = counters;
+    }
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    stats.Seconds += std::chrono::duration<Float>(now - mPhaseStart).count();
+    mPhaseStart = now;
+
+    if (Trace::Enabled())
+    {
+        Trace::Record(SolverPhaseName(mPhase), "phase", mPhaseTraceStart, Trace::Now());
+        Trace::SetCurrentName("substep");
+    }
+    mPhase = SolverPhase::Count;
+}
+
+void CPUSolver::SetStepCallback(std::function<void(const SolverStats&)> callback)
+{
+    mStepCallback = std::move(callback);
+}
+
+Uint CPUSolver::stepsPerFrame() const
 {
     // Just do a constant timestep for now...  (TODO)
     const Float timestep = 0.0001;
 
     // Framelength needs to be divisible by timestep
-    const Uint stepsPerFrame = std::floor(mFrameLength / timestep);
+    return std::floor(mFrameLength / timestep);
+}
+
+void CPUSolver::NextFrame()
+{
+    const Uint stepsPerFrame = this->stepsPerFrame();
     assert(stepsPerFrame != 0);
 
+    TraceScope frameScope("frame");
     for (Uint i = 0; i < stepsPerFrame; i++) {
-        std::cout << "Time: " << Float(mStepNum) * mFrameLength / Float(stepsPerFrame) << std::endl;
-        Particle& p = mParticleSystem->GetParticles()[0];
-        std::cout << "[" << p.velocity.x << "," << p.velocity.y << "," << p.velocity.z << "]" << std::endl;
-        std::cout << "[" << p.pos.x << "," << p.pos.y << "," << p.pos.z << "]" << std::endl;
-
-        std::cout << "[" << p.m_F_p[0][0] << "," << p.m_F_p[1][1] << "," << p.m_F_p[2][2] << "]" << std::endl;
+        if (Log::Enabled(LogLevel::Debug) && !mParticleSystem->GetParticles().empty()) {
+            const Particle& p = mParticleSystem->GetParticles()[0];
+            LOG_DEBUG("Time: " << Float(mStepNum) * mFrameLength / Float(stepsPerFrame)
+                << " particle 0 velocity [" << p.velocity.x << "," << p.velocity.y << "," << p.velocity.z << "]"
+                << " pos [" << p.pos.x << "," << p.pos.y << "," << p.pos.z << "]"
+                << " F_p diagonal [" << p.m_F_p[0][0] << "," << p.m_F_p[1][1] << "," << p.m_F_p[2][2] << "]");
+        }
 
-        Step(mFrameLength / Float(stepsPerFrame));
+        {
+            TraceScope stepScope("substep");
+            Step(mFrameLength / Float(stepsPerFrame));
+        }
+        mProgress.Update(mStepNum);
     }
 }
 
+void CPUSolver::SetProgressTarget(Uint lastFrame)
+{
+    const Uint stepsPerFrame = this->stepsPerFrame();
+    mProgress.Start(mStepNum, lastFrame * stepsPerFrame, stepsPerFrame);
+}
+
 const std::shared_ptr<SimulationOutput> CPUSolver::GetOutput()
 {
+    // The particles use a different allocator, so they're copied once into a plain vector that
+    // the output takes over
+    const ParticleVector& particles = mParticleSystem->GetParticles();
     return std::shared_ptr<SimulationOutput>(
-        new SimulationOutput(mParticleSystem->GetParticles())
+        new SimulationOutput(std::vector<Particle>(particles.begin(), particles.end()))
     );
 }
 
+const std::shared_ptr<SimulationOutput> CPUSolver::GatherOutput()
+{
+    if (!mDecomposition)
+    {
+        return GetOutput();
+    }
+
+    return std::shared_ptr<SimulationOutput>(
+        new SimulationOutput(mDecomposition->GatherParticles(*mParticleSystem))
+    );
+}
+
+const SolverStats& CPUSolver::GetStats() const
+{
+    return mStats;
+}
+
+MemoryUsage CPUSolver::GetMemoryUsage() const
+{
+    MemoryUsage usage;
+    usage.Particles = mParticleSystem->ParticleBytes();
+    usage.WeightCache = mParticleSystem->WeightCacheBytes();
+    usage.GridCells = mGrid->CellBytes();
+    usage.Transfers = mGrid->TransferBytes() + (mSleepBlocks ? mSleepBlocks->AllocatedBytes() : 0);
+    usage.Snapshots = mSnapshotBytes;
+    return usage;
+}
+
+WeightCache CPUSolver::GetWeightCache() const
+{
+    return mParticleSystem->GetWeightCache();
+}
+
+Uint CPUSolver::memoryBudget() const
+{
+    return mParams.MEMORY_BUDGET_MB * 1024 * 1024;
+}
+
+void CPUSolver::checkGridBudget(const IVec3& dims) const
+{
+    const Uint cellBytes = Grid::EstimateCellBytes(dims);
+    if (memoryBudget() > 0 && cellBytes > memoryBudget())
+    {
+        std::ostringstream message;
+        message << "The grid cells alone need " << cellBytes / (1024 * 1024) << " MB, over the memory budget of "
+                << mParams.MEMORY_BUDGET_MB << " MB";
+        throw std::runtime_error(message.str());
+    }
+}
+
+MemoryUsage CPUSolver::projectedMemoryUsage(Uint numParticles, WeightCache cache) const
+{
+    // The transfers and sleep blocks are sized on the first substep, the cells when the grid is
+    // created
+    const Uint capacity = mParticleSystem->CapacityFor(numParticles);
+    MemoryUsage usage;
+    usage.Particles = capacity * sizeof(Particle);
+    usage.WeightCache = cache == WeightCache::Full ? capacity * sizeof(StencilCache) : 0;
+    usage.GridCells = mGrid->CellBytes();
+    usage.Transfers = std::max(Grid::EstimateTransferBytes(mParams, mGrid->Dims(), numParticles), mGrid->TransferBytes()) +
+        (mSleepBlocks ? mSleepBlocks->AllocatedBytes() : 0);
+    return usage;
+}
+
+void CPUSolver::fitMemoryBudget(Uint numParticles)
+{
+    if (memoryBudget() == 0)
+    {
+        return;
+    }
+
+    const WeightCache cache = mParticleSystem->GetWeightCache();
+    const MemoryUsage usage = projectedMemoryUsage(numParticles, cache);
+    if (usage.Total() <= memoryBudget())
+    {
+        return;
+    }
+
+    const MemoryUsage compact = projectedMemoryUsage(numParticles, WeightCache::Compact);
+    if (cache == WeightCache::Full && compact.Total() <= memoryBudget())
+    {
+        LOG_INFO(numParticles << " particles need " << DescribeMemoryUsage(usage) << " with the full weight cache, over the memory budget of "
+                 << mParams.MEMORY_BUDGET_MB << " MB - switching to the compact weight cache");
+        mParticleSystem->SetWeightCache(WeightCache::Compact);
+        return;
+    }
+
+    std::ostringstream message;
+    message << numParticles << " particles need " << DescribeMemoryUsage(compact) << ", over the memory budget of "
+            << mParams.MEMORY_BUDGET_MB << " MB";
+    throw std::runtime_error(message.str());
+}
+
+Uint CPUSolver::GetFrameNum() const
+{
+    return mStepNum / stepsPerFrame();
+}
+
 void CPUSolver::AddParticle(const Vec3& pos, const Vec3& velocity, const Float mass)
 {
-    mParticleSystem->AddParticle(pos, velocity, mass);
+    if (!mDecomposition || mDecomposition->Owns(pos))
+    {
+        fitMemoryBudget(mParticleSystem->GetParticles().size() + 1);
+        mParticleSystem->AddParticle(pos, velocity, mass);
+    }
+}
+
+
+void CPUSolver::AddParticles(const ParticleSeed* seeds, Uint count)
+{
+    if (!mDecomposition)
+    {
+        fitMemoryBudget(mParticleSystem->GetParticles().size() + count);
+        mParticleSystem->AddParticles(seeds, count);
+        return;
+    }
+
+    std::vector<ParticleSeed> owned;
+    for (Uint i = 0; i < count; i++)
+    {
+        if (mDecomposition->Owns(seeds[i].pos))
+        {
+            owned.push_back(seeds[i]);
+        }
+    }
+    fitMemoryBudget(mParticleSystem->GetParticles().size() + owned.size());
+    mParticleSystem->AddParticles(owned.data(), owned.size());
+}
+
+void CPUSolver::AddCollider(const Collider& collider)
+{
+    mColliders.push_back(collider);
+}
+
+void CPUSolver::Emit(const Emitter& emitter)
+{
+    std::vector<ParticleSeed> seeds = emitter.Sample(mMt);
+    AddParticles(seeds.data(), seeds.size());
 }
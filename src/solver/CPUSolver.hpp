@@ -6,6 +6,20 @@
 #include "ParticleSystem.hpp"
 #include "Grid.hpp"
 #include "Multithread.hpp"
+#include "SleepBlocks.hpp"
+#include "SolverStats.hpp"
+#include "Emitter.hpp"
+#include "Collider.hpp"
+#include "DomainDecomposition.hpp"
+#include "Log.hpp"
+#include "PerfCounters.hpp"
+#include "Trace.hpp"
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
 
 class Grid;
 class ParticleSystem;
@@ -15,20 +29,116 @@ class CPUSolver
 public:
     CPUSolver(const IVec3& gridDimensions, Float frameLength, const SimulationParameters& params);
 
+    // One rank of a domain decomposed simulation - every rank of the transport creates its own
+    // solver with the same arguments and only simulates its slab of the grid (see
+    // DomainDecomposition).  Particles added outside the slab are ignored, so every rank can be
+    // handed the full scene.  Sleeping and checkpoints aren't supported yet and throw
+    // std::runtime_error.
+    CPUSolver(const IVec3& gridDimensions, Float frameLength, const SimulationParameters& params, std::shared_ptr<Transport> transport);
+
+    ~CPUSolver();
+
+    // Recreates a solver from a file written by Checkpoint.  Throws std::runtime_error
+    // if the file can't be read or was written by an incompatible build.
+    static std::unique_ptr<CPUSolver> FromCheckpoint(const std::string& path);
+
     virtual void AddParticle(const Vec3& pos, const Vec3& velocity, const Float mass);
+    virtual void AddParticles(const ParticleSeed* seeds, Uint count);
+
+    // Samples the emitter on the solver's threads and adds the particles
+    void Emit(const Emitter& emitter);
+
+    // Colliders are part of the scene setup rather than the simulation state - they aren't
+    // checkpointed and have to be added again after FromCheckpoint
+    void AddCollider(const Collider& collider);
 
     virtual void NextFrame();
 
+    // Lets the progress summaries (see ProgressReporter) report a percentage and ETA for a run
+    // that ends after lastFrame frames
+    void SetProgressTarget(Uint lastFrame);
+
     // Returns the list of particles present in the current simulation step of this solver.
     // Performs a full copy of the particle list so only call this when needed.
+    // Decomposed solvers only return the particles of their own slab.
     virtual const std::shared_ptr<SimulationOutput> GetOutput();
 
+    // Decomposed solvers:  collects the particles of all ranks on rank 0, the other ranks get an
+    // empty output.  Has to be called on every rank.  Same as GetOutput otherwise.
+    const std::shared_ptr<SimulationOutput> GatherOutput();
+
+    // Also has the time (and with PERF_COUNTERS the hardware counters) of every phase of the
+    // substeps so far, see LogPhaseStats
+    const SolverStats& GetStats() const;
+
+    // What the solver has allocated right now (see SimulationParameters::MEMORY_BUDGET_MB)
+    MemoryUsage GetMemoryUsage() const;
+
+    // WEIGHT_CACHE, unless the full cache didn't fit into the memory budget
+    WeightCache GetWeightCache() const;
+
+    // Called with the stats after every substep (eg. to watch the diagnostics for instabilities)
+    void SetStepCallback(std::function<void(const SolverStats&)> callback);
+
+    // Number of frames simulated so far
+    Uint GetFrameNum() const;
+
+    // Snapshots the full solver state (particles, step number, parameters and sleep state) and
+    // writes it to path on a background thread, so this only stalls for packing the particle
+    // state (see ParticleState).  Waits for the previous checkpoint to finish first.
+    void Checkpoint(const std::string& path);
+
+    // Blocks until the last checkpoint is on disk and rethrows any error that happened while writing it
+    void WaitForCheckpoint();
+
 private:
     void Step(Float timestep);
 
+    // MEMORY_BUDGET_MB in bytes, 0 without a budget
+    Uint memoryBudget() const;
+
+    // Throws std::runtime_error if the cells of a grid of the given size don't fit the budget
+    void checkGridBudget(const IVec3& dims) const;
+
+    // What the solver would have allocated with numParticles particles and the given cache
+    MemoryUsage projectedMemoryUsage(Uint numParticles, WeightCache cache) const;
+
+    // Switches to the compact weight cache if that's what it takes for numParticles particles
+    // to fit into the budget.  Throws std::runtime_error if they don't fit either way.
+    void fitMemoryBudget(Uint numParticles);
+
+    // Throws std::runtime_error if any particle went NaN/Inf (see SNOW_VALIDATION)
+    void validateParticles();
+    Uint stepsPerFrame() const;
+
+    // Every phase of a substep starts with beginPhase, which ends the one before it.  Ending a
+    // phase adds its time (and counters) to mStats.Phases and records it in the trace.
+    void beginPhase(SolverPhase phase);
+    void endPhases();
+
+    const SimulationParameters mParams;
     Float mFrameLength;
     std::unique_ptr<Grid> mGrid;
     std::unique_ptr<ParticleSystem> mParticleSystem;
+    std::unique_ptr<SleepBlocks> mSleepBlocks; // Only when sleeping is enabled
+    std::vector<Collider> mColliders;
+    std::unique_ptr<DomainDecomposition> mDecomposition; // Only for decomposed simulations
     Uint mStepNum;
     MTIterator mMt;
+    SolverStats mStats;
+    ProgressReporter mProgress;
+    std::function<void(const SolverStats&)> mStepCallback;
+
+    // Only with PERF_COUNTERS.  Opened by the thread running the substeps, since they only count
+    // the threads it starts.
+    std::unique_ptr<PerfCounters> mPerfCounters;
+    std::thread::id mPerfCountersThread;
+    PerfCounters::Values mPhaseCounters;
+    std::chrono::steady_clock::time_point mPhaseStart;
+    SolverPhase mPhase; // Count between substeps
+    Float mPhaseTraceStart;
+
+    std::thread mCheckpointThread;
+    std::exception_ptr mCheckpointError;
+    Uint mSnapshotBytes; // Copy held by the checkpoint thread
 };
\ No newline at end of file
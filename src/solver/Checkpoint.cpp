@@ -0,0 +1,118 @@
+#include "Checkpoint.hpp"
+
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static const char CHECKPOINT_MAGIC[8] = { 'S', 'N', 'O', 'W', 'C', 'K', 'P', 'T' };
+
+// Particles packed at a time when writing straight from a ParticleSystem
+static const Uint PACK_BLOCK_SIZE = 16384;
+
+// Sections start on cache line boundaries
+static Uint alignOffset(Uint offset)
+{
+    return (offset + 63) & ~Uint(63);
+}
+
+CheckpointHeader MakeCheckpointHeader(
+    const SimulationParameters& params, const IVec3& gridDims, Float frameLength, Uint stepNum)
+{
+    CheckpointHeader header{};
+    std::memcpy(header.Magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.Version = CHECKPOINT_VERSION;
+    header.ParticleSize = sizeof(ParticleState);
+    header.ParamsSize = sizeof(SimulationParameters);
+    header.GridDims[0] = gridDims.x;
+    header.GridDims[1] = gridDims.y;
+    header.GridDims[2] = gridDims.z;
+    header.FrameLength = frameLength;
+    header.StepNum = stepNum;
+    header.Params = params;
+    return header;
+}
+
+void WriteCheckpoint(const std::string& path, CheckpointData& data)
+{
+    CheckpointHeader& header = data.Header;
+    header.NumParticles = data.Source ? data.Source->GetParticles().size() : data.Particles.size();
+    header.ParticleOffset = alignOffset(sizeof(CheckpointHeader));
+    header.NumSleepBlocks = data.SleepBlockQuietSteps.size();
+    header.SleepBlockOffset = alignOffset(header.ParticleOffset + header.NumParticles * sizeof(ParticleState));
+
+    const std::string tmpPath = path + ".tmp";
+    FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("Could not open " + tmpPath + " for writing");
+    }
+
+    const char padding[64] = {};
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(padding, 1, header.ParticleOffset - sizeof(header), file) == header.ParticleOffset - sizeof(header);
+    if (data.Source)
+    {
+        std::vector<ParticleState> block(std::min(header.NumParticles, PACK_BLOCK_SIZE));
+        for (Uint first = 0; ok && first < header.NumParticles; first += PACK_BLOCK_SIZE)
+        {
+            const Uint count = std::min(header.NumParticles - first, PACK_BLOCK_SIZE);
+            data.Source->SaveParticles(first, count, block.data());
+            ok = std::fwrite(block.data(), sizeof(ParticleState), count, file) == count;
+        }
+    }
+    else
+    {
+        ok = ok && std::fwrite(data.Particles.data(), sizeof(ParticleState), data.Particles.size(), file) == data.Particles.size();
+    }
+
+    const Uint particleEnd = header.ParticleOffset + header.NumParticles * sizeof(ParticleState);
+    ok = ok && std::fwrite(padding, 1, header.SleepBlockOffset - particleEnd, file) == header.SleepBlockOffset - particleEnd;
+    ok = ok && std::fwrite(data.SleepBlockQuietSteps.data(), sizeof(Uint), data.SleepBlockQuietSteps.size(), file) == data.SleepBlockQuietSteps.size();
+    ok = std::fclose(file) == 0 && ok;
+
+    if (!ok)
+    {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Could not write checkpoint " + path);
+    }
+
+#ifdef _WIN32
+    // rename doesn't replace existing files on Windows
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("Could not move checkpoint into place at " + path);
+    }
+}
+
+CheckpointHeader ReadCheckpointHeader(const MappedFile& file)
+{
+    CheckpointHeader header;
+    if (file.Size() < sizeof(header))
+    {
+        throw std::runtime_error("Checkpoint is truncated");
+    }
+    std::memcpy(&header, file.Data(), sizeof(header));
+
+    if (std::memcmp(header.Magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+    {
+        throw std::runtime_error("Not a checkpoint file");
+    }
+    if (header.Version != CHECKPOINT_VERSION ||
+        header.ParticleSize != sizeof(ParticleState) ||
+        header.ParamsSize != sizeof(SimulationParameters))
+    {
+        throw std::runtime_error("Checkpoint was written by an incompatible version");
+    }
+    if (header.ParticleOffset + header.NumParticles * sizeof(ParticleState) > file.Size() ||
+        header.SleepBlockOffset + header.NumSleepBlocks * sizeof(Uint) > file.Size())
+    {
+        throw std::runtime_error("Checkpoint is truncated");
+    }
+
+    return header;
+}
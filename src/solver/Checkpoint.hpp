@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SimulationParameters.hpp"
+#include "ParticleSystem.hpp"
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class MappedFile;
+
+// A checkpoint is a fixed header followed by the raw ParticleState array and the sleep block
+// counters, so restoring it is a mapping and two copies with no parsing.  The layout is only
+// valid for builds with the same ParticleState/SimulationParameters layout, which the header
+// records and checks.
+static const uint32_t CHECKPOINT_VERSION = 2;
+
+struct CheckpointHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ParticleSize;
+    uint32_t ParamsSize;
+    int32_t GridDims[3];
+    Float FrameLength;
+    uint64_t StepNum;
+    uint64_t RngState; // Reserved for the solver side random state
+
+    uint64_t NumParticles;
+    uint64_t ParticleOffset; // Byte offsets from the start of the file
+    uint64_t NumSleepBlocks;
+    uint64_t SleepBlockOffset;
+
+    SimulationParameters Params;
+};
+
+// Written and mapped back as raw bytes
+static_assert(std::is_trivially_copyable<CheckpointHeader>::value, "CheckpointHeader has to be trivially copyable");
+
+// Solver state copied out of a solver so it can be written while the solver keeps going.  With
+// Source set the particles are packed from it block by block while they are written instead
+// (Particles stays empty), for checkpoints with no memory left for a copy.
+struct CheckpointData
+{
+    CheckpointHeader Header;
+    std::vector<ParticleState> Particles;
+    const ParticleSystem* Source = nullptr;
+    std::vector<Uint> SleepBlockQuietSteps;
+};
+
+CheckpointHeader MakeCheckpointHeader(
+    const SimulationParameters& params, const IVec3& gridDims, Float frameLength, Uint stepNum
+);
+
+// Writes to a temporary file first and moves it over path once complete, so a crash while
+// writing leaves the previous checkpoint intact.  Throws std::runtime_error on failure.
+void WriteCheckpoint(const std::string& path, CheckpointData& data);
+
+// Validates the mapped file and returns its header.  Throws std::runtime_error if the file
+// isn't a checkpoint of this build.
+CheckpointHeader ReadCheckpointHeader(const MappedFile& file);
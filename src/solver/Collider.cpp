@@ -0,0 +1,230 @@
+#include "Collider.hpp"
+
+#include "Math.hpp"
+#include "Mesh.hpp"
+#include "MeshBVH.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+ColliderSDF::ColliderSDF(const Mesh& mesh, Float voxelSize, Float padding, MTIterator& mt)
+{
+    init(mesh.Min() - Vec3(padding), mesh.Max() + Vec3(padding), voxelSize);
+
+    MeshBVH bvh(mesh, mt);
+    mt.IterateOverIndices(mDistance.size(), [&](Uint idx) {
+        const IVec3 c(idx % mDims.x, (idx / mDims.x) % mDims.y, idx / (Uint(mDims.x) * mDims.y));
+        const Vec3 pos = mMin + Vec3(c) * mVoxelSize;
+        const Float d = bvh.ClosestPoint(pos).Distance;
+        mDistance[idx] = bvh.Inside(pos) ? -d : d;
+    });
+}
+
+ColliderSDF::ColliderSDF(const Vec3& min, const Vec3& max, Float voxelSize, const std::function<Float(const Vec3&)>& distance, MTIterator& mt)
+{
+    init(min, max, voxelSize);
+
+    mt.IterateOverIndices(mDistance.size(), [&](Uint idx) {
+        const IVec3 c(idx % mDims.x, (idx / mDims.x) % mDims.y, idx / (Uint(mDims.x) * mDims.y));
+        mDistance[idx] = distance(mMin + Vec3(c) * mVoxelSize);
+    });
+}
+
+void ColliderSDF::init(const Vec3& min, const Vec3& max, Float voxelSize)
+{
+    mMin = min;
+    mVoxelSize = voxelSize;
+    mDims = IVec3(glm::ceil((max - min) / voxelSize)) + IVec3(1);
+    mMax = mMin + Vec3(mDims - IVec3(1)) * mVoxelSize;
+    mDistance.resize(Uint(mDims.x) * mDims.y * mDims.z);
+}
+
+Float ColliderSDF::at(int i, int j, int k) const
+{
+    return mDistance[i + Uint(mDims.x) * (j + Uint(mDims.y) * k)];
+}
+
+Float ColliderSDF::Distance(const Vec3& local) const
+{
+    const Vec3 clamped = glm::clamp(local, mMin, mMax);
+    const Vec3 x = (clamped - mMin) / mVoxelSize;
+
+    const IVec3 base = glm::min(IVec3(glm::floor(x)), mDims - IVec3(2));
+    const Vec3 f = x - Vec3(base);
+
+    // Trilinear, z then y then x
+    Float c[2][2];
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            c[i][j] = at(base.x + i, base.y + j, base.z) * (1.0 - f.z) + at(base.x + i, base.y + j, base.z + 1) * f.z;
+        }
+    }
+    const Float c0 = c[0][0] * (1.0 - f.y) + c[0][1] * f.y;
+    const Float c1 = c[1][0] * (1.0 - f.y) + c[1][1] * f.y;
+    const Float d = c0 * (1.0 - f.x) + c1 * f.x;
+
+    return d + glm::length(local - clamped);
+}
+
+Vec3 ColliderSDF::Normal(const Vec3& local) const
+{
+    const Float h = 0.5 * mVoxelSize;
+    const Vec3 grad(
+        Distance(local + Vec3(h, 0.0, 0.0)) - Distance(local - Vec3(h, 0.0, 0.0)),
+        Distance(local + Vec3(0.0, h, 0.0)) - Distance(local - Vec3(0.0, h, 0.0)),
+        Distance(local + Vec3(0.0, 0.0, h)) - Distance(local - Vec3(0.0, 0.0, h))
+    );
+    const Float len = glm::length(grad);
+    return len > 0.0 ? grad / len : Vec3(0.0, 0.0, 1.0);
+}
+
+const Vec3& ColliderSDF::Min() const
+{
+    return mMin;
+}
+
+const Vec3& ColliderSDF::Max() const
+{
+    return mMax;
+}
+
+Collider::Collider(std::shared_ptr<const ColliderSDF> sdf, const Vec3& translation, const Mat3& rotation,
+                   const Vec3& velocity, const Vec3& angularVelocity, Float friction) :
+    mSDF(sdf),
+    mFriction(friction),
+    mInitialTranslation(translation),
+    mInitialRotation(rotation),
+    mConstantVelocity(velocity),
+    mConstantAngularVelocity(angularVelocity)
+{
+    SetTime(0.0);
+}
+
+Collider::Collider(std::shared_ptr<const ColliderSDF> sdf, std::vector<ColliderKeyframe> keyframes, Float friction) :
+    mSDF(sdf),
+    mKeyframes(std::move(keyframes)),
+    mFriction(friction),
+    mInitialTranslation(0.0),
+    mInitialRotation(1.0),
+    mConstantVelocity(0.0),
+    mConstantAngularVelocity(0.0)
+{
+    if (mKeyframes.empty())
+    {
+        throw std::runtime_error("Keyframed collider needs at least one keyframe");
+    }
+    SetTime(0.0);
+}
+
+void Collider::SetTime(Float t)
+{
+    if (mKeyframes.empty())
+    {
+        mTranslation = mInitialTranslation + mConstantVelocity * t;
+        mRotation = rotationFromAxisAngle(mConstantAngularVelocity * t) * mInitialRotation;
+        mVelocity = mConstantVelocity;
+        mAngularVelocity = mConstantAngularVelocity;
+    }
+    else if (t <= mKeyframes.front().Time || t >= mKeyframes.back().Time)
+    {
+        const ColliderKeyframe& key = t <= mKeyframes.front().Time ? mKeyframes.front() : mKeyframes.back();
+        mTranslation = key.Translation;
+        mRotation = key.Rotation;
+        mVelocity = Vec3(0.0);
+        mAngularVelocity = Vec3(0.0);
+    }
+    else
+    {
+        auto next = std::upper_bound(mKeyframes.begin(), mKeyframes.end(), t, [](Float time, const ColliderKeyframe& key) {
+            return time < key.Time;
+        });
+        const ColliderKeyframe& k1 = *next;
+        const ColliderKeyframe& k0 = *(next - 1);
+
+        const Float dt = k1.Time - k0.Time;
+        const Float s = (t - k0.Time) / dt;
+
+        // Rotation from k0 to k1 in k0's frame
+        const Vec3 arc = axisAngleFromRotation(glm::transpose(k0.Rotation) * k1.Rotation);
+
+        mTranslation = k0.Translation + (k1.Translation - k0.Translation) * s;
+        mRotation = k0.Rotation * rotationFromAxisAngle(arc * s);
+        mVelocity = (k1.Translation - k0.Translation) / dt;
+        mAngularVelocity = mRotation * arc / dt;
+    }
+
+    updateBounds();
+}
+
+void Collider::updateBounds()
+{
+    mWorldMin = Vec3(std::numeric_limits<Float>::infinity());
+    mWorldMax = Vec3(-std::numeric_limits<Float>::infinity());
+    for (int corner = 0; corner < 8; corner++)
+    {
+        const Vec3 local(
+            (corner & 1) ? mSDF->Max().x : mSDF->Min().x,
+            (corner & 2) ? mSDF->Max().y : mSDF->Min().y,
+            (corner & 4) ? mSDF->Max().z : mSDF->Min().z
+        );
+        const Vec3 world = mRotation * local + mTranslation;
+        mWorldMin = glm::min(mWorldMin, world);
+        mWorldMax = glm::max(mWorldMax, world);
+    }
+}
+
+Float Collider::Distance(const Vec3& pos) const
+{
+    return mSDF->Distance(glm::transpose(mRotation) * (pos - mTranslation));
+}
+
+Vec3 Collider::VelocityAt(const Vec3& pos) const
+{
+    return mVelocity + glm::cross(mAngularVelocity, pos - mTranslation);
+}
+
+bool Collider::Collide(const Vec3& pos, Vec3& velocity) const
+{
+    // Everything outside the baked box has a positive distance
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (pos[axis] < mWorldMin[axis] || pos[axis] > mWorldMax[axis])
+        {
+            return false;
+        }
+    }
+
+    const Vec3 local = glm::transpose(mRotation) * (pos - mTranslation);
+    if (mSDF->Distance(local) > 0.0)
+    {
+        return false;
+    }
+
+    const Vec3 normal = mRotation * mSDF->Normal(local);
+    const Vec3 colliderVelocity = VelocityAt(pos);
+    const Vec3 relative = velocity - colliderVelocity;
+
+    const Float vn = glm::dot(relative, normal);
+    if (vn >= 0.0)
+    {
+        // Already separating
+        return true;
+    }
+
+    const Vec3 tangential = relative - normal * vn;
+    const Float vt = glm::length(tangential);
+    if (vt <= -mFriction * vn)
+    {
+        // Static friction - moves with the collider
+        velocity = colliderVelocity;
+    }
+    else
+    {
+        velocity = colliderVelocity + tangential * (1.0 + mFriction * vn / vt);
+    }
+    return true;
+}
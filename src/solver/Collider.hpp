@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Mesh;
+class MTIterator;
+
+// Signed distance field of a collider shape (negative inside), baked once on a regular grid in
+// the shape's local space.  Moving colliders only move their transform, so the field never has
+// to be rebuilt while they animate.
+class ColliderSDF
+{
+public:
+    // Bakes a closed mesh with voxelSize spacing over its bounds grown by padding on every side
+    ColliderSDF(const Mesh& mesh, Float voxelSize, Float padding, MTIterator& mt);
+
+    // Bakes an arbitrary signed distance function over [min, max]
+    ColliderSDF(const Vec3& min, const Vec3& max, Float voxelSize, const std::function<Float(const Vec3&)>& distance, MTIterator& mt);
+
+    // Trilinearly interpolated distance.  Outside the baked box the distance to the box is added
+    // to the value on its border.
+    Float Distance(const Vec3& local) const;
+
+    // Normalized gradient of the distance
+    Vec3 Normal(const Vec3& local) const;
+
+    const Vec3& Min() const;
+    const Vec3& Max() const;
+
+private:
+    void init(const Vec3& min, const Vec3& max, Float voxelSize);
+    Float at(int i, int j, int k) const;
+
+    Vec3 mMin;
+    Vec3 mMax;
+    Float mVoxelSize;
+    IVec3 mDims; // Number of samples per axis
+    std::vector<Float> mDistance;
+};
+
+struct ColliderKeyframe
+{
+    Float Time;
+    Vec3 Translation;
+    Mat3 Rotation;
+};
+
+// A rigid body moving through the snow.  A world position x maps into the local space of its SDF
+// as R^T (x - T).  Snow touching the collider gets the relative velocity friction response:  it
+// can't move into the collider, and its tangential velocity relative to the collider is reduced by
+// Friction times the normal velocity (or stops entirely when that's enough to stick).
+class Collider
+{
+public:
+    // Moves with constant linear and angular velocity (world space, rotating around the
+    // translation) starting from the given pose at time 0
+    Collider(std::shared_ptr<const ColliderSDF> sdf, const Vec3& translation, const Mat3& rotation,
+             const Vec3& velocity, const Vec3& angularVelocity, Float friction);
+
+    // Follows keyframes sorted by time.  Translation is interpolated linearly and rotation along
+    // the shortest arc between keys.  Before the first and after the last key the collider rests.
+    Collider(std::shared_ptr<const ColliderSDF> sdf, std::vector<ColliderKeyframe> keyframes, Float friction);
+
+    // Moves the collider to its pose at time t.  Called once per substep, before the collision passes.
+    void SetTime(Float t);
+
+    Float Distance(const Vec3& pos) const;
+
+    // Velocity of the collider's surface at pos
+    Vec3 VelocityAt(const Vec3& pos) const;
+
+    // Applies the collision response to material at pos moving with velocity.  Returns false (and
+    // leaves velocity alone) if pos isn't in contact with the collider.  Thread safe.
+    bool Collide(const Vec3& pos, Vec3& velocity) const;
+
+private:
+    void updateBounds();
+
+    std::shared_ptr<const ColliderSDF> mSDF;
+    std::vector<ColliderKeyframe> mKeyframes; // Empty for constant motion
+    Float mFriction;
+
+    // Constant motion
+    Vec3 mInitialTranslation;
+    Mat3 mInitialRotation;
+    Vec3 mConstantVelocity;
+    Vec3 mConstantAngularVelocity;
+
+    // Pose at the current time
+    Vec3 mTranslation;
+    Mat3 mRotation;
+    Vec3 mVelocity;
+    Vec3 mAngularVelocity;
+
+    // World space bounds of the baked box, to skip most queries early
+    Vec3 mWorldMin;
+    Vec3 mWorldMax;
+};
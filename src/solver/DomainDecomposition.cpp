@@ -0,0 +1,148 @@
+#include "DomainDecomposition.hpp"
+
+#include "ParticleSystem.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+DomainDecomposition::DomainDecomposition(std::shared_ptr<Transport> transport, const IVec3& domainDims, Float h) :
+    mTransport(transport),
+    mDomainDims(domainDims),
+    mH(h)
+{
+    // Overlap bands of the two ends of a slab must not touch, otherwise a cell would be
+    // shared by three ranks
+    if (domainDims.x / mTransport->NumRanks() < 2 * Grid::HALO)
+    {
+        throw std::runtime_error("Grid is too narrow for " + std::to_string(mTransport->NumRanks()) + " slabs");
+    }
+}
+
+int DomainDecomposition::Rank() const
+{
+    return mTransport->Rank();
+}
+
+int DomainDecomposition::NumRanks() const
+{
+    return mTransport->NumRanks();
+}
+
+int DomainDecomposition::slabBegin(int rank) const
+{
+    return int(Uint(mDomainDims.x) * Uint(rank) / Uint(NumRanks()));
+}
+
+IVec3 DomainDecomposition::SlabOrigin() const
+{
+    return IVec3(slabBegin(Rank()), 0, 0);
+}
+
+IVec3 DomainDecomposition::SlabDims() const
+{
+    return IVec3(slabBegin(Rank() + 1) - slabBegin(Rank()), mDomainDims.y, mDomainDims.z);
+}
+
+bool DomainDecomposition::Owns(const Vec3& pos) const
+{
+    // The outer slabs also own whatever is outside the domain, it gets clamped back in
+    const int cell = int(std::floor(pos.x / mH));
+    return (Rank() == 0 || cell >= slabBegin(Rank())) &&
+           (Rank() == NumRanks() - 1 || cell < slabBegin(Rank() + 1));
+}
+
+template<typename Func>
+void DomainDecomposition::exchangeWithNeighbours(Func f)
+{
+    const int rank = Rank();
+    const int first = rank % 2 == 0 ? rank + 1 : rank - 1;
+    const int second = rank % 2 == 0 ? rank - 1 : rank + 1;
+
+    for (int peer : { first, second })
+    {
+        if (peer >= 0 && peer < NumRanks())
+        {
+            f(peer);
+        }
+    }
+}
+
+void DomainDecomposition::ExchangeGhostCells(Grid& grid, GhostField field)
+{
+    exchangeWithNeighbours([&](int peer) {
+        // The band around the boundary shared with the peer
+        const int boundary = peer > Rank() ? slabBegin(Rank() + 1) : slabBegin(Rank());
+        const int xBegin = boundary - Grid::HALO;
+        const int xEnd = boundary + Grid::HALO;
+
+        grid.PackGhostCells(xBegin, xEnd, field, mPackBuffer);
+        std::vector<uint8_t> incoming = mTransport->Exchange(peer, mPackBuffer.data(), mPackBuffer.size() * sizeof(Float));
+        if (incoming.size() != mPackBuffer.size() * sizeof(Float))
+        {
+            throw std::runtime_error("Mismatched ghost cell exchange with rank " + std::to_string(peer));
+        }
+        grid.AddGhostCells(xBegin, xEnd, field, reinterpret_cast<const Float*>(incoming.data()));
+    });
+}
+
+void DomainDecomposition::MigrateParticles(ParticleSystem& ps)
+{
+    ParticleVector& particles = ps.GetParticles();
+    const Float slabMin = slabBegin(Rank()) * mH;
+
+    // Kept particles stay in order at the front
+    auto leaving = std::stable_partition(particles.begin(), particles.end(), [&](const Particle& p) {
+        return Owns(Vec3(p.pos));
+    });
+    std::vector<Particle> outgoing(leaving, particles.end());
+    particles.erase(leaving, particles.end());
+    const Uint kept = particles.size();
+
+    exchangeWithNeighbours([&](int peer) {
+        std::vector<Particle> send;
+        for (const Particle& p : outgoing)
+        {
+            const bool leftwards = p.pos.x < slabMin;
+            if (leftwards == (peer < Rank()))
+            {
+                send.push_back(p);
+            }
+        }
+
+        std::vector<uint8_t> incoming = mTransport->Exchange(peer, send.data(), send.size() * sizeof(Particle));
+        const Particle* received = reinterpret_cast<const Particle*>(incoming.data());
+        particles.insert(particles.end(), received, received + incoming.size() / sizeof(Particle));
+    });
+
+    // A particle that crossed a whole slab in one substep ended up on a rank whose grid doesn't
+    // reach it (it would be clamped into the wrong slab)
+    for (Uint i = kept; i < particles.size(); i++)
+    {
+        if (!Owns(Vec3(particles[i].pos)))
+        {
+            throw std::runtime_error("A particle at x = " + std::to_string(particles[i].pos.x) + " moved past the slab of rank " +
+                std::to_string(Rank()) + " in one substep, the timestep is too large for slabs this narrow");
+        }
+    }
+}
+
+std::vector<Particle> DomainDecomposition::GatherParticles(const ParticleSystem& ps)
+{
+    const ParticleVector& local = ps.GetParticles();
+
+    if (Rank() != 0)
+    {
+        mTransport->Exchange(0, local.data(), local.size() * sizeof(Particle));
+        return {};
+    }
+
+    std::vector<Particle> all(local.begin(), local.end());
+    for (int peer = 1; peer < NumRanks(); peer++)
+    {
+        std::vector<uint8_t> incoming = mTransport->Exchange(peer, nullptr, 0);
+        const Particle* received = reinterpret_cast<const Particle*>(incoming.data());
+        all.insert(all.end(), received, received + incoming.size() / sizeof(Particle));
+    }
+    return all;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Grid.hpp"
+#include "Transport.hpp"
+
+#include <memory>
+#include <vector>
+
+class ParticleSystem;
+class Particle;
+
+// Splits the grid into slabs along x, one per rank of the transport.  Every rank simulates the
+// particles inside its slab on a grid covering the slab plus its halo.  Neighbouring grids overlap
+// by HALO cells on either side of the slab boundary, and both only hold partial sums over that
+// band after the transfers from their own particles.  Every substep the ranks add each other's
+// partial sums (mass and momentum, then forces) so both end up with the complete values, and
+// particles that moved into another slab are handed over to its owner.
+class DomainDecomposition
+{
+public:
+    // Throws std::runtime_error if the slabs would be narrower than 2 * HALO cells
+    DomainDecomposition(std::shared_ptr<Transport> transport, const IVec3& domainDims, Float h);
+
+    int Rank() const;
+    int NumRanks() const;
+
+    // The cells of this rank's slab
+    IVec3 SlabOrigin() const;
+    IVec3 SlabDims() const;
+
+    // Whether a particle at pos belongs to this rank
+    bool Owns(const Vec3& pos) const;
+
+    // Completes the overlap bands of the grid with the neighbours' partial sums
+    void ExchangeGhostCells(Grid& grid, GhostField field);
+
+    // Hands the particles that left the slab over to the neighbouring ranks and takes in theirs.
+    // Particles move less than a cell per substep so they only ever reach the neighbours - throws
+    // std::runtime_error if one received from a neighbour still isn't in this slab.
+    void MigrateParticles(ParticleSystem& ps);
+
+    // Collects the particles of every rank on rank 0 (in rank order).  The other ranks get an
+    // empty list.  Has to be called on all ranks.
+    std::vector<Particle> GatherParticles(const ParticleSystem& ps);
+
+private:
+    int slabBegin(int rank) const;
+
+    // Exchanges with the left and right neighbours, pairing up ranks (0, 1), (2, 3), ... first and
+    // (1, 2), (3, 4), ... second so the chain never waits on itself.  Each call gets the peer and
+    // returns the message for it.
+    template<typename Func>
+    void exchangeWithNeighbours(Func f);
+
+    std::shared_ptr<Transport> mTransport;
+    const IVec3 mDomainDims;
+    const Float mH;
+    std::vector<Float> mPackBuffer;
+};
@@ -0,0 +1,243 @@
+#include "Emitter.hpp"
+
+#include "Multithread.hpp"
+#include "Random.hpp"
+#include "MeshVolume.hpp"
+
+#include <algorithm>
+
+Emitter::Emitter(const EmitterSettings& settings) :
+    mSettings(settings)
+{
+}
+
+std::vector<ParticleSeed> Emitter::Sample(MTIterator& mt) const
+{
+    switch (mSettings.Sampling)
+    {
+    case EmitterSampling::PoissonDisk:
+        return samplePoissonDisk(mt);
+    case EmitterSampling::Lattice:
+    default:
+        return sampleLattice(mt);
+    }
+}
+
+std::vector<ParticleSeed> Emitter::sampleLattice(MTIterator& mt) const
+{
+    Vec3 min;
+    Vec3 max;
+    Vec3 origin;
+    Bounds(min, max, origin);
+
+    const Float spacing = mSettings.Spacing;
+    const IVec3 first(
+        int(std::ceil((min.x - origin.x) / spacing)),
+        int(std::ceil((min.y - origin.y) / spacing)),
+        int(std::ceil((min.z - origin.z) / spacing))
+    );
+    const IVec3 last(
+        int(std::floor((max.x - origin.x) / spacing)),
+        int(std::floor((max.y - origin.y) / spacing)),
+        int(std::floor((max.z - origin.z) / spacing))
+    );
+    const IVec3 dims = glm::max(last - first + IVec3(1), IVec3(0));
+    const Uint numSamples = Uint(dims.x) * Uint(dims.y) * Uint(dims.z);
+
+    auto samplePos = [&](Uint i) {
+        const IVec3 n = first + IVec3(i % dims.x, (i / dims.x) % dims.y, i / (Uint(dims.x) * dims.y));
+        const Vec3 jitter(
+            randomUniform(mSettings.Seed, 3 * i) - 0.5,
+            randomUniform(mSettings.Seed, 3 * i + 1) - 0.5,
+            randomUniform(mSettings.Seed, 3 * i + 2) - 0.5
+        );
+        return origin + (Vec3(n) + mSettings.Jitter * jitter) * spacing;
+    };
+
+    // Count the samples per range, turn the counts into offsets and then let every range write
+    // its samples - the output is in lattice order regardless of how the ranges were split
+    std::vector<Uint> offsets(mt.NumThreads() + 1, 0);
+    mt.IterateOverChunks(numSamples, [&](Uint low, Uint high, Uint threadIdx) {
+        Uint count = 0;
+        for (Uint i = low; i < high; i++)
+        {
+            count += Inside(samplePos(i)) ? 1 : 0;
+        }
+        offsets[threadIdx + 1] = count;
+    });
+
+    for (Uint t = 1; t < offsets.size(); t++)
+    {
+        offsets[t] += offsets[t - 1];
+    }
+
+    std::vector<ParticleSeed> seeds(offsets.back());
+    mt.IterateOverChunks(numSamples, [&](Uint low, Uint high, Uint threadIdx) {
+        Uint out = offsets[threadIdx];
+        for (Uint i = low; i < high; i++)
+        {
+            const Vec3 pos = samplePos(i);
+            if (Inside(pos))
+            {
+                seeds[out].pos = pos;
+                seeds[out].velocity = mSettings.Velocity;
+                seeds[out].mass = mSettings.Mass;
+                out++;
+            }
+        }
+    });
+
+    return seeds;
+}
+
+std::vector<ParticleSeed> Emitter::samplePoissonDisk(MTIterator& mt) const
+{
+    // Dart throwing on a background grid with cells small enough to hold at most one sample.
+    // Samples within Spacing of each other are at most 2 cells apart, so cells 3 apart never
+    // interact - the cells are processed in 27 interleaved phases where each phase can run fully
+    // in parallel, and every cell draws its darts from its own counter range.
+    static const Uint PASSES = 4;
+    static const Uint ATTEMPTS = 16;
+
+    Vec3 min;
+    Vec3 max;
+    Vec3 origin;
+    Bounds(min, max, origin);
+
+    const Float radius = mSettings.Spacing;
+    const Float cellSize = radius / std::sqrt(3.0);
+    const IVec3 dims = glm::max(IVec3(glm::ceil((max - min) / cellSize)), IVec3(1));
+    const Uint numCells = Uint(dims.x) * Uint(dims.y) * Uint(dims.z);
+
+    auto cellIdx = [&](const IVec3& c) { return c.x + dims.x * (c.y + Uint(dims.y) * c.z); };
+
+    std::vector<Vec3> samples(numCells);
+    std::vector<uint8_t> occupied(numCells, 0);
+
+    for (Uint pass = 0; pass < PASSES; pass++)
+    {
+        for (int phase = 0; phase < 27; phase++)
+        {
+            const IVec3 offset(phase % 3, (phase / 3) % 3, phase / 9);
+            const IVec3 phaseDims = glm::max((dims - offset + IVec3(2)) / 3, IVec3(0));
+
+            mt.IterateOverIndices(Uint(phaseDims.x) * Uint(phaseDims.y) * Uint(phaseDims.z), [&](Uint i) {
+                const IVec3 cell = offset + 3 * IVec3(
+                    i % phaseDims.x, (i / phaseDims.x) % phaseDims.y, i / (Uint(phaseDims.x) * phaseDims.y)
+                );
+                const Uint idx = cellIdx(cell);
+                if (occupied[idx])
+                {
+                    return;
+                }
+
+                for (Uint attempt = 0; attempt < ATTEMPTS; attempt++)
+                {
+                    const Uint counter = 3 * ((idx * PASSES + pass) * ATTEMPTS + attempt);
+                    const Vec3 pos = min + (Vec3(cell) + Vec3(
+                        randomUniform(mSettings.Seed, counter),
+                        randomUniform(mSettings.Seed, counter + 1),
+                        randomUniform(mSettings.Seed, counter + 2)
+                    )) * cellSize;
+
+                    if (!Inside(pos))
+                    {
+                        continue;
+                    }
+
+                    bool free = true;
+                    for (int k = std::max(cell.z - 2, 0); k <= std::min(cell.z + 2, dims.z - 1) && free; k++)
+                    {
+                        for (int j = std::max(cell.y - 2, 0); j <= std::min(cell.y + 2, dims.y - 1) && free; j++)
+                        {
+                            for (int n = std::max(cell.x - 2, 0); n <= std::min(cell.x + 2, dims.x - 1) && free; n++)
+                            {
+                                const Uint other = cellIdx(IVec3(n, j, k));
+                                free = !occupied[other] || glm::length(samples[other] - pos) >= radius;
+                            }
+                        }
+                    }
+
+                    if (free)
+                    {
+                        samples[idx] = pos;
+                        occupied[idx] = 1;
+                        return;
+                    }
+                }
+            });
+        }
+    }
+
+    std::vector<ParticleSeed> seeds;
+    seeds.reserve(std::count(occupied.begin(), occupied.end(), uint8_t(1)));
+    for (Uint i = 0; i < numCells; i++)
+    {
+        if (occupied[i])
+        {
+            seeds.push_back({ samples[i], mSettings.Velocity, mSettings.Mass });
+        }
+    }
+
+    return seeds;
+}
+
+BoxEmitter::BoxEmitter(const Vec3& min, const Vec3& max, const EmitterSettings& settings) :
+    Emitter(settings),
+    mMin(min),
+    mMax(max)
+{
+}
+
+void BoxEmitter::Bounds(Vec3& min, Vec3& max, Vec3& origin) const
+{
+    // Jittered samples may move out of the box, so take the lattice over the whole box and
+    // let Inside reject them
+    min = mMin;
+    max = mMax;
+    origin = mMin;
+}
+
+bool BoxEmitter::Inside(const Vec3& pos) const
+{
+    return pos.x >= mMin.x && pos.y >= mMin.y && pos.z >= mMin.z &&
+           pos.x < mMax.x && pos.y < mMax.y && pos.z < mMax.z;
+}
+
+SphereEmitter::SphereEmitter(const Vec3& center, Float radius, const EmitterSettings& settings) :
+    Emitter(settings),
+    mCenter(center),
+    mRadius(radius)
+{
+}
+
+void SphereEmitter::Bounds(Vec3& min, Vec3& max, Vec3& origin) const
+{
+    min = mCenter - Vec3(mRadius);
+    max = mCenter + Vec3(mRadius);
+    origin = mCenter;
+}
+
+bool SphereEmitter::Inside(const Vec3& pos) const
+{
+    const Vec3 d = pos - mCenter;
+    return glm::dot(d, d) <= mRadius * mRadius;
+}
+
+MeshEmitter::MeshEmitter(const MeshVolume& volume, const EmitterSettings& settings) :
+    Emitter(settings),
+    mVolume(volume)
+{
+}
+
+void MeshEmitter::Bounds(Vec3& min, Vec3& max, Vec3& origin) const
+{
+    min = mVolume.Min();
+    max = mVolume.Max();
+    origin = mVolume.Min();
+}
+
+bool MeshEmitter::Inside(const Vec3& pos) const
+{
+    return mVolume.Inside(pos);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Common.hpp"
+#include "ParticleSystem.hpp"
+
+#include <vector>
+
+class MTIterator;
+class MeshVolume;
+
+enum class EmitterSampling {
+    Lattice,    // Jittered lattice with Spacing between the samples
+    PoissonDisk // No two samples closer than Spacing
+};
+
+struct EmitterSettings
+{
+    EmitterSampling Sampling = EmitterSampling::Lattice;
+    Float Spacing = 0.5; // Distance between samples
+    Float Jitter = 0.0;  // Random offset of each lattice sample, as a fraction of the spacing
+    Vec3 Velocity = Vec3(0.0);
+    Float Mass = 1.0;    // Per particle
+    uint64_t Seed = 0;
+};
+
+// Fills a volume with particles sampled on a jittered lattice or with Poisson-disk sampling.  The
+// samples only depend on the settings, so the same settings always produce the same particles in
+// the same order no matter how many threads sample them.
+class Emitter
+{
+public:
+    virtual ~Emitter() = default;
+
+    std::vector<ParticleSeed> Sample(MTIterator& mt) const;
+
+protected:
+    Emitter(const EmitterSettings& settings);
+
+    // Samples are taken at origin + n * spacing for all n where this is inside [min, max]
+    virtual void Bounds(Vec3& min, Vec3& max, Vec3& origin) const = 0;
+    virtual bool Inside(const Vec3& pos) const = 0;
+
+    const EmitterSettings mSettings;
+
+private:
+    std::vector<ParticleSeed> sampleLattice(MTIterator& mt) const;
+    std::vector<ParticleSeed> samplePoissonDisk(MTIterator& mt) const;
+};
+
+// Axis aligned box [min, max)
+class BoxEmitter : public Emitter
+{
+public:
+    BoxEmitter(const Vec3& min, const Vec3& max, const EmitterSettings& settings);
+
+protected:
+    void Bounds(Vec3& min, Vec3& max, Vec3& origin) const override;
+    bool Inside(const Vec3& pos) const override;
+
+private:
+    const Vec3 mMin;
+    const Vec3 mMax;
+};
+
+// The lattice is centered on the sphere's center
+class SphereEmitter : public Emitter
+{
+public:
+    SphereEmitter(const Vec3& center, Float radius, const EmitterSettings& settings);
+
+protected:
+    void Bounds(Vec3& min, Vec3& max, Vec3& origin) const override;
+    bool Inside(const Vec3& pos) const override;
+
+private:
+    const Vec3 mCenter;
+    const Float mRadius;
+};
+
+// Fills the inside of a voxelized mesh
+class MeshEmitter : public Emitter
+{
+public:
+    // The volume has to outlive the emitter
+    MeshEmitter(const MeshVolume& volume, const EmitterSettings& settings);
+
+protected:
+    void Bounds(Vec3& min, Vec3& max, Vec3& origin) const override;
+    bool Inside(const Vec3& pos) const override;
+
+private:
+    const MeshVolume& mVolume;
+};
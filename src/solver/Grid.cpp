@@ -1,25 +1,43 @@
 #include "Grid.hpp"
 #include "ParticleSystem.hpp"
 #include "Multithread.hpp"
+#include "Collider.hpp"
+#include "SleepBlocks.hpp"
+
+#include <algorithm>
+
+// Handed out for reads of cells that haven't been written this substep
+static const Cell sEmptyCell;
 
 // This is called with coordinates normalized to the size of the grid
 // (eg. divided by h)
 
 Grid::Grid(const SimulationParameters& params, const IVec3& dims) :
+    Grid(params, dims, IVec3(0), dims)
+{
+}
+
+Grid::Grid(const SimulationParameters& params, const IVec3& dims, const IVec3& origin, const IVec3& domainDims) :
     mParams(params),
     mDims(dims),
-    mCells(dims.x * dims.y * dims.z)
+    mPaddedDims(dims + IVec3(2 * HALO)),
+    mOrigin(origin),
+    mDomainDims(domainDims),
+    mStamp(1), // Cells start at stamp 0 so they are all stale
+    mCells(mPaddedDims.x * mPaddedDims.y * mPaddedDims.z, HugePageAllocator<Cell>(params.HUGE_PAGES, params.NUM_THREADS, params.NUMA_PLACEMENT))
 {
-} 
+}
 
-Cell& Grid::Get(Uint i, Uint j, Uint k)
+// Note that the returned cell may be stale - writers need to Revalidate it first
+Cell& Grid::Get(int i, int j, int k)
 {
     return mCells[coordToIdx(i, j, k)];
 }
 
-const Cell& Grid::Get(Uint i, Uint j, Uint k) const
+const Cell& Grid::Get(int i, int j, int k) const
 {
-    return mCells[coordToIdx(i, j, k)];
+    const Cell& c = mCells[coordToIdx(i, j, k)];
+    return isCurrent(c) ? c : sEmptyCell;
 }
 
 const IVec3& Grid::Dims() const
@@ -27,40 +45,517 @@ const IVec3& Grid::Dims() const
     return mDims;
 }
 
-Uint Grid::coordToIdx(Uint i, Uint j, Uint k) const
+const IVec3& Grid::Origin() const
+{
+    return mOrigin;
+}
+
+const IVec3& Grid::DomainDims() const
+{
+    return mDomainDims;
+}
+
+Uint Grid::coordToIdx(int i, int j, int k) const
+{
+    i += HALO - mOrigin.x;
+    j += HALO - mOrigin.y;
+    k += HALO - mOrigin.z;
+    return Uint(i) + Uint(mPaddedDims.x) * Uint(j) + Uint(mPaddedDims.x) * Uint(mPaddedDims.y) * Uint(k);
+}
+
+bool Grid::isCurrent(const Cell& c) const
+{
+    return c.Stamp == mStamp;
+}
+
+IVec3 Grid::idxToCoord(Uint idx) const
+{
+    const Uint plane = mPaddedDims.x * mPaddedDims.y;
+    return IVec3(idx % mPaddedDims.x, (idx % plane) / mPaddedDims.x, idx / plane) - IVec3(HALO) + mOrigin;
+}
+
+bool Grid::inDomain(const IVec3& coord) const
+{
+    return coord.x >= 0 && coord.y >= 0 && coord.z >= 0 &&
+           coord.x < mDomainDims.x && coord.y < mDomainDims.y && coord.z < mDomainDims.z;
+}
+
+// Cells per block of the diagnostic sums
+static const Uint DIAGNOSTIC_BLOCK_SIZE = 4096;
+
+P2GMode Grid::transferMode() const
+{
+    return transferMode(mParams);
+}
+
+P2GMode Grid::transferMode(const SimulationParameters& params)
 {
-    return i + mDims.x * j + mDims.x * mDims.y * k;
+    return params.DETERMINISTIC ? P2GMode::Gather : params.P2G_MODE;
 }
 
-void Grid::RasterizeParticlesToGrid(const ParticleSystem& ps, MTIterator& mt)
+Uint Grid::CellBytes() const
+{
+    return mCells.capacity() * sizeof(Cell);
+}
+
+Uint Grid::TransferBytes() const
+{
+    return mBinCursor.capacity() * sizeof(std::atomic<Uint>) + mBinStart.capacity() * sizeof(Uint) +
+        mBinParticles.capacity() * sizeof(Uint) + mParticleBin.capacity() * sizeof(Uint) +
+        mSlabBounds.capacity() * sizeof(int) + mSlabStart.capacity() * sizeof(Uint) +
+        mSlabParticles.capacity() * sizeof(Uint) + mParticleSlab.capacity() * sizeof(uint32_t);
+}
+
+Uint Grid::EstimateCellBytes(const IVec3& dims)
+{
+    const IVec3 padded = dims + IVec3(2 * HALO);
+    return Uint(padded.x) * Uint(padded.y) * Uint(padded.z) * sizeof(Cell);
+}
+
+Uint Grid::EstimateTransferBytes(const SimulationParameters& params, const IVec3& dims, Uint numParticles)
+{
+    switch (transferMode(params))
+    {
+    case P2GMode::Gather:
+    {
+        // Cursor and start per cell, bin and index per particle
+        const Uint numCells = EstimateCellBytes(dims) / sizeof(Cell);
+        return numCells * (sizeof(std::atomic<Uint>) + sizeof(Uint)) + numParticles * 2 * sizeof(Uint);
+    }
+    case P2GMode::Partitioned:
+        return numParticles * (sizeof(Uint) + sizeof(uint32_t));
+    case P2GMode::Scatter:
+        break;
+    }
+    return 0;
+}
+
+void Grid::RasterizeParticlesToGrid(const ParticleSystem& ps, MTIterator& mt, const SleepBlocks* sleepBlocks)
+{
+    const bool skipAsleep = sleepBlocks != nullptr;
+
+    switch (transferMode())
+    {
+    case P2GMode::Scatter:
+        scatterParticlesToGrid(ps, mt, skipAsleep);
+        break;
+    case P2GMode::Gather:
+        binParticles(ps, mt);
+        gatherParticlesToGrid(ps, mt, skipAsleep);
+        break;
+    case P2GMode::Partitioned:
+        partitionParticles(ps, mt);
+        scatterPartitioned(ps, mt, [&](const Particle& particle, bool locked) {
+            if (skipAsleep && particle.asleep) {
+                return;
+            }
+            WeightOverParticleNeighbourhood(ps, particle,
+                [&](IVec3 pos, Float weight) {
+                    Cell& c = Get(pos.x, pos.y, pos.z);
+                    if (locked) c.Lock();
+                    c.Revalidate(mStamp);
+                    c.Mass += weight * particle.mass;
+                    c.Velocity += Vec3(particle.velocity) * particle.mass * weight;
+                    if (locked) c.Unlock();
+                });
+        });
+        break;
+    }
+
+    if (sleepBlocks)
+    {
+        addSleepingContributions(*sleepBlocks, GhostField::MassMomentum, mt);
+    }
+}
+
+void Grid::addSleepingContributions(const SleepBlocks& sleepBlocks, GhostField field, MTIterator& mt)
+{
+    if (!sleepBlocks.HasContributions())
+    {
+        return;
+    }
+
+    // Every cell is only written by the thread that owns it and sums up the blocks in a fixed
+    // order, so this stays deterministic in every transfer mode
+    mt.IterateOverIndices(mCells.size(), [&](Uint idx) {
+        sleepBlocks.ForEachContribution(idxToCoord(idx), [&](const SleepingContribution& contribution, Uint n) {
+            if (!contribution.Reached[n])
+            {
+                return;
+            }
+
+            Cell& cell = mCells[idx];
+            cell.Revalidate(mStamp);
+            if (field == GhostField::MassMomentum)
+            {
+                cell.Mass += contribution.Mass[n];
+                cell.Velocity += contribution.Momentum[n];
+            }
+            else
+            {
+                cell.Force += contribution.Force[n];
+            }
+        });
+    });
+}
+
+void Grid::scatterParticlesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep)
 {
     mt.IterateOverVector(ps.GetParticles(), [&](const Particle& particle) {
-        WeightOverParticleNeighbourhood(mParams, particle,
+        if (skipAsleep && particle.asleep) {
+            return;
+        }
+        WeightOverParticleNeighbourhood(ps, particle,
             [&](IVec3 pos, Float weight) {
                 // Transfer mass
                 Cell& c = Get(pos.x, pos.y, pos.z);
 
                 c.Lock();
+                c.Revalidate(mStamp);
                 c.Mass += weight * particle.mass;
 
                 // Transfer velocity (normalized)
-                c.Velocity += particle.velocity * particle.mass * weight;
+                c.Velocity += Vec3(particle.velocity) * particle.mass * weight;
                 c.Unlock();
             });
     });
 }
 
-void Grid::ComputeGridForces(const ParticleSystem& ps, MTIterator& mt)
+void Grid::binParticles(const ParticleSystem& ps, MTIterator& mt)
+{
+    const ParticleVector& particles = ps.GetParticles();
+    const Uint numCells = mCells.size();
+
+    if (mBinCursor.size() != numCells)
+    {
+        mBinCursor = std::vector<std::atomic<Uint>>(numCells);
+        mBinStart.resize(numCells + 1);
+    }
+    mParticleBin.resize(particles.size());
+    mBinParticles.resize(particles.size());
+
+    mt.IterateOverIndices(numCells, [&](Uint i) {
+        mBinCursor[i].store(0, std::memory_order_relaxed);
+    });
+
+    // Count the particles per cell.  Particles are kept inside the domain (or slab) so the
+    // clamp only guards against positions sitting exactly on the upper boundary.
+    const IVec3 last = mOrigin + mDims - IVec3(1);
+    mt.IterateOverIndices(particles.size(), [&](Uint i) {
+        const Vec3 pos(particles[i].pos);
+        IVec3 cell(
+            glm::clamp(int(std::floor(pos.x / mParams.H)), mOrigin.x, last.x),
+            glm::clamp(int(std::floor(pos.y / mParams.H)), mOrigin.y, last.y),
+            glm::clamp(int(std::floor(pos.z / mParams.H)), mOrigin.z, last.z)
+        );
+        mParticleBin[i] = coordToIdx(cell.x, cell.y, cell.z);
+        mBinCursor[mParticleBin[i]].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    // Exclusive prefix sum over the counts - each thread sums its own range, the range
+    // totals are scanned serially and then every thread offsets its range
+    std::vector<Uint> chunkTotals(mt.NumThreads() + 1, 0);
+    mt.IterateOverChunks(numCells, [&](Uint low, Uint high, Uint threadIdx) {
+        Uint total = 0;
+        for (Uint i = low; i < high; i++)
+        {
+            total += mBinCursor[i].load(std::memory_order_relaxed);
+        }
+        chunkTotals[threadIdx + 1] = total;
+    });
+
+    for (Uint t = 1; t < chunkTotals.size(); t++)
+    {
+        chunkTotals[t] += chunkTotals[t - 1];
+    }
+
+    mt.IterateOverChunks(numCells, [&](Uint low, Uint high, Uint threadIdx) {
+        Uint start = chunkTotals[threadIdx];
+        for (Uint i = low; i < high; i++)
+        {
+            Uint count = mBinCursor[i].load(std::memory_order_relaxed);
+            mBinStart[i] = start;
+            mBinCursor[i].store(start, std::memory_order_relaxed);
+            start += count;
+        }
+    });
+    mBinStart[numCells] = particles.size();
+
+    mt.IterateOverIndices(particles.size(), [&](Uint i) {
+        mBinParticles[mBinCursor[mParticleBin[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+    });
+
+    // Threads race for the slots inside a bin, so restore index order to keep
+    // the gathered sums independent of scheduling
+    mt.IterateOverIndices(numCells, [&](Uint i) {
+        if (mBinStart[i + 1] - mBinStart[i] > 1)
+        {
+            std::sort(mBinParticles.begin() + mBinStart[i], mBinParticles.begin() + mBinStart[i + 1]);
+        }
+    });
+}
+
+void Grid::rebalancePartition(const ParticleSystem& ps, MTIterator& mt)
+{
+    const ParticleVector& particles = ps.GetParticles();
+    const Uint numSlabs = mt.NumThreads();
+
+    // Particles per column of cells along x
+    std::vector<std::atomic<Uint>> columns(mDims.x);
+    for (std::atomic<Uint>& c : columns)
+    {
+        c.store(0, std::memory_order_relaxed);
+    }
+    mt.IterateOverIndices(particles.size(), [&](Uint i) {
+        const int x = glm::clamp(int(std::floor(particles[i].pos.x / mParams.H)) - mOrigin.x, 0, mDims.x - 1);
+        columns[x].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    // Every slab ends at the first column where the running count reaches its share
+    mSlabBounds.assign(numSlabs + 1, mOrigin.x + mDims.x);
+    mSlabBounds[0] = mOrigin.x;
+    Uint running = 0;
+    Uint slab = 1;
+    for (int x = 0; x < mDims.x && slab < numSlabs; x++)
+    {
+        running += columns[x].load(std::memory_order_relaxed);
+        while (slab < numSlabs && running * numSlabs >= particles.size() * slab)
+        {
+            mSlabBounds[slab++] = mOrigin.x + x + 1;
+        }
+    }
+
+    mSubstepsSinceRebalance = 0;
+}
+
+void Grid::partitionParticles(const ParticleSystem& ps, MTIterator& mt)
+{
+    const ParticleVector& particles = ps.GetParticles();
+    const Uint numSlabs = mt.NumThreads();
+
+    if (mSlabBounds.size() != numSlabs + 1 || mSubstepsSinceRebalance >= mParams.PARTITION_REBALANCE_SUBSTEPS)
+    {
+        rebalancePartition(ps, mt);
+    }
+    mSubstepsSinceRebalance++;
+
+    // A particle in cell x reaches the cells x - 1 ... x + 2, it only belongs to a slab if all
+    // of those are inside of it.  Everything else goes to the border list (numSlabs).
+    mParticleSlab.resize(particles.size());
+    std::vector<Uint> counts(numSlabs * (numSlabs + 1), 0); // Per thread chunk and slab
+    mt.IterateOverChunks(particles.size(), [&](Uint low, Uint high, Uint threadIdx) {
+        Uint* chunkCounts = &counts[threadIdx * (numSlabs + 1)];
+        for (Uint i = low; i < high; i++)
+        {
+            const int x = int(std::floor(particles[i].pos.x / mParams.H));
+            const Uint slab = std::upper_bound(mSlabBounds.begin() + 1, mSlabBounds.end() - 1, x) - (mSlabBounds.begin() + 1);
+            const bool inside = x - 1 >= mSlabBounds[slab] && x + 2 < mSlabBounds[slab + 1];
+            mParticleSlab[i] = inside ? slab : numSlabs;
+            chunkCounts[mParticleSlab[i]]++;
+        }
+    });
+
+    // Offsets of every (chunk, slab) pair - slab major so each slab's particles stay in index order
+    mSlabStart.assign(numSlabs + 2, 0);
+    std::vector<Uint> offsets(counts.size());
+    Uint total = 0;
+    for (Uint slab = 0; slab <= numSlabs; slab++)
+    {
+        mSlabStart[slab] = total;
+        for (Uint chunk = 0; chunk < numSlabs; chunk++)
+        {
+            offsets[chunk * (numSlabs + 1) + slab] = total;
+            total += counts[chunk * (numSlabs + 1) + slab];
+        }
+    }
+    mSlabStart[numSlabs + 1] = total;
+
+    mSlabParticles.resize(particles.size());
+    mt.IterateOverChunks(particles.size(), [&](Uint low, Uint high, Uint threadIdx) {
+        Uint* chunkOffsets = &offsets[threadIdx * (numSlabs + 1)];
+        for (Uint i = low; i < high; i++)
+        {
+            mSlabParticles[chunkOffsets[mParticleSlab[i]]++] = i;
+        }
+    });
+}
+
+template<typename Func>
+void Grid::scatterPartitioned(const ParticleSystem& ps, MTIterator& mt, Func f)
+{
+    const ParticleVector& particles = ps.GetParticles();
+    const Uint numSlabs = mSlabBounds.size() - 1;
+
+    // Nobody else writes to a slab's cells while its owner runs
+    mt.IterateOverIndices(numSlabs, [&](Uint slab) {
+        for (Uint i = mSlabStart[slab]; i < mSlabStart[slab + 1]; i++)
+        {
+            f(particles[mSlabParticles[i]], false);
+        }
+    });
+
+    // The border particles overlap each other's cells
+    mt.IterateOverIndices(mSlabStart[numSlabs + 1] - mSlabStart[numSlabs], [&](Uint i) {
+        f(particles[mSlabParticles[mSlabStart[numSlabs] + i]], true);
+    });
+}
+
+template<typename Func>
+void Grid::forEachBinnedNeighbour(const IVec3& c, Func f) const
+{
+    // A particle in cell b reaches the cells b - 1 ... b + 2 along each axis, so cell c
+    // gathers from the 4x4x4 bins c - 2 ... c + 1.  Bins along x are contiguous, so every
+    // row of 4 bins is a single range of particles.  Only bins inside the domain hold particles.
+    const IVec3 last = mOrigin + mDims - IVec3(1);
+    const int x0 = std::max(c.x - 2, mOrigin.x);
+    const int x1 = std::min(c.x + 1, last.x);
+
+    if (x0 > x1)
+    {
+        return;
+    }
+
+    for (int k = std::max(c.z - 2, mOrigin.z); k <= std::min(c.z + 1, last.z); k++)
+    {
+        for (int j = std::max(c.y - 2, mOrigin.y); j <= std::min(c.y + 1, last.y); j++)
+        {
+            const Uint rowBegin = mBinStart[coordToIdx(x0, j, k)];
+            const Uint rowEnd = mBinStart[coordToIdx(x1, j, k) + 1];
+
+            for (Uint b = rowBegin; b < rowEnd; b++)
+            {
+                f(mBinParticles[b]);
+            }
+        }
+    }
+}
+
+void Grid::gatherParticlesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep)
+{
+    const ParticleVector& particles = ps.GetParticles();
+
+    // Every cell is only written by the thread that owns it, so no locking is needed
+    mt.IterateOverIndices(mCells.size(), [&](Uint idx) {
+        const IVec3 c = idxToCoord(idx);
+
+        Float mass = 0.0;
+        Vec3 momentum(0.0);
+
+        forEachBinnedNeighbour(c, [&](Uint p) {
+            const Particle& particle = particles[p];
+            if (skipAsleep && particle.asleep) {
+                return;
+            }
+            const Float weight = StencilNodeWeight(ps, particle, c);
+
+            mass += weight * particle.mass;
+            momentum += Vec3(particle.velocity) * particle.mass * weight;
+        });
+
+        if (mass > 0)
+        {
+            Cell& cell = mCells[idx];
+            cell.Revalidate(mStamp);
+            cell.Mass = mass;
+            cell.Velocity = momentum;
+        }
+    });
+}
+
+void Grid::gatherForcesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep)
+{
+    const ParticleVector& particles = ps.GetParticles();
+
+    mt.IterateOverIndices(mCells.size(), [&](Uint idx) {
+        const IVec3 c = idxToCoord(idx);
+        Vec3 force(0.0);
+        bool reached = false;
+
+        forEachBinnedNeighbour(c, [&](Uint p) {
+            const Particle& particle = particles[p];
+            if (skipAsleep && particle.asleep) {
+                return;
+            }
+            const Vec3 weightgrad = StencilNodeWeightGrad(ps, particle, c);
+
+            force += (-particle.volume * Mat3(particle.stress)) * weightgrad;
+            reached = true;
+        });
+
+        if (reached)
+        {
+            Cell& cell = mCells[idx];
+            cell.Revalidate(mStamp);
+            cell.Force = force;
+        }
+    });
+}
+
+void Grid::ComputeGridForces(const ParticleSystem& ps, MTIterator& mt, const SleepBlocks* sleepBlocks)
+{
+    const bool skipAsleep = sleepBlocks != nullptr;
+
+    if (transferMode() == P2GMode::Gather)
+    {
+        // Reuses the bins from the transfer earlier in the substep
+        if (mParticleBin.size() != ps.GetParticles().size())
+        {
+            binParticles(ps, mt);
+        }
+        gatherForcesToGrid(ps, mt, skipAsleep);
+    }
+    else if (transferMode() == P2GMode::Partitioned)
+    {
+        // Reuses the partition from the transfer earlier in the substep
+        if (mParticleSlab.size() != ps.GetParticles().size() || mSlabBounds.size() != mt.NumThreads() + 1)
+        {
+            partitionParticles(ps, mt);
+        }
+        scatterPartitioned(ps, mt, [&](const Particle& particle, bool locked) {
+            if (skipAsleep && particle.asleep) {
+                return;
+            }
+            const Mat3 stress = -particle.volume * Mat3(particle.stress);
+            WeightGradOverParticleNeighbourhood(ps, particle,
+                [&](IVec3 pos, Vec3 weightgrad) {
+                    Vec3 dforce = stress * weightgrad;
+                    ASSERT_VALID_VEC3(dforce);
+
+                    Cell& c = Get(pos.x, pos.y, pos.z);
+                    if (locked) c.Lock();
+                    c.Revalidate(mStamp);
+                    c.Force += dforce;
+                    if (locked) c.Unlock();
+                });
+        });
+    }
+    else
+    {
+        scatterForcesToGrid(ps, mt, skipAsleep);
+    }
+
+    if (sleepBlocks)
+    {
+        addSleepingContributions(*sleepBlocks, GhostField::Force, mt);
+    }
+}
+
+void Grid::scatterForcesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep)
 {
     mt.IterateOverVector(ps.GetParticles(), [&](const Particle& particle) {
-        WeightGradOverParticleNeighbourhood(mParams, particle,
+        if (skipAsleep && particle.asleep) {
+            return;
+        }
+        const Mat3 stress = -particle.volume * Mat3(particle.stress);
+
+        WeightGradOverParticleNeighbourhood(ps, particle,
             [&](IVec3 pos, Vec3 weightgrad) {
-                Mat3 stress = -ps.CalculateCauchyStress(particle);
-                Vec3 dforce = particle.volume * stress * weightgrad;
+                Vec3 dforce = stress * weightgrad;
                 ASSERT_VALID_VEC3(dforce);
                 
                 Cell& c = Get(pos.x, pos.y, pos.z);
                 c.Lock();
+                c.Revalidate(mStamp);
                 c.Force += dforce;
                 c.Unlock();
             }
@@ -68,38 +563,138 @@ void Grid::ComputeGridForces(const ParticleSystem& ps, MTIterator& mt)
     });
 }
 
-void Grid::UpdateGridVelocities(Float timestep, MTIterator& mt) {
-    mt.IterateOverVector(mCells, [&](Cell& c) {
-        if(c.Mass > 0) {
+void Grid::UpdateGridVelocities(Float timestep, MTIterator& mt, DiagnosticSums* diagnostics) {
+    auto update = [&](Cell& c) {
+        if(isCurrent(c) && c.Mass > 0) {
             c.Velocity /= c.Mass; // normalize velocity for energy conservation
             c.Force += Vec3(0.0, 0.0, mParams.GRAVITY * c.Mass);
             c.VelocityStar += c.Velocity + timestep / c.Mass * c.Force;
             ASSERT_VALID_VEC3(c.VelocityStar);
+            return true;
+        }
+        return false;
+    };
+
+    if (diagnostics)
+    {
+        *diagnostics = mt.ReduceOverBlocks<DiagnosticSums>(mCells.size(), DIAGNOSTIC_BLOCK_SIZE,
+            [&](Uint low, Uint high, DiagnosticSums& sums) {
+                for (Uint i = low; i < high; i++)
+                {
+                    if (update(mCells[i])) {
+                        sums.Add(mCells[i].Mass, mCells[i].Velocity);
+                    }
+                }
+            },
+            [](DiagnosticSums& total, const DiagnosticSums& partial) { total.Merge(partial); });
+        return;
+    }
+
+    mt.IterateOverVector(mCells, update);
+}
+
+void Grid::DoGridBasedCollisions(Float timestep, const std::vector<Collider>& colliders, MTIterator& mt)
+{
+    if (colliders.empty())
+    {
+        return;
+    }
+
+    mt.IterateOverIndices(mCells.size(), [&](Uint idx) {
+        Cell& c = mCells[idx];
+        if (isCurrent(c) && c.Mass > 0) {
+            const Vec3 pos = Vec3(idxToCoord(idx)) * mParams.H;
+            for (const Collider& collider : colliders) {
+                collider.Collide(pos, c.VelocityStar);
+            }
         }
     });
 }
 
-void Grid::DoGridBasedCollisions(Float timestep, MTIterator& mt)
+void Grid::ApplyBoundaryConditions(MTIterator& mt)
 {
-    // todo:
+    // The domain walls are sticky - anything that was transferred into the halo stops dead
+    mt.IterateOverIndices(mCells.size(), [&](Uint idx) {
+        Cell& c = mCells[idx];
+        if (isCurrent(c) && !inDomain(idxToCoord(idx))) {
+            c.VelocityStar = Vec3(0.0);
+        }
+    });
 }
 
 void Grid::SolveLinearSystem(Float timestep, MTIterator& mt)
 {
     mt.IterateOverVector(mCells, [&](Cell& c) {
-        c.VelocityNext = c.VelocityStar;   
+        if(isCurrent(c)) {
+            c.VelocityNext = c.VelocityStar;
+        }
     });
 }
 
 void Grid::ResetGrid()
 {
-    for (Cell& c : mCells)
+    mStamp++;
+}
+
+void Grid::PackGhostCells(int xBegin, int xEnd, GhostField field, std::vector<Float>& out) const
+{
+    out.clear();
+    for (int k = mOrigin.z - HALO; k < mOrigin.z + mDims.z + HALO; k++)
+    {
+        for (int j = mOrigin.y - HALO; j < mOrigin.y + mDims.y + HALO; j++)
+        {
+            for (int i = xBegin; i < xEnd; i++)
+            {
+                const Cell& c = Get(i, j, k);
+                if (field == GhostField::MassMomentum)
+                {
+                    out.push_back(c.Mass);
+                    out.push_back(c.Velocity.x);
+                    out.push_back(c.Velocity.y);
+                    out.push_back(c.Velocity.z);
+                }
+                else
+                {
+                    out.push_back(c.Force.x);
+                    out.push_back(c.Force.y);
+                    out.push_back(c.Force.z);
+                }
+            }
+        }
+    }
+}
+
+void Grid::AddGhostCells(int xBegin, int xEnd, GhostField field, const Float* in)
+{
+    for (int k = mOrigin.z - HALO; k < mOrigin.z + mDims.z + HALO; k++)
     {
-        c.Force = Vec3(0.0);
-        c.Mass = 0.0;
-        c.Velocity = Vec3(0.0);
-        c.VelocityNext = Vec3(0.0);
-        c.VelocityStar = Vec3(0.0);
+        for (int j = mOrigin.y - HALO; j < mOrigin.y + mDims.y + HALO; j++)
+        {
+            for (int i = xBegin; i < xEnd; i++)
+            {
+                Cell& c = Get(i, j, k);
+                if (field == GhostField::MassMomentum)
+                {
+                    // Cells the neighbour didn't write stay untouched (and possibly stale)
+                    if (in[0] != 0.0 || in[1] != 0.0 || in[2] != 0.0 || in[3] != 0.0)
+                    {
+                        c.Revalidate(mStamp);
+                        c.Mass += in[0];
+                        c.Velocity += Vec3(in[1], in[2], in[3]);
+                    }
+                    in += 4;
+                }
+                else
+                {
+                    if (in[0] != 0.0 || in[1] != 0.0 || in[2] != 0.0)
+                    {
+                        c.Revalidate(mStamp);
+                        c.Force += Vec3(in[0], in[1], in[2]);
+                    }
+                    in += 3;
+                }
+            }
+        }
     }
 }
 
@@ -110,7 +705,7 @@ std::ostream &operator<<(std::ostream &os, Grid const &g) {
         {
             for (int k = 0; k < g.mDims.z; k++)
             {
-                os << g.Get(i, j, k).Mass << " ";
+                os << g.Get(g.mOrigin.x + i, g.mOrigin.y + j, g.mOrigin.z + k).Mass << " ";
             }
             os << std::endl;
         }
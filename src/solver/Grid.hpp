@@ -9,6 +9,7 @@
 #include <glm/glm.hpp>
 #include "SimulationParameters.hpp"
 #include <mutex>
+#include <atomic>
 
 // todo:  this is needed in here because we have the Weighting templates...  we should just move those somewhere else...
 #include "ParticleSystem.hpp"
@@ -16,6 +17,8 @@
 class Grid;
 class MTIterator;
 class ParticleSystem;
+class Collider;
+class SleepBlocks;
 
 std::ostream &operator<<(std::ostream &os, Grid const &g);
 
@@ -30,21 +33,77 @@ std::ostream &operator<<(std::ostream &os, Grid const &g);
 //     values?)
 //
 template<typename Func>
-void WeightOverParticleNeighbourhood(const SimulationParameters& s, const Particle& p, Func f)
+void WeightOverParticleNeighbourhood(const ParticleSystem& ps, const Particle& p, Func f)
 {
-    for (Uint i = 0; i < p.numNeighbours; i++)
+    const StencilWeights& sw = p.stencil;
+    const StencilCache* cache = ps.GetStencilCache(p);
+    Uint n = 0;
+
+    for (int i = 0; i < 4; i++)
     {
-        f(p.neighbours_coords[i], p.neighbours_nx[i]);
+        for (int j = 0; j < 4; j++)
+        {
+            // Multiplied in the same order as the full cache, which keeps both bitwise the same
+            const Float wij = sw.w[0][i] * sw.w[1][j];
+            for (int k = 0; k < 4; k++)
+            {
+                f(sw.base + IVec3(i, j, k), cache ? cache->Weights[n] : wij * sw.w[2][k]);
+                n++;
+            }
+        }
     }
 }
 
 template<typename Func>
-void WeightGradOverParticleNeighbourhood(const SimulationParameters& s, const Particle& p, Func f)
+void WeightGradOverParticleNeighbourhood(const ParticleSystem& ps, const Particle& p, Func f)
+{
+    const StencilWeights& sw = p.stencil;
+    const StencilCache* cache = ps.GetStencilCache(p);
+    const Float H = ps.CellSize();
+    Uint n = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            const Float wij = sw.w[0][i] * sw.w[1][j];
+            for (int k = 0; k < 4; k++)
+            {
+                const Vec3 weightgrad = cache ? Vec3(cache->Gradients[n]) : Vec3(
+                    sw.dw[0][i] * sw.w[1][j] * sw.w[2][k],
+                    sw.w[0][i] * sw.dw[1][j] * sw.w[2][k],
+                    wij * sw.dw[2][k]
+                ) / H;
+                f(sw.base + IVec3(i, j, k), weightgrad);
+                n++;
+            }
+        }
+    }
+}
+
+// Weight and weight gradient of the particle's stencil node c (c has to be one of the nodes)
+inline Float StencilNodeWeight(const ParticleSystem& ps, const Particle& p, const IVec3& c)
+{
+    const StencilWeights& sw = p.stencil;
+    const IVec3 d = c - sw.base;
+    const StencilCache* cache = ps.GetStencilCache(p);
+    return cache ? cache->Weights[d.x * 16 + d.y * 4 + d.z] : sw.w[0][d.x] * sw.w[1][d.y] * sw.w[2][d.z];
+}
+
+inline Vec3 StencilNodeWeightGrad(const ParticleSystem& ps, const Particle& p, const IVec3& c)
 {
-    for (Uint i = 0; i < p.numNeighbours; i++)
+    const StencilWeights& sw = p.stencil;
+    const IVec3 d = c - sw.base;
+    const StencilCache* cache = ps.GetStencilCache(p);
+    if (cache)
     {
-        f(p.neighbours_coords[i], p.neighbours_nxgrad[i]);
+        return Vec3(cache->Gradients[d.x * 16 + d.y * 4 + d.z]);
     }
+    return Vec3(
+        sw.dw[0][d.x] * sw.w[1][d.y] * sw.w[2][d.z],
+        sw.w[0][d.x] * sw.dw[1][d.y] * sw.w[2][d.z],
+        sw.w[0][d.x] * sw.w[1][d.y] * sw.dw[2][d.z]
+    ) / ps.CellSize();
 }
 
 class Cell {
@@ -63,6 +122,22 @@ public:
         mMutex.unlock();
     }
 
+    // Cells are cleared lazily - a cell whose stamp doesn't match the grid's current
+    // substep holds leftovers from an earlier substep and is logically zero.  Writers call
+    // this (under the lock) before accumulating so the cell gets re-initialized in place.
+    inline void Revalidate(Uint stamp)
+    {
+        if (Stamp != stamp)
+        {
+            Mass = 0.0;
+            Velocity = Vec3(0.0);
+            Force = Vec3(0.0);
+            VelocityStar = Vec3(0.0);
+            VelocityNext = Vec3(0.0);
+            Stamp = stamp;
+        }
+    }
+
     // Inputs - transferred from particles each step
     Float Mass = 0;
     Vec3 Velocity = {};
@@ -74,33 +149,130 @@ public:
     Vec3 VelocityStar = {};
     Vec3 VelocityNext = {};
 
+    // Substep this cell was last written in
+    Uint Stamp = 0;
+
 private:
     std::mutex mMutex;
 };
 
+// Which accumulated cell values are exchanged between the slabs of a domain decomposed simulation
+enum class GhostField {
+    MassMomentum, // After the particle to grid transfer
+    Force         // After the grid forces
+};
+
+// The simulated domain covers the cells [0, Dims()).  Around it the grid keeps a ghost halo
+// of HALO cells so a particle inside the domain never has a stencil node outside the grid, and
+// the boundary conditions are applied on the halo.  Coordinates in the halo are negative or
+// >= Dims().
+//
+// In a domain decomposed simulation (see DomainDecomposition) a grid only stores the slab
+// [Origin(), Origin() + Dims()) of the whole DomainDims() domain plus its halo, and is still
+// addressed with global cell coordinates.  The boundary conditions only apply to the halo cells
+// outside of the whole domain.
 class Grid {
 public:
+    static const int HALO = 2;
+
     Grid(const SimulationParameters& params, const IVec3& dims);
+    Grid(const SimulationParameters& params, const IVec3& dims, const IVec3& origin, const IVec3& domainDims);
 
-    Cell& Get(Uint i, Uint j, Uint k);
-    const Cell& Get(Uint i, Uint j, Uint k) const;
+    Cell& Get(int i, int j, int k);
+    const Cell& Get(int i, int j, int k) const;
 
     const IVec3& Dims() const;
+    const IVec3& Origin() const;
+    const IVec3& DomainDims() const;
 
-    void RasterizeParticlesToGrid(const ParticleSystem& ps, MTIterator& mt);
-    void ComputeGridForces(const ParticleSystem& ps, MTIterator& mt);
-    void UpdateGridVelocities(Float timestep, MTIterator& mt);
-    void DoGridBasedCollisions(Float timestep, MTIterator& mt);
+    // With sleepBlocks the sleeping particles aren't transferred, the cached sums of their blocks
+    // are added instead (see SleepBlocks::CacheContributions)
+    void RasterizeParticlesToGrid(const ParticleSystem& ps, MTIterator& mt, const SleepBlocks* sleepBlocks = nullptr);
+    void ComputeGridForces(const ParticleSystem& ps, MTIterator& mt, const SleepBlocks* sleepBlocks = nullptr);
+    // Sums up the transferred mass and momentum into diagnostics along the way unless it's null
+    void UpdateGridVelocities(Float timestep, MTIterator& mt, DiagnosticSums* diagnostics = nullptr);
+    void DoGridBasedCollisions(Float timestep, const std::vector<Collider>& colliders, MTIterator& mt);
+    void ApplyBoundaryConditions(MTIterator& mt);
     void SolveLinearSystem(Float timestep, MTIterator& mt);
+
+    // Bytes allocated for the cells (halo included), and for the particle bins or partitions of
+    // the transfers
+    Uint CellBytes() const;
+    Uint TransferBytes() const;
+
+    // What a grid of dims cells would allocate for them, and for the transfers of numParticles
+    // particles - to check a memory budget before allocating anything
+    static Uint EstimateCellBytes(const IVec3& dims);
+    static Uint EstimateTransferBytes(const SimulationParameters& params, const IVec3& dims, Uint numParticles);
+
+    // Invalidates every cell by advancing the substep stamp - no cell data is touched
     void ResetGrid();
 
+    // Domain decomposition:  packs the field of the cells with x in [xBegin, xEnd) (over the full
+    // padded y and z range) for the neighbouring slab, and adds the neighbour's packed values
+    void PackGhostCells(int xBegin, int xEnd, GhostField field, std::vector<Float>& out) const;
+    void AddGhostCells(int xBegin, int xEnd, GhostField field, const Float* in);
+
 private:
-    Uint coordToIdx(Uint i, Uint j, Uint k) const;
+    Uint coordToIdx(int i, int j, int k) const;
+    IVec3 idxToCoord(Uint idx) const;
+    bool inDomain(const IVec3& coord) const;
+    bool isCurrent(const Cell& c) const;
+
+    // P2GMode, or Gather in deterministic mode
+    P2GMode transferMode() const;
+    static P2GMode transferMode(const SimulationParameters& params);
+
+    // The P2G engines (see P2GMode).  Particles are skipped when skipAsleep is set and they sleep.
+    void scatterParticlesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep);
+    void gatherParticlesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep);
+    void gatherForcesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep);
+    void scatterForcesToGrid(const ParticleSystem& ps, MTIterator& mt, bool skipAsleep);
+
+    // Adds the field of the sleeping blocks' cached sums, after the awake particles are transferred
+    void addSleepingContributions(const SleepBlocks& sleepBlocks, GhostField field, MTIterator& mt);
+
+    // Calls f(particle index) for every particle reaching cell c, in a fixed order
+    template<typename Func>
+    void forEachBinnedNeighbour(const IVec3& c, Func f) const;
+
+    // Counting sorts the particle indices by the cell containing the particle
+    void binParticles(const ParticleSystem& ps, MTIterator& mt);
+
+    // Partitioned mode.  Sorts the particles into the thread slabs (or the border list), and
+    // calls f(particle, locked) for every particle - first lock free on the slab owners, then
+    // for the border particles with locked set.
+    void partitionParticles(const ParticleSystem& ps, MTIterator& mt);
+    void rebalancePartition(const ParticleSystem& ps, MTIterator& mt);
+    template<typename Func>
+    void scatterPartitioned(const ParticleSystem& ps, MTIterator& mt, Func f);
 
     const SimulationParameters mParams;
     const IVec3 mDims;
+    const IVec3 mPaddedDims; // Including the halo
+    const IVec3 mOrigin; // Global coordinate of the first interior cell
+    const IVec3 mDomainDims;
+
+    // Cells with a different stamp are treated as empty (see Cell::Revalidate)
+    Uint mStamp;
+
+    std::vector<Cell, HugePageAllocator<Cell>> mCells; // Backed by huge pages with HUGE_PAGES
+
+    // Particle bins for gather mode.  The particles in cell i are
+    // mBinParticles[mBinStart[i]] ... mBinParticles[mBinStart[i + 1] - 1], in index order.
+    std::vector<std::atomic<Uint>> mBinCursor;
+    std::vector<Uint> mBinStart;
+    std::vector<Uint> mBinParticles;
+    std::vector<Uint> mParticleBin;
 
-    std::vector<Cell> mCells;
+    // Partitioned mode.  Thread t owns the cells with x in [mSlabBounds[t], mSlabBounds[t + 1]).
+    // Its particles are mSlabParticles[mSlabStart[t]] ... mSlabParticles[mSlabStart[t + 1] - 1],
+    // the last range (t = number of threads) holds the border particles.
+    std::vector<int> mSlabBounds;
+    std::vector<Uint> mSlabStart;
+    std::vector<Uint> mSlabParticles;
+    std::vector<uint32_t> mParticleSlab;
+    Uint mSubstepsSinceRebalance = 0;
     
     friend std::ostream &operator<<(std::ostream &os, Grid const &g);
 };
@@ -0,0 +1,78 @@
+#include "Mesh.hpp"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <limits>
+#include <stdexcept>
+
+Mesh::Mesh(const std::string& path)
+{
+    initFromObj(path);
+    computeBounds();
+}
+
+Mesh::Mesh(std::vector<Triangle> triangles) :
+    mTriangle(std::move(triangles))
+{
+    computeBounds();
+}
+
+const std::vector<Triangle>& Mesh::Triangles() const
+{
+    return mTriangle;
+}
+
+const Vec3& Mesh::Min() const
+{
+    return mMin;
+}
+
+const Vec3& Mesh::Max() const
+{
+    return mMax;
+}
+
+void Mesh::initFromObj(const std::string& path)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn;
+    std::string err;
+
+    // Faces get triangulated by the loader, materials are of no use to us
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str(), nullptr, true))
+    {
+        throw std::runtime_error("Could not load " + path + ": " + err);
+    }
+
+    auto vertex = [&](const tinyobj::index_t& idx) {
+        return Vec3(
+            attrib.vertices[3 * idx.vertex_index],
+            attrib.vertices[3 * idx.vertex_index + 1],
+            attrib.vertices[3 * idx.vertex_index + 2]
+        );
+    };
+
+    for (const tinyobj::shape_t& shape : shapes)
+    {
+        const std::vector<tinyobj::index_t>& indices = shape.mesh.indices;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            mTriangle.push_back({ vertex(indices[i]), vertex(indices[i + 1]), vertex(indices[i + 2]) });
+        }
+    }
+}
+
+void Mesh::computeBounds()
+{
+    mMin = Vec3(std::numeric_limits<Float>::max());
+    mMax = Vec3(std::numeric_limits<Float>::lowest());
+
+    for (const Triangle& t : mTriangle)
+    {
+        mMin = glm::min(mMin, glm::min(t.v1, glm::min(t.v2, t.v3)));
+        mMax = glm::max(mMax, glm::max(t.v1, glm::max(t.v2, t.v3)));
+    }
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "Common.hpp"
 
 #include <string>
@@ -13,11 +15,24 @@ struct Triangle
 class Mesh
 {
 public:
+    // Loads all shapes of an OBJ file into a single triangle soup.  Throws std::runtime_error
+    // if the file can't be read.
     Mesh(const std::string& path);
 
+    // For procedurally generated meshes
+    Mesh(std::vector<Triangle> triangles);
+
+    const std::vector<Triangle>& Triangles() const;
+
+    // Axis aligned bounds of all triangles
+    const Vec3& Min() const;
+    const Vec3& Max() const;
+
 private:
-    void initFromObj();
+    void initFromObj(const std::string& path);
+    void computeBounds();
 
     std::vector<Triangle> mTriangle;
+    Vec3 mMin;
+    Vec3 mMax;
 };
-
@@ -0,0 +1,506 @@
+#include "MeshBVH.hpp"
+
+#include "Mesh.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static const Uint MAX_LEAF_SIZE = 4;
+static const Uint SAH_BINS = 16;
+
+// Deeper than this the tree falls back to median splits, which keeps the total depth below
+// TRAVERSAL_STACK_SIZE for any mesh that fits in memory
+static const Uint MAX_SAH_DEPTH = 64;
+static const int TRAVERSAL_STACK_SIZE = 128;
+
+// Ranges smaller than this are built serially
+static const Uint PARALLEL_BUILD_THRESHOLD = 4096;
+
+static const Float INF = std::numeric_limits<Float>::infinity();
+
+static Float surfaceArea(const Vec3& min, const Vec3& max)
+{
+    const Vec3 d = glm::max(max - min, Vec3(0.0));
+    return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Closest point on triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+static Vec3 closestPointOnTriangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+    const Vec3 ab = b - a;
+    const Vec3 ac = c - a;
+    const Vec3 ap = p - a;
+    const Float d1 = glm::dot(ab, ap);
+    const Float d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0 && d2 <= 0.0) return a;
+
+    const Vec3 bp = p - b;
+    const Float d3 = glm::dot(ab, bp);
+    const Float d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0 && d4 <= d3) return b;
+
+    const Float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) return a + ab * (d1 / (d1 - d3));
+
+    const Vec3 cp = p - c;
+    const Float d5 = glm::dot(ab, cp);
+    const Float d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0 && d5 <= d6) return c;
+
+    const Float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) return a + ac * (d2 / (d2 - d6));
+
+    const Float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    const Float denom = 1.0 / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Moller-Trumbore, only counts hits in front of the origin
+static bool rayHitsTriangle(const Vec3& origin, const Vec3& dir, const Triangle& t)
+{
+    const Vec3 e1 = t.v2 - t.v1;
+    const Vec3 e2 = t.v3 - t.v1;
+    const Vec3 p = glm::cross(dir, e2);
+    const Float det = glm::dot(e1, p);
+    if (det == 0.0) return false;
+
+    const Float invDet = 1.0 / det;
+    const Vec3 s = origin - t.v1;
+    const Float u = glm::dot(s, p) * invDet;
+    if (u < 0.0 || u > 1.0) return false;
+
+    const Vec3 q = glm::cross(s, e1);
+    const Float v = glm::dot(dir, q) * invDet;
+    if (v < 0.0 || u + v > 1.0) return false;
+
+    return glm::dot(e2, q) * invDet > 0.0;
+}
+
+MeshBVH::MeshBVH(const Mesh& mesh, MTIterator& mt) :
+    mMesh(mesh)
+{
+    const std::vector<Triangle>& triangles = mesh.Triangles();
+    const Uint n = triangles.size();
+
+    mIndices.resize(n);
+    mTriMin.resize(n);
+    mTriMax.resize(n);
+    mTriCentroid.resize(n);
+    mt.IterateOverIndices(n, [&](Uint i) {
+        const Triangle& t = triangles[i];
+        mIndices[i] = i;
+        mTriMin[i] = glm::min(t.v1, glm::min(t.v2, t.v3));
+        mTriMax[i] = glm::max(t.v1, glm::max(t.v2, t.v3));
+        mTriCentroid[i] = (t.v1 + t.v2 + t.v3) / Float(3.0);
+    });
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    // The top of the tree is split serially until there are enough independent subtrees to keep
+    // every thread busy.  The subtrees are built in parallel into their own arrays and stitched
+    // into depth first order afterwards.
+    struct TopNode
+    {
+        Uint Begin;
+        Uint End;
+        int Left = -1;
+        int Right = -1;
+        int Subtree = -1;
+    };
+
+    std::vector<TopNode> top;
+    std::vector<Range> subtrees;
+    std::vector<Uint> subtreeDepth;
+    const Uint targetSubtrees = 4 * mt.NumThreads();
+
+    std::function<int(Uint, Uint, Uint)> splitTop = [&](Uint begin, Uint end, Uint depth) {
+        const int idx = top.size();
+        top.push_back(TopNode{ begin, end });
+
+        const Uint mid = (end - begin > PARALLEL_BUILD_THRESHOLD && (Uint(1) << depth) < targetSubtrees) ? split(begin, end) : end;
+        if (mid == end)
+        {
+            top[idx].Subtree = subtrees.size();
+            subtrees.push_back(Range{ begin, end });
+            subtreeDepth.push_back(depth);
+        }
+        else
+        {
+            const int left = splitTop(begin, mid, depth + 1);
+            const int right = splitTop(mid, end, depth + 1);
+            top[idx].Left = left;
+            top[idx].Right = right;
+        }
+        return idx;
+    };
+    splitTop(0, n, 0);
+
+    std::vector<std::vector<Node>> subtreeNodes(subtrees.size());
+    mt.IterateOverIndices(subtrees.size(), [&](Uint s) {
+        buildSubtree(subtrees[s].Begin, subtrees[s].End, subtreeDepth[s], subtreeNodes[s]);
+    });
+
+    std::function<void(int)> flatten = [&](int t) {
+        const TopNode& node = top[t];
+        if (node.Subtree >= 0)
+        {
+            const uint32_t base = mNodes.size();
+            for (Node child : subtreeNodes[node.Subtree])
+            {
+                if (child.Count == 0)
+                {
+                    child.Offset += base;
+                }
+                mNodes.push_back(child);
+            }
+            return;
+        }
+
+        const Uint idx = mNodes.size();
+        mNodes.push_back(makeNode(node.Begin, node.End));
+        mNodes[idx].Count = 0;
+        flatten(node.Left);
+        mNodes[idx].Offset = mNodes.size();
+        flatten(node.Right);
+    };
+    flatten(0);
+
+    // Only needed for building
+    mTriMin = std::vector<Vec3>();
+    mTriMax = std::vector<Vec3>();
+    mTriCentroid = std::vector<Vec3>();
+}
+
+MeshBVH::Node MeshBVH::makeNode(Uint begin, Uint end) const
+{
+    Vec3 min(INF);
+    Vec3 max(-INF);
+    for (Uint i = begin; i < end; i++)
+    {
+        min = glm::min(min, mTriMin[mIndices[i]]);
+        max = glm::max(max, mTriMax[mIndices[i]]);
+    }
+
+    Node node;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        node.Min[axis] = min[axis];
+        node.Max[axis] = max[axis];
+    }
+    node.Min[3] = -INF;
+    node.Max[3] = INF;
+    node.Offset = begin;
+    node.Count = end - begin;
+    return node;
+}
+
+Uint MeshBVH::split(Uint begin, Uint end)
+{
+    const Uint count = end - begin;
+    if (count <= MAX_LEAF_SIZE)
+    {
+        return end;
+    }
+
+    Vec3 cmin(INF);
+    Vec3 cmax(-INF);
+    Vec3 bmin(INF);
+    Vec3 bmax(-INF);
+    for (Uint i = begin; i < end; i++)
+    {
+        cmin = glm::min(cmin, mTriCentroid[mIndices[i]]);
+        cmax = glm::max(cmax, mTriCentroid[mIndices[i]]);
+        bmin = glm::min(bmin, mTriMin[mIndices[i]]);
+        bmax = glm::max(bmax, mTriMax[mIndices[i]]);
+    }
+
+    // Bin along the axis with the largest centroid extent
+    const Vec3 extent = cmax - cmin;
+    const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    if (extent[axis] <= 0.0)
+    {
+        // All centroids coincide - split in the middle to keep the leaves small
+        return splitMedian(begin, end);
+    }
+
+    struct Bin
+    {
+        Vec3 Min = Vec3(INF);
+        Vec3 Max = Vec3(-INF);
+        Uint Count = 0;
+    };
+    Bin bins[SAH_BINS];
+
+    const Float scale = Float(SAH_BINS) / extent[axis];
+    auto binOf = [&](Uint tri) {
+        return std::min(Uint((mTriCentroid[tri][axis] - cmin[axis]) * scale), SAH_BINS - 1);
+    };
+
+    for (Uint i = begin; i < end; i++)
+    {
+        const Uint tri = mIndices[i];
+        Bin& b = bins[binOf(tri)];
+        b.Min = glm::min(b.Min, mTriMin[tri]);
+        b.Max = glm::max(b.Max, mTriMax[tri]);
+        b.Count++;
+    }
+
+    // Sweep from the right to get the cost of every right side, then from the left
+    Float rightArea[SAH_BINS];
+    Uint rightCount[SAH_BINS];
+    Vec3 min(INF);
+    Vec3 max(-INF);
+    Uint running = 0;
+    for (Uint b = SAH_BINS - 1; b > 0; b--)
+    {
+        min = glm::min(min, bins[b].Min);
+        max = glm::max(max, bins[b].Max);
+        running += bins[b].Count;
+        rightArea[b] = surfaceArea(min, max);
+        rightCount[b] = running;
+    }
+
+    Float bestCost = INF;
+    Uint bestSplit = 0;
+    min = Vec3(INF);
+    max = Vec3(-INF);
+    running = 0;
+    for (Uint b = 1; b < SAH_BINS; b++)
+    {
+        min = glm::min(min, bins[b - 1].Min);
+        max = glm::max(max, bins[b - 1].Max);
+        running += bins[b - 1].Count;
+        const Float cost = surfaceArea(min, max) * running + rightArea[b] * rightCount[b];
+        if (running > 0 && rightCount[b] > 0 && cost < bestCost)
+        {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+
+    if (bestSplit == 0)
+    {
+        return splitMedian(begin, end);
+    }
+
+    // Small ranges stay leaves when splitting doesn't pay for the extra traversal step (costed
+    // at one triangle test)
+    const Float area = surfaceArea(bmin, bmax);
+    if (count <= 2 * MAX_LEAF_SIZE && bestCost + area >= area * count)
+    {
+        return end;
+    }
+
+    Uint* mid = std::partition(&mIndices[begin], &mIndices[begin] + count, [&](Uint tri) {
+        return binOf(tri) < bestSplit;
+    });
+    return mid - mIndices.data();
+}
+
+Uint MeshBVH::splitMedian(Uint begin, Uint end)
+{
+    if (end - begin <= MAX_LEAF_SIZE)
+    {
+        return end;
+    }
+
+    Vec3 cmin(INF);
+    Vec3 cmax(-INF);
+    for (Uint i = begin; i < end; i++)
+    {
+        cmin = glm::min(cmin, mTriCentroid[mIndices[i]]);
+        cmax = glm::max(cmax, mTriCentroid[mIndices[i]]);
+    }
+    const Vec3 extent = cmax - cmin;
+    const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    const Uint mid = begin + (end - begin) / 2;
+    std::nth_element(&mIndices[begin], &mIndices[mid], &mIndices[begin] + (end - begin), [&](Uint a, Uint b) {
+        return mTriCentroid[a][axis] < mTriCentroid[b][axis];
+    });
+    return mid;
+}
+
+void MeshBVH::buildSubtree(Uint begin, Uint end, Uint depth, std::vector<Node>& nodes)
+{
+    const Uint idx = nodes.size();
+    nodes.push_back(makeNode(begin, end));
+
+    const Uint mid = depth < MAX_SAH_DEPTH ? split(begin, end) : splitMedian(begin, end);
+    if (mid == end)
+    {
+        return;
+    }
+
+    nodes[idx].Count = 0;
+    buildSubtree(begin, mid, depth + 1, nodes);
+    nodes[idx].Offset = nodes.size();
+    buildSubtree(mid, end, depth + 1, nodes);
+}
+
+Float MeshBVH::intersectNode(const Node& node, const Float origin[4], const Float invDir[4], Float maxT) const
+{
+#ifdef __AVX2__
+    const __m256d o = _mm256_loadu_pd(origin);
+    const __m256d inv = _mm256_loadu_pd(invDir);
+    const __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(node.Min), o), inv);
+    const __m256d t2 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(node.Max), o), inv);
+    __m256d tnear = _mm256_min_pd(t1, t2);
+    __m256d tfar = _mm256_max_pd(t1, t2);
+
+    // Horizontal max of the near and min of the far distances
+    tnear = _mm256_max_pd(tnear, _mm256_permute4x64_pd(tnear, _MM_SHUFFLE(1, 0, 3, 2)));
+    tnear = _mm256_max_pd(tnear, _mm256_permute_pd(tnear, 0x5));
+    tfar = _mm256_min_pd(tfar, _mm256_permute4x64_pd(tfar, _MM_SHUFFLE(1, 0, 3, 2)));
+    tfar = _mm256_min_pd(tfar, _mm256_permute_pd(tfar, 0x5));
+
+    const Float enter = std::max(_mm256_cvtsd_f64(tnear), 0.0);
+    const Float exit = std::min(_mm256_cvtsd_f64(tfar), maxT);
+#else
+    Float enter = 0.0;
+    Float exit = maxT;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const Float t1 = (node.Min[axis] - origin[axis]) * invDir[axis];
+        const Float t2 = (node.Max[axis] - origin[axis]) * invDir[axis];
+        enter = std::max(enter, std::min(t1, t2));
+        exit = std::min(exit, std::max(t1, t2));
+    }
+#endif
+    return enter <= exit ? enter : -1.0;
+}
+
+MeshBVH::ClosestHit MeshBVH::ClosestPoint(const Vec3& pos) const
+{
+    const std::vector<Triangle>& triangles = mMesh.Triangles();
+
+    ClosestHit best;
+    best.Distance = INF;
+    best.Triangle = 0;
+    best.Point = pos;
+    if (mNodes.empty())
+    {
+        return best;
+    }
+
+    auto boxDistance2 = [&](const Node& node) {
+        Float d2 = 0.0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const Float d = std::max(std::max(node.Min[axis] - pos[axis], pos[axis] - node.Max[axis]), 0.0);
+            d2 += d * d;
+        }
+        return d2;
+    };
+
+    Float best2 = INF;
+    uint32_t stack[TRAVERSAL_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node& node = mNodes[stack[--stackSize]];
+        if (boxDistance2(node) >= best2)
+        {
+            continue;
+        }
+
+        if (node.Count > 0)
+        {
+            for (Uint i = node.Offset; i < node.Offset + node.Count; i++)
+            {
+                const Triangle& t = triangles[mIndices[i]];
+                const Vec3 p = closestPointOnTriangle(pos, t.v1, t.v2, t.v3);
+                const Float d2 = glm::dot(p - pos, p - pos);
+                if (d2 < best2)
+                {
+                    best2 = d2;
+                    best.Point = p;
+                    best.Triangle = mIndices[i];
+                }
+            }
+            continue;
+        }
+
+        // Visit the closer child first (it goes on the stack last)
+        const uint32_t first = &node - mNodes.data() + 1;
+        const uint32_t second = node.Offset;
+        if (boxDistance2(mNodes[first]) < boxDistance2(mNodes[second]))
+        {
+            stack[stackSize++] = second;
+            stack[stackSize++] = first;
+        }
+        else
+        {
+            stack[stackSize++] = first;
+            stack[stackSize++] = second;
+        }
+    }
+
+    best.Distance = std::sqrt(best2);
+    return best;
+}
+
+Uint MeshBVH::CountCrossings(const Vec3& origin, const Vec3& dir) const
+{
+    const std::vector<Triangle>& triangles = mMesh.Triangles();
+    if (mNodes.empty())
+    {
+        return 0;
+    }
+
+    // Lane 3 gives -inf / +inf slabs with the padded node bounds so it never limits the interval
+    const Float o[4] = { origin.x, origin.y, origin.z, 0.0 };
+    const Float inv[4] = { 1.0 / dir.x, 1.0 / dir.y, 1.0 / dir.z, 1.0 };
+
+    Uint crossings = 0;
+    uint32_t stack[TRAVERSAL_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node& node = mNodes[stack[--stackSize]];
+        if (intersectNode(node, o, inv, INF) < 0.0)
+        {
+            continue;
+        }
+
+        if (node.Count > 0)
+        {
+            for (Uint i = node.Offset; i < node.Offset + node.Count; i++)
+            {
+                crossings += rayHitsTriangle(origin, dir, triangles[mIndices[i]]) ? 1 : 0;
+            }
+            continue;
+        }
+
+        stack[stackSize++] = node.Offset;
+        stack[stackSize++] = &node - mNodes.data() + 1;
+    }
+
+    return crossings;
+}
+
+bool MeshBVH::Inside(const Vec3& pos) const
+{
+    // An irrational-ish direction so the ray doesn't run along the edges of axis aligned meshes
+    return CountCrossings(pos, Vec3(0.8017837, 0.5345225, 0.2672612)) % 2 == 1;
+}
+
+Uint MeshBVH::NumNodes() const
+{
+    return mNodes.size();
+}
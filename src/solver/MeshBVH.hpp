@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <vector>
+
+class Mesh;
+class MTIterator;
+
+// Bounding volume hierarchy over the triangles of a mesh, for closest point and ray queries
+// (collider SDF baking, seeding, ...).  The tree is built with binned SAH splits and flattened
+// into a single array in depth first order - the first child of a node directly follows it.
+// Queries don't modify the tree so they can run from any number of threads at once.
+class MeshBVH
+{
+public:
+    // The mesh has to outlive the BVH
+    MeshBVH(const Mesh& mesh, MTIterator& mt);
+
+    struct ClosestHit
+    {
+        Vec3 Point;
+        Float Distance;
+        Uint Triangle;
+    };
+
+    // Closest point on the mesh surface to pos
+    ClosestHit ClosestPoint(const Vec3& pos) const;
+
+    // Number of times the ray origin + t * dir (t > 0) crosses the mesh
+    Uint CountCrossings(const Vec3& origin, const Vec3& dir) const;
+
+    // Ray parity test - the mesh has to be closed
+    bool Inside(const Vec3& pos) const;
+
+    Uint NumNodes() const;
+
+private:
+    // Lane 3 of the bounds is padding (-inf / +inf) so boxes can be tested 4 wide
+    struct Node
+    {
+        Float Min[4];
+        Float Max[4];
+        uint32_t Offset; // Leaves:  first entry in mIndices.  Interior nodes:  index of the second child.
+        uint32_t Count;  // Number of triangles for leaves, 0 for interior nodes
+    };
+
+    struct Range
+    {
+        Uint Begin;
+        Uint End;
+    };
+
+    // Partitions mIndices[begin, end) with the best SAH split and returns the split point,
+    // or end if the range should become a leaf
+    Uint split(Uint begin, Uint end);
+    // Splits at the centroid median, bounds the tree depth for pathological meshes
+    Uint splitMedian(Uint begin, Uint end);
+    void buildSubtree(Uint begin, Uint end, Uint depth, std::vector<Node>& nodes);
+    Node makeNode(Uint begin, Uint end) const;
+
+    // Returns the entry distance of the ray into the node, or a negative value on a miss
+    Float intersectNode(const Node& node, const Float origin[4], const Float invDir[4], Float maxT) const;
+
+    const Mesh& mMesh;
+    std::vector<Node> mNodes;
+    std::vector<Uint> mIndices; // Triangle indices, grouped by leaf
+
+    // Per triangle bounds and centroids used while building
+    std::vector<Vec3> mTriMin;
+    std::vector<Vec3> mTriMax;
+    std::vector<Vec3> mTriCentroid;
+};
@@ -0,0 +1,134 @@
+#include "MeshVolume.hpp"
+
+#include "Mesh.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+MeshVolume::MeshVolume(const Mesh& mesh, Float voxelSize, MTIterator& mt) :
+    mOrigin(mesh.Min()),
+    mVoxelSize(voxelSize),
+    mDims(glm::max(IVec3(glm::ceil((mesh.Max() - mesh.Min()) / voxelSize)), IVec3(1)))
+{
+    const std::vector<Triangle>& triangles = mesh.Triangles();
+    const Uint numRows = Uint(mDims.y) * Uint(mDims.z);
+    mInside.assign(numRows * mDims.x, 0);
+
+    // The rays run through the voxel centers, nudged by an odd fraction of a voxel so they
+    // don't graze the edges and vertices of meshes built on the same lattice
+    const Float nudge = voxelSize * 1.2345e-6;
+    auto rayY = [&](int j) { return mOrigin.y + (j + 0.5) * voxelSize + nudge; };
+    auto rayZ = [&](int k) { return mOrigin.z + (k + 0.5) * voxelSize + nudge * 0.618; };
+
+    // Range of rows whose ray passes through the triangle's yz bounds
+    auto rowRange = [&](const Triangle& t, IVec3& low, IVec3& high) {
+        const Vec3 tmin = glm::min(t.v1, glm::min(t.v2, t.v3));
+        const Vec3 tmax = glm::max(t.v1, glm::max(t.v2, t.v3));
+        low.y = std::max(int(std::ceil((tmin.y - mOrigin.y) / voxelSize - 0.5)), 0);
+        low.z = std::max(int(std::ceil((tmin.z - mOrigin.z) / voxelSize - 0.5)), 0);
+        high.y = std::min(int(std::floor((tmax.y - mOrigin.y) / voxelSize - 0.5)), mDims.y - 1);
+        high.z = std::min(int(std::floor((tmax.z - mOrigin.z) / voxelSize - 0.5)), mDims.z - 1);
+    };
+
+    // Bin the triangles by the rows they can hit (count, prefix sum, fill)
+    std::vector<std::atomic<Uint>> rowCursor(numRows);
+    mt.IterateOverIndices(triangles.size(), [&](Uint t) {
+        IVec3 low;
+        IVec3 high;
+        rowRange(triangles[t], low, high);
+        for (int k = low.z; k <= high.z; k++)
+        {
+            for (int j = low.y; j <= high.y; j++)
+            {
+                rowCursor[j + mDims.y * k].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    std::vector<Uint> rowStart(numRows + 1, 0);
+    for (Uint r = 0; r < numRows; r++)
+    {
+        rowStart[r + 1] = rowStart[r] + rowCursor[r].load(std::memory_order_relaxed);
+        rowCursor[r].store(rowStart[r], std::memory_order_relaxed);
+    }
+
+    std::vector<Uint> rowTriangles(rowStart[numRows]);
+    mt.IterateOverIndices(triangles.size(), [&](Uint t) {
+        IVec3 low;
+        IVec3 high;
+        rowRange(triangles[t], low, high);
+        for (int k = low.z; k <= high.z; k++)
+        {
+            for (int j = low.y; j <= high.y; j++)
+            {
+                rowTriangles[rowCursor[j + mDims.y * k].fetch_add(1, std::memory_order_relaxed)] = t;
+            }
+        }
+    });
+
+    // Cast the rays
+    mt.IterateOverIndices(numRows, [&](Uint row) {
+        const int j = row % mDims.y;
+        const int k = row / mDims.y;
+        const Float y = rayY(j);
+        const Float z = rayZ(k);
+
+        std::vector<Float> crossings;
+        for (Uint i = rowStart[row]; i < rowStart[row + 1]; i++)
+        {
+            const Triangle& t = triangles[rowTriangles[i]];
+
+            // Barycentric coordinates of the ray in the triangle projected onto yz
+            const Float e0 = (t.v2.y - y) * (t.v3.z - z) - (t.v3.y - y) * (t.v2.z - z);
+            const Float e1 = (t.v3.y - y) * (t.v1.z - z) - (t.v1.y - y) * (t.v3.z - z);
+            const Float e2 = (t.v1.y - y) * (t.v2.z - z) - (t.v2.y - y) * (t.v1.z - z);
+            const Float area = e0 + e1 + e2;
+
+            const bool hit = area != 0.0 &&
+                ((e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0));
+            if (hit)
+            {
+                crossings.push_back((e0 * t.v1.x + e1 * t.v2.x + e2 * t.v3.x) / area);
+            }
+        }
+
+        std::sort(crossings.begin(), crossings.end());
+
+        uint8_t* inside = &mInside[row * mDims.x];
+        for (Uint c = 0; c + 1 < crossings.size(); c += 2)
+        {
+            const int first = std::max(int(std::ceil((crossings[c] - mOrigin.x) / voxelSize - 0.5)), 0);
+            const int last = std::min(int(std::floor((crossings[c + 1] - mOrigin.x) / voxelSize - 0.5)), mDims.x - 1);
+            for (int i = first; i <= last; i++)
+            {
+                inside[i] = 1;
+            }
+        }
+    });
+}
+
+bool MeshVolume::Inside(const Vec3& pos) const
+{
+    const IVec3 v(glm::floor((pos - mOrigin) / mVoxelSize));
+    if (v.x < 0 || v.y < 0 || v.z < 0 || v.x >= mDims.x || v.y >= mDims.y || v.z >= mDims.z)
+    {
+        return false;
+    }
+    return mInside[v.x + mDims.x * (v.y + Uint(mDims.y) * v.z)] != 0;
+}
+
+const Vec3& MeshVolume::Min() const
+{
+    return mOrigin;
+}
+
+Vec3 MeshVolume::Max() const
+{
+    return mOrigin + Vec3(mDims) * mVoxelSize;
+}
+
+Uint MeshVolume::NumInside() const
+{
+    return std::count(mInside.begin(), mInside.end(), uint8_t(1));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <vector>
+
+class Mesh;
+class MTIterator;
+
+// Inside/outside classification of a closed mesh on a regular grid of voxels.  Every row of
+// voxels along x is classified with a single ray:  the crossings with the mesh are sorted and
+// the voxel centers between every other pair of crossings are inside (ray parity).
+class MeshVolume
+{
+public:
+    MeshVolume(const Mesh& mesh, Float voxelSize, MTIterator& mt);
+
+    // Whether the voxel containing pos is inside the mesh
+    bool Inside(const Vec3& pos) const;
+
+    const Vec3& Min() const;
+    Vec3 Max() const;
+    Uint NumInside() const;
+
+private:
+    Vec3 mOrigin;
+    Float mVoxelSize;
+    IVec3 mDims;
+    std::vector<uint8_t> mInside;
+};
@@ -32,33 +32,50 @@ void OvdbConverter::Output(const std::string& path) const
     grid->setName("snowdensity");
 
     openvdb::FloatGrid::Accessor accessor = grid->getAccessor();
-    for(const Particle &p : mData->GetParticles())
-    {
-        const Vec3& Position = p.pos;
-        // Use our rasterization kernel to accumulate density onto the grid
-
-        // todo:  this is a nasty thing to copy and paste
-        // i'm guessing that the grid random access is awful and it's probably better to use the normal accumulator and
-        // then iterating that (considering I don't have sparsity implemented in the first place)
-        
-        for (int i = -2; i < 3; i++)
+
+    // Use our rasterization kernel to accumulate density onto the grid
+    // i'm guessing that the grid random access is awful and it's probably better to use the normal accumulator and
+    // then iterating that (considering I don't have sparsity implemented in the first place)
+    auto splat = [&](const Particle& p, const StencilWeights& sw) {
+        for (int i = 0; i < 4; i++)
         {
-            for (int j = -2; j < 3; j++)
+            for (int j = 0; j < 4; j++)
             {
-                for (int k = -2; k < 3; k++)
+                for (int k = 0; k < 4; k++)
                 {
-                    // The coordinate of the cell we are rasterizing to
-                    int ix = static_cast<int>(Position.x / H) + i;
-                    int iy = static_cast<int>(Position.y / H) + j;
-                    int iz = static_cast<int>(Position.z / H) + k;
+                    Float nx = sw.w[0][i] * sw.w[1][j] * sw.w[2][k];
 
-                    Float nx = gridWeight(H, Position.x / H, ix, Position.y / H, iy, Position.z / H, iz);
-
-                    openvdb::Coord xyz(ix, iy, iz);
+                    openvdb::Coord xyz(sw.base.x + i, sw.base.y + j, sw.base.z + k);
                     accessor.setValue(xyz, accessor.getValue(xyz) + nx * p.mass);
                 }
             }
         }
+    };
+
+    const std::vector<Particle>& particles = mData->GetParticles();
+    Uint i = 0;
+    for (; i + 4 <= particles.size(); i += 4)
+    {
+        Vec3 x[4];
+        StencilWeights sw[4];
+        for (Uint n = 0; n < 4; n++)
+        {
+            x[n] = Vec3(particles[i + n].pos) / H;
+        }
+
+        stencilWeights4(x, sw);
+
+        for (Uint n = 0; n < 4; n++)
+        {
+            splat(particles[i + n], sw[n]);
+        }
+    }
+
+    for (; i < particles.size(); i++)
+    {
+        StencilWeights sw;
+        stencilWeights(Vec3(particles[i].pos) / H, sw);
+        splat(particles[i], sw);
     }
 
 
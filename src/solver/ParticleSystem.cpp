@@ -3,29 +3,130 @@
 #include "Grid.hpp"
 #include "Math.hpp"
 #include "Multithread.hpp"
+#include "Collider.hpp"
+#include "SleepBlocks.hpp"
 #include "glm/gtx/matrix_operation.hpp"
 
+#include <algorithm>
 #include <exception>
 
 Particle::Particle(const Vec3& pos, Float mass, const Vec3& velocity) :
-    pos(pos),
+    pos(PVec3(pos)),
     mass(mass),
-    velocity(velocity),
+    velocity(PVec3(velocity)),
     volume(0.0), // This is set later
-    m_F_p(Mat3(1.0)),
-    m_F_e(Mat3(1.0)),
-    m_R_e(Mat3(1.0))
+    m_F_p(PMat3(1.0)),
+    m_F_e(PMat3(1.0)),
+    m_R_e(PMat3(1.0)),
+    stress(PMat3(0.0)), // No deformation yet
+    strainRate(0.0),
+    asleep(false)
 {
 }
 
+// Particles per block of the diagnostic sums (a multiple of the SIMD groups in CacheParticleGrads)
+static const Uint DIAGNOSTIC_BLOCK_SIZE = 256;
+
 ParticleSystem::ParticleSystem(const SimulationParameters& parameters) :
-    mParams(parameters)
+    mParams(parameters),
+    mParticles(HugePageAllocator<Particle>(parameters.HUGE_PAGES, parameters.NUM_THREADS, parameters.NUMA_PLACEMENT)),
+    mWeightCache(parameters.WEIGHT_CACHE),
+    mStencilCache(HugePageAllocator<StencilCache>(parameters.HUGE_PAGES, parameters.NUM_THREADS, parameters.NUMA_PLACEMENT)),
+    mStencilCacheStale(true),
+    mPlacedParticles(0)
 {
 }
 
 void ParticleSystem::AddParticle(const Vec3& pos, const Vec3& velocity, const Float mass)
 {
+    mParticles.reserve(CapacityFor(mParticles.size() + 1));
     mParticles.push_back(Particle(pos, mass, velocity)); // Volume is 0 by default
+    mStencilCacheStale = true;
+}
+
+void ParticleSystem::AddParticles(const ParticleSeed* seeds, Uint count)
+{
+    mParticles.reserve(CapacityFor(mParticles.size() + count));
+    for (Uint i = 0; i < count; i++)
+    {
+        mParticles.push_back(Particle(seeds[i].pos, seeds[i].mass, seeds[i].velocity));
+    }
+    mStencilCacheStale = true;
+}
+
+void ParticleSystem::SaveParticles(Uint first, Uint count, ParticleState* out) const
+{
+    for (Uint i = 0; i < count; i++)
+    {
+        const Particle& p = mParticles[first + i];
+        ParticleState& state = out[i];
+        state.Pos = p.pos;
+        state.Velocity = p.velocity;
+        state.Mass = p.mass;
+        state.Volume = p.volume;
+        state.F_e = p.m_F_e;
+        state.F_p = p.m_F_p;
+        state.Asleep = p.asleep ? 1 : 0;
+    }
+}
+
+void ParticleSystem::RestoreParticles(const ParticleState* states, Uint count, MTIterator& mt)
+{
+    mParticles.assign(count, Particle(Vec3(0.0), 0.0, Vec3(0.0)));
+
+    mt.IterateOverIndices(count, [&](Uint i) {
+        const ParticleState& state = states[i];
+        Particle& p = mParticles[i];
+        p.pos = state.Pos;
+        p.velocity = state.Velocity;
+        p.mass = state.Mass;
+        p.volume = state.Volume;
+        p.m_F_e = state.F_e;
+        p.m_F_p = state.F_p;
+        p.asleep = state.Asleep != 0;
+
+        // Same as at the end of the deformation update.  The strain rate is only read after the
+        // next update has set it again (sleeping particles keep it at 0).
+        Mat3 u(1.0);
+        Mat3 s(1.0);
+        Mat3 v(1.0);
+        svd3(Mat3(p.m_F_e), u, s, v);
+        p.m_R_e = PMat3(u * glm::transpose(v));
+        p.stress = PMat3(CalculateCauchyStress(p));
+    });
+    mStencilCacheStale = true;
+}
+
+WeightCache ParticleSystem::GetWeightCache() const
+{
+    return mWeightCache;
+}
+
+void ParticleSystem::SetWeightCache(WeightCache cache)
+{
+    if (cache != mWeightCache)
+    {
+        mWeightCache = cache;
+        mStencilCache.clear();
+        mStencilCache.shrink_to_fit();
+        mStencilCacheStale = true;
+    }
+}
+
+Uint ParticleSystem::CapacityFor(Uint numParticles) const
+{
+    const Uint capacity = mParticles.capacity();
+    return numParticles <= capacity ? capacity : std::max(numParticles, 2 * capacity);
+}
+
+Uint ParticleSystem::ParticleBytes() const
+{
+    return mParticles.capacity() * sizeof(Particle);
+}
+
+Uint ParticleSystem::WeightCacheBytes() const
+{
+    return mStencilCache.capacity() * sizeof(StencilCache);
 }
 
 Mat3 ParticleSystem::CalculateVelocityGradient(const Particle& p, const Grid& g) const 
@@ -33,8 +134,8 @@ Mat3 ParticleSystem::CalculateVelocityGradient(const Particle& p, const Grid& g)
     Mat3 velGrad = Mat3(Float(0.0));
 
     WeightGradOverParticleNeighbourhood(
-        mParams, p,
-        [&](IVec3 pos, Vec3 weightgrad) {
+        *this, p,
+        [&](IVec3 pos, const Vec3& weightgrad) {
             velGrad += glm::outerProduct(g.Get(pos.x, pos.y, pos.z).VelocityStar, weightgrad);
         }
     );
@@ -44,80 +145,221 @@ Mat3 ParticleSystem::CalculateVelocityGradient(const Particle& p, const Grid& g)
 
 Mat3 ParticleSystem::CalculateCauchyStress(const Particle& p) const
 {
-    Float j_p = glm::determinant(p.m_F_p);
-    Float j_e = glm::determinant(p.m_F_e);
+    const Mat3 F_e(p.m_F_e);
+    Float j_p = glm::determinant(Mat3(p.m_F_p));
+    Float j_e = glm::determinant(F_e);
 
     Float hardening = exp(mParams.HARDENING * (1 - j_p));
     Float mu = mParams.MU_0 * hardening;
     Float lambda = mParams.LAMBDA_0 * hardening;
 
-    auto result = Float(2.0) * mu * (p.m_F_e - p.m_R_e) * glm::transpose(p.m_F_e) + Mat3(lambda * (j_e - 1) * j_e);
+    auto result = Float(2.0) * mu * (F_e - Mat3(p.m_R_e)) * glm::transpose(F_e) + Mat3(lambda * (j_e - 1) * j_e);
     
     ASSERT_VALID_MAT3(result);
 
     return result;
 }
+
+Float ParticleSystem::CalculateElasticEnergy(const Particle& p) const
+{
+    const Mat3 F_e(p.m_F_e);
+    Float j_p = glm::determinant(Mat3(p.m_F_p));
+    Float j_e = glm::determinant(F_e);
+
+    Float hardening = exp(mParams.HARDENING * (1 - j_p));
+    Float mu = mParams.MU_0 * hardening;
+    Float lambda = mParams.LAMBDA_0 * hardening;
+
+    // Same fixed corotated energy the stress above is derived from
+    const Mat3 d = F_e - Mat3(p.m_R_e);
+    const Float norm2 = glm::dot(d[0], d[0]) + glm::dot(d[1], d[1]) + glm::dot(d[2], d[2]);
+    return p.volume * (mu * norm2 + 0.5 * lambda * (j_e - 1) * (j_e - 1));
+}
  
-void ParticleSystem::BodyCollisions(Float dt, MTIterator& mt)
+void ParticleSystem::BodyCollisions(Float dt, const std::vector<Collider>& colliders, SleepBlocks* sleepBlocks, MTIterator& mt)
 {
+    if (colliders.empty())
+    {
+        return;
+    }
+
+    mt.IterateOverVector(mParticles, [&](Particle& p) {
+        for (const Collider& collider : colliders)
+        {
+            if (p.asleep)
+            {
+                if (sleepBlocks && collider.Distance(Vec3(p.pos)) <= 0.0)
+                {
+                    sleepBlocks->Wake(Vec3(p.pos));
+                }
+            }
+            else
+            {
+                Vec3 pos(p.pos);
+                Vec3 velocity(p.velocity);
+                collider.Collide(pos, velocity);
+                p.pos = PVec3(pos);
+                p.velocity = PVec3(velocity);
+            }
+        }
+    });
 }
 
-void ParticleSystem::CacheParticleGrads(const Grid& g, MTIterator& mt)
+void ParticleSystem::CacheParticleGrads(const Grid& g, MTIterator& mt, DiagnosticSums* diagnostics, const SleepBlocks* sleepBlocks)
 {
-    mt.IterateOverVector(mParticles, [&](Particle& p) {
-        const auto& Position = p.pos;
-        const auto& H = mParams.H;
+    const Float H = mParams.H;
+
+    // Particles that left the domain (or the grid's slab of it) are clamped back in, which keeps
+    // their stencil inside the halo of the grid
+    const IVec3 end = g.Origin() + g.Dims();
+    const Vec3 domainMin = Vec3(g.Origin()) * H;
+    const Vec3 domainMax(
+        std::nextafter(end.x * H, Float(0.0)),
+        std::nextafter(end.y * H, Float(0.0)),
+        std::nextafter(end.z * H, Float(0.0))
+    );
 
-        p.numNeighbours = 0;
-        
-        for (int i = -2; i < 3; i++)
+    // The particles changed since the last substep, so the full cache of the sleeping ones is
+    // gone too and everything is recomputed once
+    const Uint numParticles = mParticles.size();
+    const bool full = mWeightCache == WeightCache::Full;
+    const bool refreshAll = mStencilCacheStale || (full && mStencilCache.size() != numParticles);
+    if (full)
+    {
+        // Same capacity as the particles rather than the vector's own growth
+        mStencilCache.reserve(mParticles.capacity());
+        mStencilCache.resize(numParticles);
+    }
+    mStencilCacheStale = false;
+
+    // Added (or migrated) particles shift the workers' chunks, and a grown vector was first touched
+    // split by its capacity rather than the particles in it
+    if (mParams.NUMA_PLACEMENT && (refreshAll || numParticles != mPlacedParticles))
+    {
+        PlaceOnWorkerNodes(mParticles, mt.NumThreads());
+        PlaceOnWorkerNodes(mStencilCache, mt.NumThreads());
+        mPlacedParticles = numParticles;
+    }
+
+    auto cacheStencil = [&](Uint idx, const StencilWeights& sw) {
+        mParticles[idx].stencil = sw;
+        if (!full)
         {
-            for (int j = -2; j < 3; j++)
+            return;
+        }
+
+        StencilCache& cache = mStencilCache[idx];
+        Uint n = 0;
+
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
             {
-                for (int k = -2; k < 3; k++)
+                for (int k = 0; k < 4; k++)
                 {
-                    // The coordinate of the cell we are rasterizing to
-                    int ix = static_cast<int>(Position.x / H) + i;
-                    int iy = static_cast<int>(Position.y / H) + j;
-                    int iz = static_cast<int>(Position.z / H) + k;
-
-                    // Check bounds
-                    if (ix < 0 || iy < 0 || iz < 0 ||
-                        ix >= g.Dims().x || iy >= g.Dims().y || iz >= g.Dims().z) {
-                        continue;
-                    }
-
-                    Vec3 nxgrad = gridWeightGrad(H, Position.x / H, ix, Position.y / H, iy, Position.z / H, iz);
-                    Float nx = gridWeight(H, Position.x / H, ix, Position.y / H, iy, Position.z / H, iz);
-
-                    if (nxgrad == Vec3(0) && nx == 0)
-                    {
-                        continue;
-                    }
-
-                    
-                    if(p.numNeighbours > 63) 
-                    {
-                        throw std::exception("Error in creating gradient kernel cache, crashing due to potential data corruption!");
-                    }
-
-                    p.neighbours_coords[p.numNeighbours] = IVec3(ix, iy, iz);
-                    p.neighbours_nx[p.numNeighbours] = nx;
-                    p.neighbours_nxgrad[p.numNeighbours] = nxgrad;
-                    p.numNeighbours++;
-
+                    Float nx = sw.w[0][i] * sw.w[1][j] * sw.w[2][k];
+                    Vec3 nxgrad = Vec3(
+                        sw.dw[0][i] * sw.w[1][j] * sw.w[2][k],
+                        sw.w[0][i] * sw.dw[1][j] * sw.w[2][k],
+                        sw.w[0][i] * sw.w[1][j] * sw.dw[2][k]
+                    ) / H;
+
+                    cache.Weights[n] = nx;
+                    cache.Gradients[n] = PVec3(nxgrad);
+                    n++;
                 }
             }
         }
+    };
+
+    // The weights are evaluated 4 particles at a time.  The groups of 4 are fixed by the particle
+    // index (the last one padded) so every particle takes the same path no matter how the work is
+    // split between threads - which keeps the results independent of the thread count.
+    auto cacheGroup = [&](Uint g) {
+        const Uint first = 4 * g;
+        const Uint count = std::min(numParticles - first, Uint(4));
+
+        // Sleeping particles haven't moved so their cache is still valid - unless they only fell
+        // asleep at the end of the last substep, after moving away from where it was computed
+        bool toCache[4] = { false, false, false, false };
+        bool anyToCache = false;
+        for (Uint n = 0; n < count; n++)
+        {
+            Particle& p = mParticles[first + n];
+            toCache[n] = !p.asleep || refreshAll || (sleepBlocks && sleepBlocks->Recaching(Vec3(p.pos)));
+            if (toCache[n])
+            {
+                p.pos = PVec3(glm::clamp(Vec3(p.pos), domainMin, domainMax));
+            }
+            anyToCache = anyToCache || toCache[n];
+        }
+
+        if (!anyToCache)
+        {
+            return;
+        }
+
+        Vec3 x[4];
+        StencilWeights sw[4];
+        for (Uint n = 0; n < 4; n++)
+        {
+            x[n] = Vec3(mParticles[first + std::min(n, count - 1)].pos) / H;
+        }
+
+        stencilWeights4(x, sw);
+
+        for (Uint n = 0; n < count; n++)
+        {
+            if (toCache[n])
+            {
+                cacheStencil(first + n, sw[n]);
+            }
+        }
+    };
+
+    if (diagnostics)
+    {
+        *diagnostics = mt.ReduceOverBlocks<DiagnosticSums>(numParticles, DIAGNOSTIC_BLOCK_SIZE,
+            [&](Uint low, Uint high, DiagnosticSums& sums) {
+                for (Uint g = low / 4; g < (high + 3) / 4; g++)
+                {
+                    cacheGroup(g);
+                }
+                for (Uint i = low; i < high; i++)
+                {
+                    const Particle& p = mParticles[i];
+                    sums.Add(p.mass, Vec3(p.velocity));
+                    sums.ElasticEnergy += CalculateElasticEnergy(p);
+                }
+            },
+            [](DiagnosticSums& total, const DiagnosticSums& partial) { total.Merge(partial); });
+        return;
+    }
+
+    mt.IterateOverChunks((numParticles + 3) / 4, [&](Uint low, Uint high, Uint threadIdx) {
+        for (Uint g = low; g < high; g++)
+        {
+            cacheGroup(g);
+        }
     });
 }
 
 void ParticleSystem::UpdateDeformationGradients(Float dt, const Grid& g, MTIterator& mt)
 {
     mt.IterateOverVector(mParticles, [&](Particle& p) {
+        if (p.asleep) {
+            return;
+        }
+
+        Mat3 velGrad = CalculateVelocityGradient(p, g);
+        p.strainRate = std::sqrt(
+            glm::dot(velGrad[0], velGrad[0]) + glm::dot(velGrad[1], velGrad[1]) + glm::dot(velGrad[2], velGrad[2])
+        );
+
         // First attribute all new changes to elastic part of deformation
-        Mat3 new_fe = (Mat3(Float(1.0)) + dt * CalculateVelocityGradient(p, g)) * p.m_F_e;
-        Mat3 new_f = new_fe * p.m_F_p;
+        // The deformation is updated (and decomposed) in double precision whatever it's stored in
+        Mat3 new_fe = (Mat3(Float(1.0)) + dt * velGrad) * Mat3(p.m_F_e);
+        Mat3 new_f = new_fe * Mat3(p.m_F_p);
         
         Mat3 u(1.0);
         Mat3 s(1.0);
@@ -134,17 +376,22 @@ void ParticleSystem::UpdateDeformationGradients(Float dt, const Grid& g, MTItera
             sinv[i][i] = Float(1.0) / s[i][i];
         }
 
-        p.m_F_e = u * s * glm::transpose(v);
-        p.m_F_p = v * sinv * glm::transpose(u) * new_f;
+        const Mat3 F_e = u * s * glm::transpose(v);
+        const Mat3 F_p = v * sinv * glm::transpose(u) * new_f;
 
         // todo:  can we use any properties of the previous SVD to speed this up?
 
-        svd3(p.m_F_e, u, s, v); 
-        p.m_R_e = u * glm::transpose(v);
+        svd3(F_e, u, s, v); 
+        const Mat3 R_e = u * glm::transpose(v);
+
+        ASSERT_VALID_MAT3(F_e);
+        ASSERT_VALID_MAT3(F_p);
+        ASSERT_VALID_MAT3(R_e);
 
-        ASSERT_VALID_MAT3(p.m_F_e);
-        ASSERT_VALID_MAT3(p.m_F_p);
-        ASSERT_VALID_MAT3(p.m_R_e);
+        p.m_F_e = PMat3(F_e);
+        p.m_F_p = PMat3(F_p);
+        p.m_R_e = PMat3(R_e);
+        p.stress = PMat3(CalculateCauchyStress(p));
     });
 }
 
@@ -154,7 +401,7 @@ void ParticleSystem::EstimateParticleVolumes(const Grid& g, MTIterator& mt)
         Float particleDensity = 0;
 
         WeightOverParticleNeighbourhood(
-            mParams, particle,
+            *this, particle,
             [&](IVec3 pos, Float weight) {
 
                 Float cellvolume = mParams.H * mParams.H * mParams.H;
@@ -175,10 +422,10 @@ void ParticleSystem::EstimateParticleVolumes(const Grid& g, MTIterator& mt)
 void ParticleSystem::CalculateFlipPicVelocity(const Particle& p, const Grid& g, Vec3& flip, Vec3& pic) const
 {
     flip = Vec3(0.0);
-    pic = p.velocity;
+    pic = Vec3(p.velocity);
 
     WeightOverParticleNeighbourhood(
-        mParams, p,
+        *this, p,
         [&](IVec3 pos, Float weight) {
             // Transfer mass
             const Cell& cell = g.Get(pos.x, pos.y, pos.z);
@@ -188,31 +435,78 @@ void ParticleSystem::CalculateFlipPicVelocity(const Particle& p, const Grid& g,
     );
 }
 
-void ParticleSystem::UpdateVelocities(const Grid& g, MTIterator& mt)
+void ParticleSystem::UpdateVelocities(const Grid& g, MTIterator& mt, DiagnosticSums* diagnostics)
 {
-    mt.IterateOverVector(mParticles, [&](Particle& p) {
+    auto update = [&](Particle& p) {
+        if (p.asleep) {
+            return;
+        }
+
         Vec3 flip;
         Vec3 pic;
 
         CalculateFlipPicVelocity(p, g, pic, flip);
-        p.velocity = (1 - mParams.ALPHA) * pic + mParams.ALPHA * flip;
-    });
+        p.velocity = PVec3((1 - mParams.ALPHA) * pic + mParams.ALPHA * flip);
+    };
+
+    if (diagnostics)
+    {
+        *diagnostics = mt.ReduceOverBlocks<DiagnosticSums>(mParticles.size(), DIAGNOSTIC_BLOCK_SIZE,
+            [&](Uint low, Uint high, DiagnosticSums& sums) {
+                for (Uint i = low; i < high; i++)
+                {
+                    Particle& p = mParticles[i];
+                    update(p);
+                    sums.Add(p.mass, Vec3(p.velocity));
+                    sums.ElasticEnergy += CalculateElasticEnergy(p);
+                }
+            },
+            [](DiagnosticSums& total, const DiagnosticSums& partial) { total.Merge(partial); });
+        return;
+    }
+
+    mt.IterateOverVector(mParticles, update);
 }
 
 
 void ParticleSystem::UpdatePositions(Float dt, MTIterator& mt) 
 {
     mt.IterateOverVector(mParticles, [&](Particle& p) {
-        p.pos += dt * p.velocity; 
+        if (!p.asleep) {
+            p.pos = PVec3(Vec3(p.pos) + dt * Vec3(p.velocity));
+        }
+    });
+}
+
+Uint ParticleSystem::FindInvalidParticle(MTIterator& mt) const
+{
+    const Uint numParticles = mParticles.size();
+    std::vector<Uint> firstInvalid(mt.NumThreads(), numParticles);
+
+    mt.IterateOverChunks(numParticles, [&](Uint low, Uint high, Uint threadIdx) {
+        for (Uint i = low; i < high; i++)
+        {
+            const Particle& p = mParticles[i];
+            const bool invalid =
+                AnyNonFinite(p.pos) | AnyNonFinite(p.velocity) | AnyNonFinite(p.mass) | AnyNonFinite(p.volume) |
+                AnyNonFinite(p.m_F_p) | AnyNonFinite(p.m_F_e) | AnyNonFinite(p.m_R_e) | AnyNonFinite(p.stress);
+            if (invalid)
+            {
+                firstInvalid[threadIdx] = i;
+                return;
+            }
+        }
     });
+
+    return *std::min_element(firstInvalid.begin(), firstInvalid.end());
 }
 
-std::vector<Particle>& ParticleSystem::GetParticles()
+ParticleVector& ParticleSystem::GetParticles()
 {
     return mParticles;
 }
 
-const std::vector<Particle>& ParticleSystem::GetParticles() const
+const ParticleVector& ParticleSystem::GetParticles() const
 {
     return mParticles;
 }
@@ -4,61 +4,173 @@
 
 #include "Common.hpp"
 #include <array>
+#include "Math.hpp"
 #include "SimulationParameters.hpp"
+#include "SolverStats.hpp"
 
 using ParticleHandle = Uint;
 
 class Grid;
 class ParticleSystem;
 class MTIterator;
+class Collider;
+class SleepBlocks;
+
+// Initial state of a particle added to the simulation
+struct ParticleSeed
+{
+    Vec3 pos;
+    Vec3 velocity;
+    Float mass;
+};
+
+// Every particle reaches a full 4x4x4 block of nodes (the grid has a halo so
+// the block never needs to be clipped)
+static const Uint STENCIL_SIZE = 64;
 
 // todo:  this class is getting fat and is almost 1kb at this point.
 // It may be a performance improvement to split this up, because the data is being accessed 
 // contiguously anyways, 
+//
+// The vectors and matrices are stored as PVec3/PMat3 (single precision with SNOW_FLOAT_PARTICLES)
+// and converted to Vec3/Mat3 before doing any arithmetic on them.
 class Particle {
 public:
-    Vec3 pos;
+    PVec3 pos;
     Float mass;
-    Vec3 velocity;
+    PVec3 velocity;
     Float volume;
-    Mat3 m_F_p;
-    Mat3 m_F_e;
-    Mat3 m_R_e;
+    PMat3 m_F_p;
+    PMat3 m_F_e;
+    PMat3 m_R_e;
+
+    // Cauchy stress of the current deformation - updated along with the deformation gradient
+    // so that sleeping particles keep contributing it without being reevaluated
+    PMat3 stress;
+
+    // Norm of the velocity gradient from the last deformation update
+    Float strainRate;
+
+    // Sleeping particles are skipped by everything, their blocks transfer a cached sum to the grid
+    // instead (see SleepBlocks)
+    bool asleep;
     
     // We cache this since it ends up being quite expensive
-    // to do this every time (calculating the gradient is 27 branches )
-    Uint numNeighbours;
-    std::array<IVec3, 64> neighbours_coords;
-    std::array<Float, 64> neighbours_nx;
-    std::array<Vec3, 64> neighbours_nxgrad;
+    // to do this every time (calculating the gradient is 27 branches ).  Only the per axis
+    // weights live in the particle, the products over the whole stencil are in the
+    // ParticleSystem's StencilCache (WeightCache::Full).  The weights are kept in double
+    // whatever the storage precision, so that they still add up to 1 and the transfers conserve
+    // mass and momentum.
+    StencilWeights stencil;
 
 private:
     Particle(const Vec3& pos, Float mass, const Vec3& velocity);
     friend ParticleSystem;
 };
 
+// The part of a particle's state that isn't derived from the rest, which is all checkpoints keep.
+// The rotation of F_e, the stress and the stencil weights are recomputed on restore.  Asleep is
+// 0 or 1, it's 8 bytes wide so the record has no padding.
+struct ParticleState
+{
+    PVec3 Pos;
+    PVec3 Velocity;
+    Float Mass;
+    Float Volume;
+    PMat3 F_e;
+    PMat3 F_p;
+    uint64_t Asleep;
+};
+
+// Backed by huge pages with SimulationParameters::HUGE_PAGES
+using ParticleVector = std::vector<Particle, HugePageAllocator<Particle>>;
+
+// Weights and weight gradients of the nodes of one particle's stencil, in the order
+// WeightOverParticleNeighbourhood visits them
+struct StencilCache
+{
+    std::array<Float, STENCIL_SIZE> Weights;
+    std::array<PVec3, STENCIL_SIZE> Gradients;
+};
+
 class ParticleSystem {
 public:
     ParticleSystem(const SimulationParameters& parameters);
     void AddParticle(const Vec3& pos, const Vec3& velocity, const Float mass);
 
+    // Adds count particles with a single allocation
+    void AddParticles(const ParticleSeed* seeds, Uint count);
+
+    // Capacity of the particle storage (and of the full weight cache) once particles are added up
+    // to numParticles.  The storage grows by doubling, so a single added particle can allocate
+    // twice what is needed - the memory budget is checked against this rather than numParticles.
+    Uint CapacityFor(Uint numParticles) const;
+
+    // Copies out the state of the particles [first, first + count)
+    void SaveParticles(Uint first, Uint count, ParticleState* out) const;
+
+    // Replaces all particles with the given states (eg. from a checkpoint) and recomputes what's
+    // derived from them
+    void RestoreParticles(const ParticleState* states, Uint count, MTIterator& mt);
+
     Mat3 CalculateCauchyStress(const Particle& p) const;
 
-    void CacheParticleGrads(const Grid& g, MTIterator& mt);
+    // Elastic potential of the particle's F_e (energy density times the particle volume)
+    Float CalculateElasticEnergy(const Particle& p) const;
+
+    // CacheParticleGrads and UpdateVelocities sum up the particles into diagnostics along the way
+    // unless it's null.  CacheParticleGrads keeps the weights of sleeping particles, except in the
+    // blocks of sleepBlocks (may be null) that take their sums again.
+    void CacheParticleGrads(const Grid& g, MTIterator& mt, DiagnosticSums* diagnostics = nullptr, const SleepBlocks* sleepBlocks = nullptr);
     void EstimateParticleVolumes(const Grid& g, MTIterator& mt);
     void UpdateDeformationGradients(const Float dt, const Grid& g, MTIterator& mt);
-    void UpdateVelocities(const Grid& g, MTIterator& mt);
-    void BodyCollisions(Float dt, MTIterator& mt);
+    void UpdateVelocities(const Grid& g, MTIterator& mt, DiagnosticSums* diagnostics = nullptr);
+    // Sleeping particles touched by a collider wake up their block instead (sleepBlocks may be null)
+    void BodyCollisions(Float dt, const std::vector<Collider>& colliders, SleepBlocks* sleepBlocks, MTIterator& mt);
     void UpdatePositions(Float dt, MTIterator& mt);
 
+    // Index of the first particle with a NaN or infinite value in its state, or the number of
+    // particles if they are all fine
+    Uint FindInvalidParticle(MTIterator& mt) const;
+
+    // Starts out as WEIGHT_CACHE, the solver switches to the compact one when the full one
+    // doesn't fit its memory budget
+    WeightCache GetWeightCache() const;
+    void SetWeightCache(WeightCache cache);
+
+    // Full weight cache of the particle, or null with the compact one.  Only valid after
+    // CacheParticleGrads.
+    const StencilCache* GetStencilCache(const Particle& p) const
+    {
+        return mWeightCache == WeightCache::Full ? &mStencilCache[&p - mParticles.data()] : nullptr;
+    }
+
+    Float CellSize() const
+    {
+        return mParams.H;
+    }
+
+    // Bytes allocated for the particles and for the weight cache
+    Uint ParticleBytes() const;
+    Uint WeightCacheBytes() const;
+
     // todo:  This interface is 'dirty' - does a better way for contignuous particle data access exist?
-    std::vector<Particle>& GetParticles();
-    const std::vector<Particle>& GetParticles() const;
+    ParticleVector& GetParticles();
+    const ParticleVector& GetParticles() const;
 
 private:
     void CalculateFlipPicVelocity(const Particle& p, const Grid& g, Vec3& flip, Vec3& pic) const;
     Mat3 CalculateVelocityGradient(const Particle& p, const Grid& g) const;
 
     const SimulationParameters& mParams;
-    std::vector<Particle> mParticles;
+    ParticleVector mParticles;
+
+    // One per particle with WeightCache::Full, empty otherwise.  When the particles change the
+    // cache of the sleeping ones (which aren't recomputed every substep) has to be rebuilt too.
+    WeightCache mWeightCache;
+    std::vector<StencilCache, HugePageAllocator<StencilCache>> mStencilCache;
+    bool mStencilCacheStale;
+
+    // Particles the last PlaceOnWorkerNodes placed with NUMA_PLACEMENT
+    Uint mPlacedParticles;
 };
@@ -0,0 +1,458 @@
+#include "Scene.hpp"
+
+#include "Json.hpp"
+#include "Math.hpp"
+#include "Mesh.hpp"
+#include "MeshVolume.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <stdexcept>
+
+namespace
+{
+    // Typed access to the members of a JSON object.  Remembers which keys were read so Finish can
+    // reject the ones nobody asked for.
+    class Fields
+    {
+    public:
+        Fields(const JsonValue& value, const std::string& where) : mWhere(where)
+        {
+            if (value.GetType() != JsonValue::Type::Object)
+            {
+                fail(std::string("expected an object, got ") + JsonTypeName(value.GetType()));
+            }
+            mObject = &value.AsObject();
+        }
+
+        [[noreturn]] void fail(const std::string& message) const
+        {
+            throw std::runtime_error(mWhere + ": " + message);
+        }
+
+        bool Has(const std::string& key) const
+        {
+            return mObject->count(key) != 0;
+        }
+
+        const JsonValue& Get(const std::string& key)
+        {
+            auto it = mObject->find(key);
+            if (it == mObject->end())
+            {
+                fail("missing \"" + key + "\"");
+            }
+            mUsed.insert(key);
+            return it->second;
+        }
+
+        Float Number(const std::string& key)
+        {
+            const JsonValue& value = Get(key);
+            if (value.GetType() != JsonValue::Type::Number)
+            {
+                fail("\"" + key + "\" has to be a number");
+            }
+            return value.AsNumber();
+        }
+
+        Float Number(const std::string& key, Float fallback)
+        {
+            return Has(key) ? Number(key) : fallback;
+        }
+
+        Uint Count(const std::string& key)
+        {
+            const Float value = Number(key);
+            if (value < 0.0 || value != std::floor(value))
+            {
+                fail("\"" + key + "\" has to be a non-negative integer");
+            }
+            return Uint(value);
+        }
+
+        Uint Count(const std::string& key, Uint fallback)
+        {
+            return Has(key) ? Count(key) : fallback;
+        }
+
+        bool Bool(const std::string& key)
+        {
+            const JsonValue& value = Get(key);
+            if (value.GetType() != JsonValue::Type::Bool)
+            {
+                fail("\"" + key + "\" has to be true or false");
+            }
+            return value.AsBool();
+        }
+
+        std::string String(const std::string& key)
+        {
+            const JsonValue& value = Get(key);
+            if (value.GetType() != JsonValue::Type::String)
+            {
+                fail("\"" + key + "\" has to be a string");
+            }
+            return value.AsString();
+        }
+
+        std::string String(const std::string& key, const std::string& fallback)
+        {
+            return Has(key) ? String(key) : fallback;
+        }
+
+        Vec3 Vector(const std::string& key)
+        {
+            const JsonValue& value = Get(key);
+            if (value.GetType() != JsonValue::Type::Array || value.AsArray().size() != 3)
+            {
+                fail("\"" + key + "\" has to be an array of 3 numbers");
+            }
+            Vec3 result;
+            for (int a = 0; a < 3; a++)
+            {
+                if (value.AsArray()[a].GetType() != JsonValue::Type::Number)
+                {
+                    fail("\"" + key + "\" has to be an array of 3 numbers");
+                }
+                result[a] = value.AsArray()[a].AsNumber();
+            }
+            return result;
+        }
+
+        Vec3 Vector(const std::string& key, const Vec3& fallback)
+        {
+            return Has(key) ? Vector(key) : fallback;
+        }
+
+        const std::vector<JsonValue>& Array(const std::string& key)
+        {
+            const JsonValue& value = Get(key);
+            if (value.GetType() != JsonValue::Type::Array)
+            {
+                fail("\"" + key + "\" has to be an array");
+            }
+            return value.AsArray();
+        }
+
+        // Name of an entry for the error messages of nested values
+        std::string Where(const std::string& key) const
+        {
+            return mWhere + "." + key;
+        }
+
+        void Finish() const
+        {
+            for (const auto& member : *mObject)
+            {
+                if (mUsed.count(member.first) == 0)
+                {
+                    fail("unknown key \"" + member.first + "\"");
+                }
+            }
+        }
+
+    private:
+        std::string mWhere;
+        const std::map<std::string, JsonValue>* mObject;
+        std::set<std::string> mUsed;
+    };
+
+    // Setters for every SimulationParameters field, by field name
+    using ParameterSetter = std::function<void(Fields&, const std::string&, SimulationParameters&)>;
+
+    ParameterSetter floatParam(Float SimulationParameters::* field)
+    {
+        return [field](Fields& f, const std::string& key, SimulationParameters& p) { p.*field = f.Number(key); };
+    }
+
+    ParameterSetter uintParam(Uint SimulationParameters::* field)
+    {
+        return [field](Fields& f, const std::string& key, SimulationParameters& p) { p.*field = f.Count(key); };
+    }
+
+    ParameterSetter intParam(int SimulationParameters::* field)
+    {
+        return [field](Fields& f, const std::string& key, SimulationParameters& p) { p.*field = int(f.Count(key)); };
+    }
+
+    ParameterSetter boolParam(bool SimulationParameters::* field)
+    {
+        return [field](Fields& f, const std::string& key, SimulationParameters& p) { p.*field = f.Bool(key); };
+    }
+
+    const std::map<std::string, ParameterSetter>& parameterSetters()
+    {
+        static const std::map<std::string, ParameterSetter> setters = {
+            { "H", floatParam(&SimulationParameters::H) },
+            { "HARDENING", floatParam(&SimulationParameters::HARDENING) },
+            { "MU_0", floatParam(&SimulationParameters::MU_0) },
+            { "LAMBDA_0", floatParam(&SimulationParameters::LAMBDA_0) },
+            { "PHI_C", floatParam(&SimulationParameters::PHI_C) },
+            { "PHI_S", floatParam(&SimulationParameters::PHI_S) },
+            { "ALPHA", floatParam(&SimulationParameters::ALPHA) },
+            { "GRAVITY", floatParam(&SimulationParameters::GRAVITY) },
+            { "P2G_MODE", [](Fields& f, const std::string& key, SimulationParameters& p) {
+                const std::string mode = f.String(key);
+                if (mode == "Scatter") p.P2G_MODE = P2GMode::Scatter;
+                else if (mode == "Gather") p.P2G_MODE = P2GMode::Gather;
+                else if (mode == "Partitioned") p.P2G_MODE = P2GMode::Partitioned;
+                else f.fail("\"" + key + "\" has to be Scatter, Gather or Partitioned");
+            } },
+            { "DETERMINISTIC", boolParam(&SimulationParameters::DETERMINISTIC) },
+            { "DIAGNOSTICS", boolParam(&SimulationParameters::DIAGNOSTICS) },
+            { "PERF_COUNTERS", boolParam(&SimulationParameters::PERF_COUNTERS) },
+            { "VALIDATION_SUBSTEPS", uintParam(&SimulationParameters::VALIDATION_SUBSTEPS) },
+            { "WEIGHT_CACHE", [](Fields& f, const std::string& key, SimulationParameters& p) {
+                const std::string cache = f.String(key);
+                if (cache == "Full") p.WEIGHT_CACHE = WeightCache::Full;
+                else if (cache == "Compact") p.WEIGHT_CACHE = WeightCache::Compact;
+                else f.fail("\"" + key + "\" has to be Full or Compact");
+            } },
+            { "HUGE_PAGES", [](Fields& f, const std::string& key, SimulationParameters& p) {
+                const std::string pages = f.String(key);
+                if (pages == "Off") p.HUGE_PAGES = HugePages::Off;
+                else if (pages == "Transparent") p.HUGE_PAGES = HugePages::Transparent;
+                else if (pages == "Reserved") p.HUGE_PAGES = HugePages::Reserved;
+                else f.fail("\"" + key + "\" has to be Off, Transparent or Reserved");
+            } },
+            { "NUMA_PLACEMENT", boolParam(&SimulationParameters::NUMA_PLACEMENT) },
+            { "MEMORY_BUDGET_MB", uintParam(&SimulationParameters::MEMORY_BUDGET_MB) },
+            { "NUM_THREADS", uintParam(&SimulationParameters::NUM_THREADS) },
+            { "PARTITION_REBALANCE_SUBSTEPS", uintParam(&SimulationParameters::PARTITION_REBALANCE_SUBSTEPS) },
+            { "SLEEPING", boolParam(&SimulationParameters::SLEEPING) },
+            { "SLEEP_BLOCK_SIZE", intParam(&SimulationParameters::SLEEP_BLOCK_SIZE) },
+            { "SLEEP_VELOCITY", floatParam(&SimulationParameters::SLEEP_VELOCITY) },
+            { "SLEEP_STRAIN_RATE", floatParam(&SimulationParameters::SLEEP_STRAIN_RATE) },
+            { "SLEEP_SUBSTEPS", uintParam(&SimulationParameters::SLEEP_SUBSTEPS) },
+        };
+        return setters;
+    }
+
+    SimulationParameters readParameters(Fields& f)
+    {
+        SimulationParameters params;
+        Fields fields(f.Get("parameters"), f.Where("parameters"));
+        for (const auto& setter : parameterSetters())
+        {
+            if (fields.Has(setter.first))
+            {
+                setter.second(fields, setter.first, params);
+            }
+        }
+        fields.Finish();
+
+        if (params.H <= 0.0)
+        {
+            fields.fail("\"H\" has to be positive");
+        }
+        if (params.NUM_THREADS == 0)
+        {
+            fields.fail("\"NUM_THREADS\" has to be at least 1");
+        }
+        if (params.SLEEP_BLOCK_SIZE < 1)
+        {
+            fields.fail("\"SLEEP_BLOCK_SIZE\" has to be at least 1");
+        }
+        return params;
+    }
+
+    std::string resolvePath(const std::string& sceneDir, const std::string& path)
+    {
+        const bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+        return absolute || sceneDir.empty() ? path : sceneDir + "/" + path;
+    }
+
+    std::shared_ptr<Emitter> readEmitter(Fields& f, Scene& scene, const std::string& sceneDir, MTIterator& mt)
+    {
+        EmitterSettings settings;
+        const std::string sampling = f.String("sampling", "lattice");
+        if (sampling == "lattice") settings.Sampling = EmitterSampling::Lattice;
+        else if (sampling == "poissonDisk") settings.Sampling = EmitterSampling::PoissonDisk;
+        else f.fail("\"sampling\" has to be lattice or poissonDisk");
+
+        settings.Spacing = f.Number("spacing", settings.Spacing);
+        settings.Jitter = f.Number("jitter", settings.Jitter);
+        settings.Velocity = f.Vector("velocity", settings.Velocity);
+        settings.Mass = f.Number("mass", settings.Mass);
+        settings.Seed = f.Count("seed", settings.Seed);
+        if (settings.Spacing <= 0.0)
+        {
+            f.fail("\"spacing\" has to be positive");
+        }
+
+        const std::string shape = f.String("shape");
+        if (shape == "box")
+        {
+            return std::make_shared<BoxEmitter>(f.Vector("min"), f.Vector("max"), settings);
+        }
+        if (shape == "sphere")
+        {
+            return std::make_shared<SphereEmitter>(f.Vector("center"), f.Number("radius"), settings);
+        }
+        if (shape == "mesh")
+        {
+            const Mesh mesh(resolvePath(sceneDir, f.String("path")));
+            scene.Volumes.push_back(std::make_shared<MeshVolume>(mesh, f.Number("voxelSize"), mt));
+            return std::make_shared<MeshEmitter>(*scene.Volumes.back(), settings);
+        }
+        f.fail("unknown emitter shape \"" + shape + "\"");
+    }
+
+    std::shared_ptr<ColliderSDF> readColliderShape(Fields& f, const std::string& sceneDir, MTIterator& mt)
+    {
+        const Float voxelSize = f.Number("voxelSize");
+        if (voxelSize <= 0.0)
+        {
+            f.fail("\"voxelSize\" has to be positive");
+        }
+        // Enough room around the shape for the normals at its surface
+        const Float padding = f.Number("padding", 4.0 * voxelSize);
+
+        const std::string shape = f.String("shape");
+        if (shape == "box")
+        {
+            const Vec3 halfSize = f.Vector("halfSize");
+            return std::make_shared<ColliderSDF>(-halfSize - Vec3(padding), halfSize + Vec3(padding), voxelSize, [halfSize](const Vec3& p) {
+                const Vec3 d = glm::abs(p) - halfSize;
+                return glm::length(glm::max(d, Vec3(0.0))) + std::min(std::max(d.x, std::max(d.y, d.z)), 0.0);
+            }, mt);
+        }
+        if (shape == "sphere")
+        {
+            const Float radius = f.Number("radius");
+            return std::make_shared<ColliderSDF>(Vec3(-radius - padding), Vec3(radius + padding), voxelSize, [radius](const Vec3& p) {
+                return glm::length(p) - radius;
+            }, mt);
+        }
+        if (shape == "mesh")
+        {
+            return std::make_shared<ColliderSDF>(Mesh(resolvePath(sceneDir, f.String("path"))), voxelSize, padding, mt);
+        }
+        f.fail("unknown collider shape \"" + shape + "\"");
+    }
+
+    Collider readCollider(Fields& f, const std::string& sceneDir, MTIterator& mt)
+    {
+        std::shared_ptr<ColliderSDF> sdf = readColliderShape(f, sceneDir, mt);
+        const Float friction = f.Number("friction");
+
+        if (f.Has("keyframes"))
+        {
+            std::vector<ColliderKeyframe> keyframes;
+            const std::vector<JsonValue>& keys = f.Array("keyframes");
+            for (Uint i = 0; i < keys.size(); i++)
+            {
+                Fields key(keys[i], f.Where("keyframes[" + std::to_string(i) + "]"));
+                keyframes.push_back({ key.Number("time"), key.Vector("position", Vec3(0.0)), rotationFromAxisAngle(key.Vector("rotation", Vec3(0.0))) });
+                key.Finish();
+
+                // Colliders interpolate between the keyframes around the current time
+                if (i > 0 && keyframes[i].Time <= keyframes[i - 1].Time)
+                {
+                    key.fail("\"time\" has to be after the time of the previous keyframe");
+                }
+            }
+            if (keyframes.empty())
+            {
+                f.fail("\"keyframes\" can't be empty");
+            }
+            return Collider(sdf, keyframes, friction);
+        }
+
+        return Collider(
+            sdf,
+            f.Vector("position", Vec3(0.0)),
+            rotationFromAxisAngle(f.Vector("rotation", Vec3(0.0))),
+            f.Vector("velocity", Vec3(0.0)),
+            f.Vector("angularVelocity", Vec3(0.0)),
+            friction
+        );
+    }
+
+    SceneOutput readOutput(Fields& f)
+    {
+        SceneOutput output;
+        output.PositionsPrefix = f.String("positions", "");
+        output.VdbPrefix = f.String("vdb", "");
+        output.CheckpointPath = f.String("checkpoint", "");
+        output.CheckpointInterval = f.Count("checkpointInterval", output.CheckpointPath.empty() ? 0 : 1);
+        output.TracePath = f.String("trace", "");
+        output.TraceFirstFrame = f.Count("traceFirstFrame", output.TraceFirstFrame);
+        output.TraceLastFrame = f.Count("traceLastFrame", output.TraceLastFrame);
+        if (output.TraceLastFrame < output.TraceFirstFrame)
+        {
+            f.fail("\"traceLastFrame\" is before \"traceFirstFrame\"");
+        }
+        f.Finish();
+        return output;
+    }
+
+    Scene readScene(const JsonValue& document, const std::string& path)
+    {
+        const Uint slash = path.find_last_of("/\\");
+        const std::string sceneDir = slash == std::string::npos ? "" : path.substr(0, slash);
+
+        Scene scene;
+        Fields f(document, path);
+
+        const Vec3 dims = f.Vector("grid");
+        scene.GridDims = IVec3(dims);
+        if (Vec3(scene.GridDims) != dims || scene.GridDims.x <= 0 || scene.GridDims.y <= 0 || scene.GridDims.z <= 0)
+        {
+            f.fail("\"grid\" has to be 3 positive integers");
+        }
+        scene.FrameLength = f.Number("frameLength");
+        if (scene.FrameLength <= 0.0)
+        {
+            f.fail("\"frameLength\" has to be positive");
+        }
+        scene.NumFrames = f.Count("frames");
+
+        if (f.Has("parameters"))
+        {
+            scene.Params = readParameters(f);
+        }
+
+        // Baking and voxelizing run on the scene's own thread count
+        MTIterator mt(scene.Params.NUM_THREADS);
+
+        if (f.Has("emitters"))
+        {
+            const std::vector<JsonValue>& emitters = f.Array("emitters");
+            for (Uint i = 0; i < emitters.size(); i++)
+            {
+                Fields emitter(emitters[i], f.Where("emitters[" + std::to_string(i) + "]"));
+                scene.Emitters.push_back(readEmitter(emitter, scene, sceneDir, mt));
+                emitter.Finish();
+            }
+        }
+
+        if (f.Has("colliders"))
+        {
+            const std::vector<JsonValue>& colliders = f.Array("colliders");
+            for (Uint i = 0; i < colliders.size(); i++)
+            {
+                Fields collider(colliders[i], f.Where("colliders[" + std::to_string(i) + "]"));
+                scene.Colliders.push_back(readCollider(collider, sceneDir, mt));
+                collider.Finish();
+            }
+        }
+
+        if (f.Has("output"))
+        {
+            Fields output(f.Get("output"), f.Where("output"));
+            scene.Output = readOutput(output);
+        }
+
+        f.Finish();
+        return scene;
+    }
+}
+
+Scene LoadScene(const std::string& path)
+{
+    return readScene(JsonValue::ParseFile(path), path);
+}
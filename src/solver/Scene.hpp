@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SimulationParameters.hpp"
+#include "Emitter.hpp"
+#include "Collider.hpp"
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MeshVolume;
+
+// Where a job writes its results.  Empty prefixes/paths turn the channel off.
+struct SceneOutput
+{
+    std::string PositionsPrefix; // <prefix><frame>.txt, one particle position per line
+    std::string VdbPrefix;       // <prefix><frame>.vdb
+    std::string CheckpointPath;
+    Uint CheckpointInterval = 0; // In frames
+
+    // Chrome trace of the frames TraceFirstFrame ... TraceLastFrame (see Trace)
+    std::string TracePath;
+    Uint TraceFirstFrame = 0;
+    Uint TraceLastFrame = std::numeric_limits<Uint>::max();
+};
+
+// A simulation job, loaded from a JSON scene file:
+//
+// {
+//     "grid": [300, 180, 180],
+//     "frameLength": 0.0416667,
+//     "frames": 48,
+//     "parameters": { "H": 1.0, "NUM_THREADS": 12, "P2G_MODE": "Partitioned", ... },
+//     "emitters": [
+//         { "shape": "sphere", "center": [40, 90, 90], "radius": 1.5, "spacing": 0.5, "velocity": [250, 0, 0], "mass": 200 },
+//         { "shape": "box", "min": [...], "max": [...], "sampling": "poissonDisk", "seed": 3 },
+//         { "shape": "mesh", "path": "bunny.obj", "voxelSize": 0.1 }
+//     ],
+//     "colliders": [
+//         { "shape": "box", "halfSize": [1, 2, 1], "position": [...], "velocity": [...], "friction": 0.3 },
+//         { "shape": "mesh", "path": "rock.obj", "voxelSize": 0.1, "keyframes": [{ "time": 0, "position": [...], "rotation": [...] }, ...] }
+//     ],
+//     "output": { "positions": "out", "vdb": "sim_", "checkpoint": "sim.snowckpt", "checkpointInterval": 4,
+//                 "trace": "sim.trace.json", "traceFirstFrame": 10, "traceLastFrame": 12 }
+// }
+//
+// "parameters" takes the names of the SimulationParameters fields; anything left out keeps its
+// default.  Rotations are axis-angle vectors in radians.  Relative mesh paths are relative to
+// the scene file.
+struct Scene
+{
+    IVec3 GridDims = IVec3(0);
+    Float FrameLength = 0.0;
+    Uint NumFrames = 0;
+    SimulationParameters Params;
+
+    std::vector<std::shared_ptr<Emitter>> Emitters;
+    std::vector<Collider> Colliders;
+    SceneOutput Output;
+
+    // Voxelized meshes of the mesh emitters, which only keep a reference to them
+    std::vector<std::shared_ptr<MeshVolume>> Volumes;
+};
+
+// Loads and validates a scene file, including baking collider SDFs and voxelizing emitter meshes.
+// Unknown keys are errors so misspelled settings don't silently fall back to their defaults.
+// Throws std::runtime_error naming the file and the offending entry.
+Scene LoadScene(const std::string& path);
@@ -1,7 +1,9 @@
 #include "SimulationOutput.hpp"
 
-SimulationOutput::SimulationOutput(const std::vector<Particle>& particles) :
-    mParticles(particles)
+#include <utility>
+
+SimulationOutput::SimulationOutput(std::vector<Particle> particles) :
+    mParticles(std::move(particles))
 {
 }
 
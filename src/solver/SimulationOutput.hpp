@@ -9,7 +9,8 @@
 class SimulationOutput
 {
 public:
-    SimulationOutput(const std::vector<Particle>& particles);
+    // Takes the particles over, so pass a temporary (or std::move) to avoid a second copy
+    SimulationOutput(std::vector<Particle> particles);
     const std::vector<Particle>& GetParticles() const; // this is nasty shit this class should just have accessors for the particles...
 
 private:
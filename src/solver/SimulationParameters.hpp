@@ -1,7 +1,26 @@
 #pragma once
 
 #include "Common.hpp"
+#include "HugePageAllocator.hpp"
 
+enum class P2GMode {
+    Scatter,    // Particles scatter into their neighbour cells under per-cell locks
+    Gather,     // Particles are binned by cell and every cell gathers from the nearby bins (mass,
+                // momentum and forces), always in the same order
+    Partitioned // Every thread owns a slab of cells and scatters its particles without locks,
+                // only particles reaching into another slab take the locks
+};
+
+// How much of the particles' stencils is kept between the transfers of a substep.  Both give
+// bitwise the same results, except with SNOW_FLOAT_PARTICLES where the full cache stores the
+// weight gradients in single precision.
+enum class WeightCache {
+    Full,   // The weight and weight gradient of all 64 stencil nodes, about 2 KB per particle
+    Compact // Only the per axis weights (see StencilWeights) - the transfers multiply them out
+            // again every time they visit a node
+};
+
+// Every field can be set by name from the "parameters" of a scene file (see Scene.cpp)
 struct SimulationParameters {
     Float H = 1.0; // cell size
     Float HARDENING = 10.0;
@@ -11,4 +30,63 @@ struct SimulationParameters {
     Float PHI_S = 0.005;
     Float ALPHA = 0.95;
     Float GRAVITY = -9.81;
+
+    // Which particle to grid transfer is used - both produce the same grid
+    P2GMode P2G_MODE = P2GMode::Scatter;
+
+    // Bitwise reproducible results for any number of threads.  The transfers to the grid use the
+    // gather engine whatever P2G_MODE says, since the scatters add up in whatever order the
+    // threads arrive in.
+    bool DETERMINISTIC = false;
+
+    // Momentum and energy totals of every substep (see StepDiagnostics).  They are summed up in
+    // the particle and grid sweeps the solver does anyway.
+    bool DIAGNOSTICS = false;
+
+    // Hardware counters (cycles, instructions, cache, branch and TLB misses) for every phase of the
+    // substeps next to their timings (see SolverStats::Phases).  Linux only, the phases are only
+    // timed if the counters can't be opened.
+    bool PERF_COUNTERS = false;
+
+    // Builds with sampled validation (see Assert.hpp) check the particles for NaN/Inf every this
+    // many substeps, 0 turns the check off
+    Uint VALIDATION_SUBSTEPS = 100;
+
+    // Where the particles keep their stencil weights (see WeightCache).  Solvers switch to the
+    // compact cache on their own when the full one doesn't fit into MEMORY_BUDGET_MB.
+    WeightCache WEIGHT_CACHE = WeightCache::Full;
+
+    // Megabytes the solver may allocate (particles, weight cache, grid and checkpoint copies),
+    // 0 for no limit.  The budget is checked before anything is allocated:  the grid when the
+    // solver is created and the particles whenever they are added, which throws
+    // std::runtime_error if they don't fit even with the compact weight cache.  Checkpoints
+    // that don't fit are written without a copy, stalling the simulation until they are done.
+    Uint MEMORY_BUDGET_MB = 0;
+
+    // Page size behind the grid cells, the particles and the weight cache (see HugePages).  Huge
+    // pages are first touched by the worker threads that are going to use them.
+    HugePages HUGE_PAGES = HugePages::Off;
+
+    // Multi-socket nodes:  the workers are pinned to the NUMA nodes in contiguous blocks (see
+    // NumaTopology) and the grid cells, the particles and the weight cache are first touched by
+    // the workers that process them, so most accesses stay on the local node.  The particles'
+    // pages are moved along when added particles change the split.  Without effect on machines
+    // with a single node.
+    bool NUMA_PLACEMENT = false;
+
+    // Worker threads of the solver
+    Uint NUM_THREADS = 12;
+
+    // Partitioned mode:  the thread slabs are resized to even out their particle counts every
+    // this many substeps
+    Uint PARTITION_REBALANCE_SUBSTEPS = 50;
+
+    // Particle sleeping.  Blocks of SLEEP_BLOCK_SIZE^3 cells whose particles stay under both
+    // thresholds for SLEEP_SUBSTEPS substeps are frozen until activity in a neighbouring block
+    // (or a collision) wakes them up again.
+    bool SLEEPING = false;
+    int SLEEP_BLOCK_SIZE = 4;
+    Float SLEEP_VELOCITY = 0.01; // Max particle speed
+    Float SLEEP_STRAIN_RATE = 0.01; // Max norm of the particle velocity gradient
+    Uint SLEEP_SUBSTEPS = 200;
 };
@@ -0,0 +1,292 @@
+#include "SleepBlocks.hpp"
+
+#include "ParticleSystem.hpp"
+#include "Grid.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static uint64_t floatBits(Float f)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static Float bitsFloat(uint64_t bits)
+{
+    Float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static void atomicMax(std::atomic<uint64_t>& target, Float value)
+{
+    uint64_t bits = floatBits(value);
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (bits > current && !target.compare_exchange_weak(current, bits, std::memory_order_relaxed))
+    {
+    }
+}
+
+SleepBlocks::SleepBlocks(const SimulationParameters& params, const IVec3& gridDims) :
+    mParams(params),
+    mBlockDims((gridDims + IVec3(params.SLEEP_BLOCK_SIZE - 1)) / params.SLEEP_BLOCK_SIZE),
+    mMaxSpeed(mBlockDims.x * mBlockDims.y * mBlockDims.z),
+    mMaxStrainRate(mBlockDims.x * mBlockDims.y * mBlockDims.z),
+    mWakeRequested(mBlockDims.x * mBlockDims.y * mBlockDims.z),
+    mActive(mBlockDims.x * mBlockDims.y * mBlockDims.z, 0),
+    mQuietSteps(mBlockDims.x * mBlockDims.y * mBlockDims.z, 0),
+    mContributions(mBlockDims.x * mBlockDims.y * mBlockDims.z),
+    mRecache(mBlockDims.x * mBlockDims.y * mBlockDims.z),
+    mNumContributions(0)
+{
+}
+
+Uint SleepBlocks::blockIdx(const Vec3& pos) const
+{
+    // Through the cell, the same way the particles' stencils are found, so that the stencil of
+    // every particle of a block lies in the block's footprint
+    const int size = mParams.SLEEP_BLOCK_SIZE;
+    IVec3 b(
+        glm::clamp(floorDiv(int(std::floor(pos.x / mParams.H)), size), 0, mBlockDims.x - 1),
+        glm::clamp(floorDiv(int(std::floor(pos.y / mParams.H)), size), 0, mBlockDims.y - 1),
+        glm::clamp(floorDiv(int(std::floor(pos.z / mParams.H)), size), 0, mBlockDims.z - 1)
+    );
+    return b.x + mBlockDims.x * b.y + mBlockDims.x * mBlockDims.y * b.z;
+}
+
+void SleepBlocks::Wake(const Vec3& pos)
+{
+    mWakeRequested[blockIdx(pos)].store(true, std::memory_order_relaxed);
+}
+
+const std::vector<Uint>& SleepBlocks::GetQuietSteps() const
+{
+    return mQuietSteps;
+}
+
+bool SleepBlocks::HasContributions() const
+{
+    return mNumContributions > 0;
+}
+
+bool SleepBlocks::Recaching(const Vec3& pos) const
+{
+    return mRecache[blockIdx(pos)].load(std::memory_order_relaxed);
+}
+
+Uint SleepBlocks::AllocatedBytes() const
+{
+    Uint contributionBytes = mContributions.capacity() * sizeof(std::unique_ptr<SleepingContribution>);
+    for (const std::unique_ptr<SleepingContribution>& c : mContributions)
+    {
+        if (c)
+        {
+            contributionBytes += sizeof(SleepingContribution) + c->Mass.capacity() * sizeof(Float) +
+                (c->Momentum.capacity() + c->Force.capacity()) * sizeof(Vec3) + c->Reached.capacity();
+        }
+    }
+
+    return (mMaxSpeed.capacity() + mMaxStrainRate.capacity()) * sizeof(std::atomic<uint64_t>) +
+        (mWakeRequested.capacity() + mRecache.capacity()) * sizeof(std::atomic<bool>) + mActive.capacity() +
+        mQuietSteps.capacity() * sizeof(Uint) + contributionBytes;
+}
+
+void SleepBlocks::RestoreQuietSteps(const Uint* quietSteps, Uint count)
+{
+    // Checkpoints of differently sized grids leave every block awake
+    if (count == mQuietSteps.size())
+    {
+        mQuietSteps.assign(quietSteps, quietSteps + count);
+    }
+
+    // The sums of the sleeping blocks aren't part of the checkpoint
+    for (Uint b = 0; b < mQuietSteps.size(); b++)
+    {
+        mContributions[b].reset();
+        mRecache[b].store(mQuietSteps[b] >= mParams.SLEEP_SUBSTEPS, std::memory_order_relaxed);
+    }
+    mNumContributions = 0;
+}
+
+void SleepBlocks::CacheContributions(const ParticleSystem& ps, MTIterator& mt)
+{
+    const Uint numBlocks = mQuietSteps.size();
+    std::vector<int> slot(numBlocks, -1);
+    std::vector<Uint> blocks;
+    for (Uint b = 0; b < numBlocks; b++)
+    {
+        if (mRecache[b].exchange(false, std::memory_order_relaxed))
+        {
+            slot[b] = int(blocks.size());
+            blocks.push_back(b);
+        }
+    }
+
+    if (blocks.empty())
+    {
+        return;
+    }
+
+    // The sleeping particles of every block in index order, which keeps the sums deterministic
+    const ParticleVector& particles = ps.GetParticles();
+    std::vector<std::vector<Uint>> blockParticles(blocks.size());
+    for (Uint i = 0; i < particles.size(); i++)
+    {
+        if (particles[i].asleep)
+        {
+            const int s = slot[blockIdx(Vec3(particles[i].pos))];
+            if (s >= 0)
+            {
+                blockParticles[s].push_back(i);
+            }
+        }
+    }
+
+    mt.IterateOverIndices(blocks.size(), [&](Uint s) {
+        cacheContribution(ps, blocks[s], blockParticles[s]);
+    });
+
+    mNumContributions = 0;
+    for (const std::unique_ptr<SleepingContribution>& c : mContributions)
+    {
+        mNumContributions += c ? 1 : 0;
+    }
+}
+
+void SleepBlocks::cacheContribution(const ParticleSystem& ps, Uint block, const std::vector<Uint>& particles)
+{
+    if (particles.empty())
+    {
+        mContributions[block].reset();
+        return;
+    }
+
+    const int size = mParams.SLEEP_BLOCK_SIZE;
+    const int side = size + 3;
+    const Uint numCells = Uint(side) * side * side;
+    const IVec3 b(block % mBlockDims.x, (block / mBlockDims.x) % mBlockDims.y, block / (mBlockDims.x * mBlockDims.y));
+    const IVec3 origin = b * size - IVec3(1);
+
+    std::unique_ptr<SleepingContribution> c = std::make_unique<SleepingContribution>();
+    c->Mass.assign(numCells, 0.0);
+    c->Momentum.assign(numCells, Vec3(0.0));
+    c->Force.assign(numCells, Vec3(0.0));
+    c->Reached.assign(numCells, 0);
+
+    auto cellIdx = [&](const IVec3& pos) {
+        const IVec3 local = pos - origin;
+        assert(std::min(local.x, std::min(local.y, local.z)) >= 0 && std::max(local.x, std::max(local.y, local.z)) < side);
+        return Uint(local.x + side * (local.y + side * local.z));
+    };
+
+    // Same arithmetic as the transfers of awake particles
+    const ParticleVector& all = ps.GetParticles();
+    for (Uint i : particles)
+    {
+        const Particle& particle = all[i];
+        WeightOverParticleNeighbourhood(ps, particle, [&](IVec3 pos, Float weight) {
+            const Uint n = cellIdx(pos);
+            c->Mass[n] += weight * particle.mass;
+            c->Momentum[n] += Vec3(particle.velocity) * particle.mass * weight;
+            c->Reached[n] = 1;
+        });
+
+        const Mat3 stress = -particle.volume * Mat3(particle.stress);
+        WeightGradOverParticleNeighbourhood(ps, particle, [&](IVec3 pos, Vec3 weightgrad) {
+            c->Force[cellIdx(pos)] += stress * weightgrad;
+        });
+    }
+
+    mContributions[block] = std::move(c);
+}
+
+Uint SleepBlocks::Update(ParticleSystem& ps, MTIterator& mt)
+{
+    ParticleVector& particles = ps.GetParticles();
+    const Uint numBlocks = mQuietSteps.size();
+
+    mt.IterateOverIndices(numBlocks, [&](Uint b) {
+        mMaxSpeed[b].store(0, std::memory_order_relaxed);
+        mMaxStrainRate[b].store(0, std::memory_order_relaxed);
+    });
+
+    // Sleeping particles don't move, so only the awake ones can make a block active
+    mt.IterateOverVector(particles, [&](Particle& p) {
+        if (!p.asleep) {
+            Uint b = blockIdx(Vec3(p.pos));
+            atomicMax(mMaxSpeed[b], glm::length(Vec3(p.velocity)));
+            atomicMax(mMaxStrainRate[b], p.strainRate);
+        }
+    });
+
+    mt.IterateOverIndices(numBlocks, [&](Uint b) {
+        mActive[b] =
+            bitsFloat(mMaxSpeed[b].load(std::memory_order_relaxed)) > mParams.SLEEP_VELOCITY ||
+            bitsFloat(mMaxStrainRate[b].load(std::memory_order_relaxed)) > mParams.SLEEP_STRAIN_RATE ||
+            mWakeRequested[b].exchange(false, std::memory_order_relaxed);
+    });
+
+    // A block only counts as quiet when its whole neighbourhood is, so that
+    // activity spreads into resting regions before it reaches their particles
+    mt.IterateOverIndices(numBlocks, [&](Uint b) {
+        const IVec3 c(b % mBlockDims.x, (b / mBlockDims.x) % mBlockDims.y, b / (mBlockDims.x * mBlockDims.y));
+        bool active = false;
+
+        for (int k = std::max(c.z - 1, 0); k <= std::min(c.z + 1, mBlockDims.z - 1) && !active; k++)
+        {
+            for (int j = std::max(c.y - 1, 0); j <= std::min(c.y + 1, mBlockDims.y - 1) && !active; j++)
+            {
+                for (int i = std::max(c.x - 1, 0); i <= std::min(c.x + 1, mBlockDims.x - 1) && !active; i++)
+                {
+                    active = mActive[i + mBlockDims.x * j + mBlockDims.x * mBlockDims.y * k] != 0;
+                }
+            }
+        }
+
+        mQuietSteps[b] = active ? 0 : mQuietSteps[b] + 1;
+    });
+
+    std::vector<Uint> sleeping(mt.NumThreads(), 0);
+    mt.IterateOverChunks(particles.size(), [&](Uint low, Uint high, Uint threadIdx) {
+        Uint count = 0;
+        for (Uint i = low; i < high; i++)
+        {
+            Particle& p = particles[i];
+            const bool asleep = mQuietSteps[blockIdx(Vec3(p.pos))] >= mParams.SLEEP_SUBSTEPS;
+
+            // Whatever motion is left is below the threshold - drop it so the particle
+            // doesn't keep pushing momentum into the grid while it sleeps.  The sum of its block
+            // has to be (re)taken with it.
+            if (asleep && !p.asleep) {
+                p.velocity = PVec3(0.0);
+                p.strainRate = 0.0;
+                mRecache[blockIdx(Vec3(p.pos))].store(true, std::memory_order_relaxed);
+            }
+
+            p.asleep = asleep;
+            count += asleep ? 1 : 0;
+        }
+        sleeping[threadIdx] = count;
+    });
+
+    // Blocks that woke up drop their sum
+    for (Uint b = 0; b < numBlocks; b++)
+    {
+        if (mQuietSteps[b] < mParams.SLEEP_SUBSTEPS && mContributions[b])
+        {
+            mContributions[b].reset();
+            mNumContributions--;
+        }
+    }
+
+    Uint total = 0;
+    for (Uint count : sleeping)
+    {
+        total += count;
+    }
+    return total;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SimulationParameters.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class ParticleSystem;
+class MTIterator;
+
+// Grid contribution of the sleeping particles of one block, over the SLEEP_BLOCK_SIZE + 3 cells
+// along each axis their stencils can reach (starting one cell before the block), x fastest
+struct SleepingContribution
+{
+    std::vector<Float> Mass;
+    std::vector<Vec3> Momentum;
+    std::vector<Vec3> Force;
+    std::vector<uint8_t> Reached;
+};
+
+// Tracks which parts of the domain have come to rest.  The domain is split into blocks of
+// SLEEP_BLOCK_SIZE^3 cells and every substep each block records the largest particle speed and
+// strain rate inside of it.  Blocks that stay quiet (and have quiet neighbours) for
+// SLEEP_SUBSTEPS substeps put their particles to sleep:  they skip the deformation update, the
+// transfers back from the grid and the position update.  Their mass and frozen stress still
+// reach the grid so that whatever rests on them stays supported, but from a per block sum that
+// is taken once when the block falls asleep (see CacheContributions) instead of transferring
+// every particle each substep.
+class SleepBlocks
+{
+public:
+    SleepBlocks(const SimulationParameters& params, const IVec3& gridDims);
+
+    // Called at the end of each substep - updates the block states and the particles' asleep flags.
+    // Returns the number of sleeping particles.
+    Uint Update(ParticleSystem& ps, MTIterator& mt);
+
+    // Wakes the block containing pos (and its neighbours) on the next update.  Thread safe.
+    void Wake(const Vec3& pos);
+
+    // Sums up the grid contribution of the blocks that fell asleep (or took in more sleeping
+    // particles) since the last call.  Has to run after the weights of the particles are cached
+    // for the substep.  Blocks drop their sum when they wake up.
+    void CacheContributions(const ParticleSystem& ps, MTIterator& mt);
+
+    bool HasContributions() const;
+
+    // Whether the block of pos takes its sum again on the next CacheContributions - particles fell
+    // asleep in it, which happens after they moved, so their weights have to be cached again first
+    bool Recaching(const Vec3& pos) const;
+
+    // Calls f(contribution, n) for every cached block that reaches cell, with n the index of the
+    // cell in the contribution.  The blocks are visited in a fixed order.
+    template<typename Func>
+    void ForEachContribution(const IVec3& cell, Func f) const
+    {
+        const int size = mParams.SLEEP_BLOCK_SIZE;
+        const int side = size + 3;
+
+        // The particles reaching the cell sit in the cells cell - 2 ... cell + 1
+        IVec3 first, last;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            first[axis] = std::max(floorDiv(cell[axis] - 2, size), 0);
+            last[axis] = std::min(floorDiv(cell[axis] + 1, size), mBlockDims[axis] - 1);
+        }
+
+        for (int k = first.z; k <= last.z; k++)
+        {
+            for (int j = first.y; j <= last.y; j++)
+            {
+                for (int i = first.x; i <= last.x; i++)
+                {
+                    const SleepingContribution* contribution = mContributions[i + mBlockDims.x * j + mBlockDims.x * mBlockDims.y * k].get();
+                    if (contribution)
+                    {
+                        const IVec3 local = cell - IVec3(i, j, k) * size + IVec3(1);
+                        f(*contribution, Uint(local.x + side * (local.y + side * local.z)));
+                    }
+                }
+            }
+        }
+    }
+
+    // The per block quiet substep counters are the only state carried between substeps
+    const std::vector<Uint>& GetQuietSteps() const;
+    void RestoreQuietSteps(const Uint* quietSteps, Uint count);
+
+    // Bytes allocated for the block states and the cached contributions
+    Uint AllocatedBytes() const;
+
+private:
+    Uint blockIdx(const Vec3& pos) const;
+    void cacheContribution(const ParticleSystem& ps, Uint block, const std::vector<Uint>& particles);
+
+    static int floorDiv(int a, int b)
+    {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    const SimulationParameters& mParams;
+    IVec3 mBlockDims;
+
+    // Per block maxima of the current substep, stored as the bit patterns of non-negative
+    // doubles (which order the same way as the values) so they can be maxed atomically
+    std::vector<std::atomic<uint64_t>> mMaxSpeed;
+    std::vector<std::atomic<uint64_t>> mMaxStrainRate;
+    std::vector<std::atomic<bool>> mWakeRequested;
+
+    std::vector<uint8_t> mActive;
+    std::vector<Uint> mQuietSteps;
+
+    // Per block, null while the block is awake or its sum is yet to be taken (mRecache)
+    std::vector<std::unique_ptr<SleepingContribution>> mContributions;
+    std::vector<std::atomic<bool>> mRecache;
+    Uint mNumContributions;
+};
@@ -0,0 +1,223 @@
+#include "SocketTransport.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS - SIGPIPE is left to the default
+#endif
+#endif
+
+SocketTransport::SocketTransport(int rank, std::vector<int> sockets, std::vector<int> children) :
+    mRank(rank),
+    mSockets(std::move(sockets)),
+    mChildren(std::move(children))
+{
+}
+
+int SocketTransport::Rank() const
+{
+    return mRank;
+}
+
+int SocketTransport::NumRanks() const
+{
+    return mSockets.size();
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<SocketTransport> SocketTransport::Fork(int numRanks)
+{
+    throw std::runtime_error("SocketTransport is only available on POSIX systems");
+}
+
+SocketTransport::~SocketTransport()
+{
+}
+
+std::vector<uint8_t> SocketTransport::Exchange(int peer, const void* data, Uint size)
+{
+    throw std::runtime_error("SocketTransport is only available on POSIX systems");
+}
+
+bool SocketTransport::WaitForRanks()
+{
+    return false;
+}
+
+#else
+
+std::unique_ptr<SocketTransport> SocketTransport::Fork(int numRanks)
+{
+    if (numRanks < 1)
+    {
+        throw std::runtime_error("SocketTransport needs at least one rank");
+    }
+
+    // sockets[a][b] is rank a's end of the connection to rank b
+    std::vector<std::vector<int>> sockets(numRanks, std::vector<int>(numRanks, -1));
+    for (int a = 0; a < numRanks; a++)
+    {
+        for (int b = a + 1; b < numRanks; b++)
+        {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+            {
+                throw std::runtime_error(std::string("socketpair failed: ") + std::strerror(errno));
+            }
+            sockets[a][b] = pair[0];
+            sockets[b][a] = pair[1];
+        }
+    }
+
+    // Every process only keeps its own row of sockets
+    auto keepRank = [&](int rank) {
+        for (int a = 0; a < numRanks; a++)
+        {
+            for (int b = 0; b < numRanks; b++)
+            {
+                if (a != rank && sockets[a][b] >= 0)
+                {
+                    close(sockets[a][b]);
+                }
+            }
+        }
+        return sockets[rank];
+    };
+
+    // Buffered output would otherwise get written by every process
+    std::fflush(nullptr);
+
+    std::vector<int> children;
+    for (int rank = 1; rank < numRanks; rank++)
+    {
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw std::runtime_error(std::string("fork failed: ") + std::strerror(errno));
+        }
+        if (pid == 0)
+        {
+            return std::unique_ptr<SocketTransport>(new SocketTransport(rank, keepRank(rank), {}));
+        }
+        children.push_back(pid);
+    }
+
+    return std::unique_ptr<SocketTransport>(new SocketTransport(0, keepRank(0), children));
+}
+
+SocketTransport::~SocketTransport()
+{
+    for (int s : mSockets)
+    {
+        if (s >= 0)
+        {
+            close(s);
+        }
+    }
+}
+
+std::vector<uint8_t> SocketTransport::Exchange(int peer, const void* data, Uint size)
+{
+    const int s = mSockets.at(peer);
+    if (s < 0)
+    {
+        throw std::runtime_error("Can't exchange with the own rank");
+    }
+
+    // Messages are prefixed with their size.  Sending and receiving are interleaved with poll so
+    // that neither side fills up the socket buffer while the other is also still sending.
+    std::vector<uint8_t> outgoing(sizeof(Uint) + size);
+    std::memcpy(outgoing.data(), &size, sizeof(Uint));
+    if (size > 0)
+    {
+        std::memcpy(outgoing.data() + sizeof(Uint), data, size);
+    }
+
+    Uint incomingSize = 0;
+    std::vector<uint8_t> incoming;
+    Uint sent = 0;
+    Uint received = 0; // Including the size prefix
+
+    while (sent < outgoing.size() || received < sizeof(Uint) + incomingSize)
+    {
+        pollfd pfd;
+        pfd.fd = s;
+        pfd.events = (sent < outgoing.size() ? POLLOUT : 0) | (received < sizeof(Uint) + incomingSize ? POLLIN : 0);
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        }
+
+        if ((pfd.revents & POLLOUT) && sent < outgoing.size())
+        {
+            const ssize_t n = send(s, outgoing.data() + sent, outgoing.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                throw std::runtime_error(std::string("send to rank " + std::to_string(peer) + " failed: ") + std::strerror(errno));
+            }
+            sent += n > 0 ? n : 0;
+        }
+
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && received < sizeof(Uint) + incomingSize)
+        {
+            ssize_t n;
+            if (received < sizeof(Uint))
+            {
+                n = recv(s, reinterpret_cast<uint8_t*>(&incomingSize) + received, sizeof(Uint) - received, MSG_DONTWAIT);
+            }
+            else
+            {
+                n = recv(s, incoming.data() + (received - sizeof(Uint)), sizeof(Uint) + incomingSize - received, MSG_DONTWAIT);
+            }
+
+            if (n == 0)
+            {
+                throw std::runtime_error("Rank " + std::to_string(peer) + " closed the connection");
+            }
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                throw std::runtime_error(std::string("recv from rank " + std::to_string(peer) + " failed: ") + std::strerror(errno));
+            }
+
+            received += n;
+            if (received == sizeof(Uint))
+            {
+                incoming.resize(incomingSize);
+            }
+        }
+    }
+
+    return incoming;
+}
+
+bool SocketTransport::WaitForRanks()
+{
+    bool ok = true;
+    for (int pid : mChildren)
+    {
+        int status = 0;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            ok = false;
+        }
+    }
+    mChildren.clear();
+    return ok;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Transport.hpp"
+
+#include <memory>
+#include <vector>
+
+// Transport between processes forked from a single parent, connected pairwise by Unix domain
+// socket pairs.  Only available on POSIX systems.
+class SocketTransport : public Transport
+{
+public:
+    // Forks numRanks - 1 child processes.  The caller becomes rank 0 and every child returns from
+    // this with its own rank - children should _exit once they're done instead of returning
+    // further.  Throws std::runtime_error if the processes can't be set up.
+    static std::unique_ptr<SocketTransport> Fork(int numRanks);
+
+    ~SocketTransport() override;
+
+    int Rank() const override;
+    int NumRanks() const override;
+    std::vector<uint8_t> Exchange(int peer, const void* data, Uint size) override;
+
+    // Rank 0 only:  waits for the other ranks to exit.  Returns false if any of them failed.
+    bool WaitForRanks();
+
+private:
+    SocketTransport(int rank, std::vector<int> sockets, std::vector<int> children);
+
+    int mRank;
+    std::vector<int> mSockets; // Indexed by peer rank, -1 for this rank
+    std::vector<int> mChildren; // Process ids of ranks 1... (rank 0 only)
+};
@@ -6,6 +6,7 @@
 #include <memory>
 
 #include "SimulationOutput.hpp"
+#include "ParticleSystem.hpp"
 
 class Grid;
 class ParticleSystem;
@@ -16,6 +17,7 @@ public:
     Solver() = default;
 
     virtual void AddParticle(const Vec3& pos, const Vec3& velocity, const Float mass) = 0;
+    virtual void AddParticles(const ParticleSeed* seeds, Uint count) = 0;
 
     // Each time this is called - the particle list from last frame is invalidated
     virtual void NextFrame() = 0;
@@ -0,0 +1,93 @@
+#include "SolverStats.hpp"
+
+#include <cstdio>
+
+const char* SolverPhaseName(SolverPhase phase)
+{
+    switch (phase)
+    {
+    case SolverPhase::Weights: return "weights";
+    case SolverPhase::Rasterize: return "rasterize";
+    case SolverPhase::Volumes: return "volumes";
+    case SolverPhase::GridForces: return "grid forces";
+    case SolverPhase::GridVelocities: return "grid velocities";
+    case SolverPhase::GridCollisions: return "grid collisions";
+    case SolverPhase::LinearSolve: return "linear solve";
+    case SolverPhase::DeformationUpdate: return "deformation update";
+    case SolverPhase::ParticleVelocities: return "particle velocities";
+    case SolverPhase::ParticleCollisions: return "particle collisions";
+    case SolverPhase::Positions: return "positions";
+    case SolverPhase::Housekeeping: return "housekeeping";
+    case SolverPhase::Validation: return "validation";
+    case SolverPhase::Count: break;
+    }
+    return "?";
+}
+
+void LogPhaseStats(const SolverStats& stats, LogLevel level)
+{
+    if (!Log::Enabled(level))
+    {
+        return;
+    }
+
+    Float total = 0.0;
+    for (const PhaseStats& phase : stats.Phases)
+    {
+        total += phase.Seconds;
+    }
+
+    bool anyCounters = false;
+    for (bool available : stats.CountersAvailable)
+    {
+        anyCounters = anyCounters || available;
+    }
+
+    SNOW_LOG(level, "phase timings over " << stats.StepNum << " substeps, " << total << " s"
+             << (anyCounters ? "" : " (no hardware counters)"));
+
+    const Uint cycles = Uint(PerfCounter::Cycles);
+    const Uint instructions = Uint(PerfCounter::Instructions);
+    for (Uint i = 0; i < NUM_SOLVER_PHASES; i++)
+    {
+        const PhaseStats& phase = stats.Phases[i];
+        if (phase.Seconds == 0.0)
+        {
+            continue;
+        }
+
+        char line[Log::MAX_MESSAGE];
+        int length = std::snprintf(line, sizeof(line), "  %-20s %9.3f s %5.1f%%", SolverPhaseName(SolverPhase(i)),
+                                   phase.Seconds, total > 0.0 ? 100.0 * phase.Seconds / total : 0.0);
+
+        if (anyCounters)
+        {
+            if (stats.CountersAvailable[cycles] && stats.CountersAvailable[instructions] && phase.Counters[cycles] > 0)
+            {
+                length += std::snprintf(line + length, sizeof(line) - length, "  IPC %5.2f",
+                                        Float(phase.Counters[instructions]) / Float(phase.Counters[cycles]));
+            }
+
+            for (Uint c = 0; c < PerfCounters::NUM_COUNTERS && length < int(sizeof(line)); c++)
+            {
+                const char* name = PerfCounters::CounterName(PerfCounter(c));
+                length += stats.CountersAvailable[c] ?
+                    std::snprintf(line + length, sizeof(line) - length, "  %s %9.3e", name, Float(phase.Counters[c])) :
+                    std::snprintf(line + length, sizeof(line) - length, "  %s n/a", name);
+            }
+        }
+
+        SNOW_LOG(level, line);
+    }
+}
+
+std::string DescribeMemoryUsage(const MemoryUsage& usage)
+{
+    const Float MB = 1024.0 * 1024.0;
+    char text[256];
+    std::snprintf(text, sizeof(text),
+                  "%.1f MB (particles %.1f MB, weight cache %.1f MB, grid cells %.1f MB, transfers %.1f MB, snapshots %.1f MB)",
+                  usage.Total() / MB, usage.Particles / MB, usage.WeightCache / MB, usage.GridCells / MB,
+                  usage.Transfers / MB, usage.Snapshots / MB);
+    return text;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Log.hpp"
+#include "PerfCounters.hpp"
+
+#include <algorithm>
+#include <array>
+#include <string>
+
+// Totals over the particles (or grid cells) at one point of a substep
+struct DiagnosticSums
+{
+    Float Mass = 0.0;
+    Vec3 Momentum = Vec3(0.0);
+    Float KineticEnergy = 0.0;
+    Float ElasticEnergy = 0.0; // Particles only, from F_e
+    Float MaxSpeed = 0.0;
+
+    void Add(Float mass, const Vec3& velocity)
+    {
+        const Float speed2 = glm::dot(velocity, velocity);
+        Mass += mass;
+        Momentum += mass * velocity;
+        KineticEnergy += 0.5 * mass * speed2;
+        MaxSpeed = std::max(MaxSpeed, std::sqrt(speed2));
+    }
+
+    void Merge(const DiagnosticSums& other)
+    {
+        Mass += other.Mass;
+        Momentum += other.Momentum;
+        KineticEnergy += other.KineticEnergy;
+        ElasticEnergy += other.ElasticEnergy;
+        MaxSpeed = std::max(MaxSpeed, other.MaxSpeed);
+    }
+};
+
+// Where the momentum and energy went during a substep (see SimulationParameters::DIAGNOSTICS).
+// The sums are taken in fixed blocks so they don't depend on the number of threads.
+struct StepDiagnostics
+{
+    DiagnosticSums ParticlesBefore; // Particles as they are transferred to the grid
+    DiagnosticSums Grid;            // Grid nodes after the transfer, before forces are applied
+    DiagnosticSums ParticlesAfter;  // Particles after the transfer back
+};
+
+// The parts of a substep that are timed separately, in the order they run
+enum class SolverPhase : int {
+    Weights,            // Caching the stencil weights of the particles
+    Rasterize,          // Mass and momentum to the grid
+    Volumes,            // First substep only
+    GridForces,
+    GridVelocities,
+    GridCollisions,     // Colliders and boundary conditions
+    LinearSolve,
+    DeformationUpdate,  // Velocity gradients and the SVDs
+    ParticleVelocities, // Back to the particles
+    ParticleCollisions,
+    Positions,          // Advection (and migration between ranks)
+    Housekeeping,       // Grid reset and sleeping
+    Validation,
+    Count
+};
+
+static const Uint NUM_SOLVER_PHASES = Uint(SolverPhase::Count);
+
+const char* SolverPhaseName(SolverPhase phase);
+
+// Where the time of a phase went
+struct PhaseStats
+{
+    Float Seconds = 0.0;
+
+    // Summed over the solver thread and its workers, indexed by PerfCounter.  Zero unless
+    // PERF_COUNTERS is on and the counter is available.
+    PerfCounters::Values Counters = {};
+};
+
+// Counters describing the current state of a solver, refreshed every substep
+struct SolverStats
+{
+    Uint StepNum = 0;
+    Uint NumParticles = 0;
+
+    // Particle sleeping (see SleepBlocks) - zero unless sleeping is enabled
+    Uint SleepingParticles = 0;
+    Float SleepingFraction = 0.0;
+
+    // Zero unless diagnostics are enabled
+    StepDiagnostics Diagnostics;
+
+    // Totals since the solver was created, indexed by SolverPhase
+    std::array<PhaseStats, NUM_SOLVER_PHASES> Phases;
+
+    // Which of the hardware counters could be opened (all false without PERF_COUNTERS)
+    std::array<bool, PerfCounters::NUM_COUNTERS> CountersAvailable = {};
+};
+
+// Logs a table of the phase timings and counters, one record per phase
+void LogPhaseStats(const SolverStats& stats, LogLevel level);
+
+// Bytes a solver has allocated, by what they hold (see CPUSolver::GetMemoryUsage)
+struct MemoryUsage
+{
+    Uint Particles = 0;   // Particle attributes, per axis stencil weights included
+    Uint WeightCache = 0; // Full stencil weights and gradients (WeightCache::Full)
+    Uint GridCells = 0;
+    Uint Transfers = 0;   // Particle bins or partitions of the transfers, and the sleep blocks
+    Uint Snapshots = 0;   // Particle copy of a checkpoint that is still being written
+
+    Uint Total() const
+    {
+        return Particles + WeightCache + GridCells + Transfers + Snapshots;
+    }
+};
+
+// "<total> MB (particles <n> MB, weight cache <n> MB, ...)"
+std::string DescribeMemoryUsage(const MemoryUsage& usage);
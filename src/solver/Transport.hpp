@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <vector>
+
+// Message passing between the ranks (processes) of a domain decomposed simulation, see
+// DomainDecomposition.  Ranks are numbered [0, NumRanks()).
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    virtual int Rank() const = 0;
+    virtual int NumRanks() const = 0;
+
+    // Sends size bytes to peer and returns the message peer sent to this rank in its matching
+    // Exchange call.  Both directions are transferred at the same time, so two ranks exchanging
+    // large messages with each other never wait on one another.  Throws std::runtime_error if
+    // the peer went away.
+    virtual std::vector<uint8_t> Exchange(int peer, const void* data, Uint size) = 0;
+};
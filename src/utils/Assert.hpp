@@ -1,7 +1,92 @@
+#pragma once
+
 #include <Common.hpp>
 
-void ASSERT_VALID_FLOAT(Float f);
-void ASSERT_VALID_VEC3(Vec3 v);
-void ASSERT_VALID_MAT3(Mat3 v);
-void ASSERT_NOT_SINGULAR(Mat3 v);
+#include <cstring>
+
+// How much of the simulation state gets validated, chosen at compile time with SNOW_VALIDATION
+// (the SNOW_VALIDATION cache variable in CMake):
+//  - OFF:      nothing, the checks compile to nothing
+//  - SAMPLED:  every VALIDATION_SUBSTEPS substeps the solver sweeps the particles for NaN/Inf
+//              and throws if it finds any (see ParticleSystem::FindInvalidParticle)
+//  - FULL:     the sweep runs every substep and the ASSERT_VALID_* checks in the kernels abort on
+//              the first non-finite result
+#define SNOW_VALIDATION_OFF 0
+#define SNOW_VALIDATION_SAMPLED 1
+#define SNOW_VALIDATION_FULL 2
+
+#ifndef SNOW_VALIDATION
+#ifdef NDEBUG
+#define SNOW_VALIDATION SNOW_VALIDATION_SAMPLED
+#else
+#define SNOW_VALIDATION SNOW_VALIDATION_FULL
+#endif
+#endif
+
+// Whether any of the count values is NaN or infinite.  Checks the exponent bits without
+// branching so the loop vectorizes.
+inline bool AnyNonFinite(const Float* values, Uint count)
+{
+    uint64_t bad = 0;
+    for (Uint i = 0; i < count; i++)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        bad |= uint64_t((bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull);
+    }
+    return bad != 0;
+}
+
+inline bool AnyNonFinite(Float f)
+{
+    return AnyNonFinite(&f, 1);
+}
+
+inline bool AnyNonFinite(const Vec3& v)
+{
+    return AnyNonFinite(&v[0], 3);
+}
+
+inline bool AnyNonFinite(const Mat3& m)
+{
+    return AnyNonFinite(&m[0][0], 9);
+}
+
+// Single precision versions for the particle storage (see PVec3)
+inline bool AnyNonFinite(const float* values, Uint count)
+{
+    uint32_t bad = 0;
+    for (Uint i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        bad |= uint32_t((bits & 0x7F800000u) == 0x7F800000u);
+    }
+    return bad != 0;
+}
+
+inline bool AnyNonFinite(const glm::vec3& v)
+{
+    return AnyNonFinite(&v[0], 3);
+}
+
+inline bool AnyNonFinite(const glm::mat3& m)
+{
+    return AnyNonFinite(&m[0][0], 9);
+}
+
+// Reports a failed check and aborts
+[[noreturn]] void ValidationFailed(const char* expression, const char* file, int line);
+
+// The operands aren't evaluated unless validation is FULL
+#if SNOW_VALIDATION == SNOW_VALIDATION_FULL
+#define SNOW_VALIDATE_FINITE(Type, value) \
+    do { if (AnyNonFinite(static_cast<const Type&>(value))) ValidationFailed(#value, __FILE__, __LINE__); } while (0)
+#else
+#define SNOW_VALIDATE_FINITE(Type, value) do { } while (0)
+#endif
 
+#define ASSERT_VALID_FLOAT(f) SNOW_VALIDATE_FINITE(Float, f)
+#define ASSERT_VALID_VEC3(v) SNOW_VALIDATE_FINITE(Vec3, v)
+#define ASSERT_VALID_MAT3(m) SNOW_VALIDATE_FINITE(Mat3, m)
+#define ASSERT_NOT_SINGULAR(m) do { } while (0)
@@ -14,6 +14,16 @@ using Vec3 = glm::dvec3;
 using Mat3 = glm::dmat3;
 using IVec3 = glm::ivec3;
 
+// Storage types of the particle state (see Particle).  With SNOW_FLOAT_PARTICLES the particles are
+// stored in single precision, all the arithmetic on them and the grid stay in double.
+#ifdef SNOW_FLOAT_PARTICLES
+using PVec3 = glm::vec3;
+using PMat3 = glm::mat3;
+#else
+using PVec3 = Vec3;
+using PMat3 = Mat3;
+#endif
+
 static const Float EPSILON = 2.2204460492503131e-016;
 
 #include <assert.hpp>
@@ -0,0 +1,154 @@
+#include "HugePageAllocator.hpp"
+
+#include "Log.hpp"
+#include "Multithread.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    Uint roundToHugePages(Uint bytes)
+    {
+        return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+#ifdef __linux__
+    void* mapReserved(Uint bytes)
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+        flags |= MAP_HUGE_2MB;
+#endif
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    // Maps one huge page more than needed and trims it to a 2 MB boundary, so that every 2 MB of
+    // the range can be backed by a huge page
+    void* mapAligned(Uint bytes)
+    {
+        const Uint mapped = bytes + HUGE_PAGE_SIZE;
+        void* memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+        char* start = static_cast<char*>(memory);
+        char* aligned = reinterpret_cast<char*>((uintptr_t(start) + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1));
+        if (aligned > start)
+        {
+            munmap(start, aligned - start);
+        }
+        munmap(aligned + bytes, start + mapped - (aligned + bytes));
+        return aligned;
+    }
+
+    void* mapTransparent(Uint bytes)
+    {
+        void* memory = mapAligned(bytes);
+        if (memory != nullptr)
+        {
+            // Just regular pages if transparent huge pages are off
+            madvise(memory, bytes, MADV_HUGEPAGE);
+        }
+        return memory;
+    }
+#endif
+
+    // Pages whose first byte is in [low, high)
+    PageRange bytePages(Uint low, Uint high)
+    {
+        return { (low + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE, (high + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE };
+    }
+
+    // Faults the pages in on the threads that are going to work on them, pinned to their NUMA
+    // nodes with numa so that the pages land on the node of the worker
+    void firstTouch(char* memory, Uint bytes, Uint elementSize, Uint touchThreads, bool numa)
+    {
+        MTIterator mt(std::max<Uint>(touchThreads, 1), numa);
+        mt.IterateOverChunks(bytes / elementSize, [memory, elementSize](Uint low, Uint high, Uint threadIdx) {
+            const PageRange pages = bytePages(low * elementSize, high * elementSize);
+            for (Uint page = pages.First; page < pages.End; page++)
+            {
+                memory[page * SMALL_PAGE_SIZE] = 0;
+            }
+        });
+    }
+
+    std::atomic<bool> sWarnedReserved{ false };
+}
+
+void* AllocateLarge(Uint bytes, HugePages mode, Uint touchThreads, bool numa, Uint elementSize)
+{
+#ifdef __linux__
+    if ((mode != HugePages::Off || numa) && bytes >= HUGE_PAGE_SIZE)
+    {
+        const Uint mapped = roundToHugePages(bytes);
+        void* memory = mode == HugePages::Reserved ? mapReserved(mapped) : nullptr;
+        if (memory == nullptr && mode == HugePages::Reserved && !sWarnedReserved.exchange(true))
+        {
+            LOG_WARNING("Not enough reserved huge pages (vm.nr_hugepages), falling back to transparent huge pages");
+        }
+
+        if (memory == nullptr)
+        {
+            memory = mode == HugePages::Off ? mapAligned(mapped) : mapTransparent(mapped);
+        }
+        if (memory == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        firstTouch(static_cast<char*>(memory), bytes, std::max<Uint>(elementSize, 1), touchThreads, numa);
+        return memory;
+    }
+#endif
+    return ::operator new(bytes);
+}
+
+void FreeLarge(void* memory, Uint bytes, HugePages mode, bool numa)
+{
+#ifdef __linux__
+    if ((mode != HugePages::Off || numa) && bytes >= HUGE_PAGE_SIZE)
+    {
+        munmap(memory, roundToHugePages(bytes));
+        return;
+    }
+#endif
+    ::operator delete(memory);
+}
+
+PageRange WorkerPages(Uint elementSize, Uint count, Uint threadIdx, Uint numThreads)
+{
+    Uint low, high;
+    MTIterator::ChunkRange(count, numThreads, threadIdx, low, high);
+    return bytePages(low * elementSize, high * elementSize);
+}
+
+void PlaceOnWorkerNodes(void* memory, Uint elementSize, Uint count, Uint numThreads)
+{
+    const NumaTopology& topology = NumaTopology::Get();
+    if (topology.NumNodes() < 2)
+    {
+        return;
+    }
+
+    // Moving pages is copying them, so the workers move their own chunks in parallel
+    char* bytes = static_cast<char*>(memory);
+    MTIterator mt(numThreads);
+    mt.IterateOverChunks(count, [&](Uint low, Uint high, Uint threadIdx) {
+        const PageRange pages = bytePages(low * elementSize, high * elementSize);
+        if (pages.End > pages.First)
+        {
+            topology.MoveToNode(bytes + pages.First * SMALL_PAGE_SIZE, (pages.End - pages.First) * SMALL_PAGE_SIZE,
+                topology.WorkerNode(threadIdx, numThreads));
+        }
+    });
+}
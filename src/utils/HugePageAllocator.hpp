@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Backing of the large arrays (grid cells, particles) - scattered accesses over gigabytes of
+// 4 KB pages miss the TLB all the time, 2 MB pages cover 512 times as much memory per entry
+enum class HugePages {
+    Off,         // Plain heap allocations
+    Transparent, // 2 MB aligned mappings with madvise(MADV_HUGEPAGE), the kernel backs them with
+                 // huge pages as far as it can (needs transparent_hugepage "madvise" or "always")
+    Reserved     // MAP_HUGETLB from the preallocated pool (vm.nr_hugepages), Transparent when the
+                 // pool can't hold the allocation
+};
+
+// Allocations of at least HUGE_PAGE_SIZE bytes are mapped separately (unless the mode is Off and
+// numa is false) and first touched by touchThreads threads, split into the same chunks of
+// elementSize byte elements as MTIterator splits its work:  the page faults (which zero the pages)
+// run in parallel and every page is touched by the worker that processes it, smaller allocations
+// come from the heap.  With numa the touching workers are pinned to their NUMA nodes (see
+// NumaTopology), which places every chunk on the node of its worker.  Everything falls back to the
+// heap on other platforms.
+static const Uint HUGE_PAGE_SIZE = Uint(2) << 20;
+static const Uint SMALL_PAGE_SIZE = 4096;
+
+void* AllocateLarge(Uint bytes, HugePages mode, Uint touchThreads, bool numa = false, Uint elementSize = 1);
+void FreeLarge(void* memory, Uint bytes, HugePages mode, bool numa = false);
+
+// 4 KB pages [First, End) from the start of an array of count elements of elementSize bytes that
+// belong to worker threadIdx out of numThreads:  the pages whose first byte is in the worker's
+// chunk (see MTIterator::ChunkRange).  The first touch and PlaceOnWorkerNodes split pages this way.
+struct PageRange
+{
+    Uint First;
+    Uint End;
+};
+
+PageRange WorkerPages(Uint elementSize, Uint count, Uint threadIdx, Uint numThreads);
+
+// Moves the pages of the first count elements of an array from AllocateLarge to the NUMA nodes of
+// the numThreads workers that process them.  The first touch splits an array by its capacity, so
+// once a container holds fewer elements than that (eg. after it grew) most of them would be on the
+// first nodes.
+void PlaceOnWorkerNodes(void* memory, Uint elementSize, Uint count, Uint numThreads);
+
+// Standard allocator on top of AllocateLarge, eg. std::vector<Cell, HugePageAllocator<Cell>>.  It
+// travels with the memory on copies, moves and swaps of the containers.
+template<typename T>
+class HugePageAllocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    HugePageAllocator() = default;
+
+    HugePageAllocator(HugePages mode, Uint touchThreads, bool numa = false) :
+        mMode(mode),
+        mTouchThreads(touchThreads),
+        mNuma(numa)
+    {
+    }
+
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>& other) :
+        mMode(other.Mode()),
+        mTouchThreads(other.TouchThreads()),
+        mNuma(other.Numa())
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(AllocateLarge(n * sizeof(T), mMode, mTouchThreads, mNuma, sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        FreeLarge(p, n * sizeof(T), mMode, mNuma);
+    }
+
+    HugePages Mode() const
+    {
+        return mMode;
+    }
+
+    Uint TouchThreads() const
+    {
+        return mTouchThreads;
+    }
+
+    bool Numa() const
+    {
+        return mNuma;
+    }
+
+private:
+    HugePages mMode = HugePages::Off;
+    Uint mTouchThreads = 1;
+    bool mNuma = false;
+};
+
+// Memory of one can be freed by the other when both map it the same way
+template<typename T, typename U>
+bool operator==(const HugePageAllocator<T>& a, const HugePageAllocator<U>& b)
+{
+    return a.Mode() == b.Mode() && a.Numa() == b.Numa();
+}
+
+template<typename T, typename U>
+bool operator!=(const HugePageAllocator<T>& a, const HugePageAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+// PlaceOnWorkerNodes for the elements of a vector, if its allocator placed it on the NUMA nodes
+template<typename T>
+void PlaceOnWorkerNodes(std::vector<T, HugePageAllocator<T>>& vector, Uint numThreads)
+{
+    if (vector.get_allocator().Numa() && vector.capacity() * sizeof(T) >= HUGE_PAGE_SIZE)
+    {
+        PlaceOnWorkerNodes(vector.data(), sizeof(T), vector.size(), numThreads);
+    }
+}
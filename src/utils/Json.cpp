@@ -0,0 +1,460 @@
+#include "Json.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    // Recursive descent over the document text
+    class JsonParser
+    {
+    public:
+        JsonParser(const std::string& text) : mText(text), mPos(0) {}
+
+        JsonValue ParseDocument()
+        {
+            JsonValue value = parseValue(0);
+            skipWhitespace();
+            if (mPos != mText.size())
+            {
+                fail("unexpected trailing characters");
+            }
+            return value;
+        }
+
+    private:
+        // Deeper documents are rejected instead of overflowing the stack
+        static const int MAX_DEPTH = 256;
+
+        [[noreturn]] void fail(const std::string& message) const
+        {
+            Uint line = 1;
+            Uint column = 1;
+            for (Uint i = 0; i < mPos && i < mText.size(); i++)
+            {
+                if (mText[i] == '\n')
+                {
+                    line++;
+                    column = 1;
+                }
+                else
+                {
+                    column++;
+                }
+            }
+            throw std::runtime_error("JSON error at line " + std::to_string(line) + ", column " + std::to_string(column) + ": " + message);
+        }
+
+        void skipWhitespace()
+        {
+            while (mPos < mText.size())
+            {
+                const char c = mText[mPos];
+                if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+                {
+                    mPos++;
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+
+        bool consume(char c)
+        {
+            skipWhitespace();
+            if (mPos < mText.size() && mText[mPos] == c)
+            {
+                mPos++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c)
+        {
+            if (!consume(c))
+            {
+                fail(std::string("expected '") + c + "'");
+            }
+        }
+
+        void expectLiteral(const char* literal)
+        {
+            for (const char* c = literal; *c != '\0'; c++, mPos++)
+            {
+                if (mPos >= mText.size() || mText[mPos] != *c)
+                {
+                    fail(std::string("invalid literal, expected ") + literal);
+                }
+            }
+        }
+
+        JsonValue parseValue(int depth)
+        {
+            if (depth > MAX_DEPTH)
+            {
+                fail("document is nested too deeply");
+            }
+
+            skipWhitespace();
+            if (mPos >= mText.size())
+            {
+                fail("unexpected end of document");
+            }
+
+            switch (mText[mPos])
+            {
+            case '{':
+                return parseObject(depth);
+            case '[':
+                return parseArray(depth);
+            case '"':
+                return JsonValue(parseString());
+            case 't':
+                expectLiteral("true");
+                return JsonValue(true);
+            case 'f':
+                expectLiteral("false");
+                return JsonValue(false);
+            case 'n':
+                expectLiteral("null");
+                return JsonValue();
+            default:
+                return JsonValue(parseNumber());
+            }
+        }
+
+        JsonValue parseObject(int depth)
+        {
+            expect('{');
+            std::map<std::string, JsonValue> object;
+            if (consume('}'))
+            {
+                return JsonValue(std::move(object));
+            }
+
+            do
+            {
+                skipWhitespace();
+                if (mPos >= mText.size() || mText[mPos] != '"')
+                {
+                    fail("expected a key");
+                }
+                std::string key = parseString();
+                if (object.count(key) != 0)
+                {
+                    fail("duplicate key \"" + key + "\"");
+                }
+                expect(':');
+                object.emplace(std::move(key), parseValue(depth + 1));
+            } while (consume(','));
+
+            expect('}');
+            return JsonValue(std::move(object));
+        }
+
+        JsonValue parseArray(int depth)
+        {
+            expect('[');
+            std::vector<JsonValue> array;
+            if (consume(']'))
+            {
+                return JsonValue(std::move(array));
+            }
+
+            do
+            {
+                array.push_back(parseValue(depth + 1));
+            } while (consume(','));
+
+            expect(']');
+            return JsonValue(std::move(array));
+        }
+
+        std::string parseString()
+        {
+            mPos++; // Opening quote
+            std::string result;
+            while (true)
+            {
+                if (mPos >= mText.size())
+                {
+                    fail("unterminated string");
+                }
+
+                const char c = mText[mPos++];
+                if (c == '"')
+                {
+                    return result;
+                }
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    fail("control character in string");
+                }
+                if (c != '\\')
+                {
+                    result += c;
+                    continue;
+                }
+
+                if (mPos >= mText.size())
+                {
+                    fail("unterminated string");
+                }
+                const char escape = mText[mPos++];
+                switch (escape)
+                {
+                case '"': result += '"'; break;
+                case '\\': result += '\\'; break;
+                case '/': result += '/'; break;
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'n': result += '\n'; break;
+                case 'r': result += '\r'; break;
+                case 't': result += '\t'; break;
+                case 'u': appendUtf8(parseCodePoint(), result); break;
+                default: fail(std::string("invalid escape \\") + escape);
+                }
+            }
+        }
+
+        uint32_t parseHex4()
+        {
+            if (mPos + 4 > mText.size())
+            {
+                fail("truncated \\u escape");
+            }
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                const char c = mText[mPos++];
+                value <<= 4;
+                if (c >= '0' && c <= '9') value |= uint32_t(c - '0');
+                else if (c >= 'a' && c <= 'f') value |= uint32_t(c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F') value |= uint32_t(c - 'A' + 10);
+                else fail("invalid \\u escape");
+            }
+            return value;
+        }
+
+        // \uXXXX, combining surrogate pairs
+        uint32_t parseCodePoint()
+        {
+            const uint32_t high = parseHex4();
+            if (high < 0xD800 || high > 0xDBFF)
+            {
+                return high;
+            }
+            if (mPos + 2 > mText.size() || mText[mPos] != '\\' || mText[mPos + 1] != 'u')
+            {
+                fail("unpaired surrogate");
+            }
+            mPos += 2;
+            const uint32_t low = parseHex4();
+            if (low < 0xDC00 || low > 0xDFFF)
+            {
+                fail("invalid surrogate pair");
+            }
+            return 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        static void appendUtf8(uint32_t cp, std::string& out)
+        {
+            if (cp < 0x80)
+            {
+                out += char(cp);
+            }
+            else if (cp < 0x800)
+            {
+                out += char(0xC0 | (cp >> 6));
+                out += char(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                out += char(0xE0 | (cp >> 12));
+                out += char(0x80 | ((cp >> 6) & 0x3F));
+                out += char(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                out += char(0xF0 | (cp >> 18));
+                out += char(0x80 | ((cp >> 12) & 0x3F));
+                out += char(0x80 | ((cp >> 6) & 0x3F));
+                out += char(0x80 | (cp & 0x3F));
+            }
+        }
+
+        Float parseNumber()
+        {
+            // Validate the JSON number grammar first, strtod accepts more (hex, inf, leading +)
+            const Uint start = mPos;
+            auto digits = [&]() {
+                const Uint first = mPos;
+                while (mPos < mText.size() && mText[mPos] >= '0' && mText[mPos] <= '9')
+                {
+                    mPos++;
+                }
+                return mPos > first;
+            };
+
+            if (mPos < mText.size() && mText[mPos] == '-')
+            {
+                mPos++;
+            }
+            if (mPos < mText.size() && mText[mPos] == '0')
+            {
+                mPos++;
+            }
+            else if (!digits())
+            {
+                fail("invalid value");
+            }
+            if (mPos < mText.size() && mText[mPos] == '.')
+            {
+                mPos++;
+                if (!digits())
+                {
+                    fail("expected digits after the decimal point");
+                }
+            }
+            if (mPos < mText.size() && (mText[mPos] == 'e' || mText[mPos] == 'E'))
+            {
+                mPos++;
+                if (mPos < mText.size() && (mText[mPos] == '+' || mText[mPos] == '-'))
+                {
+                    mPos++;
+                }
+                if (!digits())
+                {
+                    fail("expected digits in the exponent");
+                }
+            }
+
+            return std::strtod(mText.substr(start, mPos - start).c_str(), nullptr);
+        }
+
+        const std::string& mText;
+        Uint mPos;
+    };
+}
+
+JsonValue::JsonValue() : mType(Type::Null), mBool(false), mNumber(0.0) {}
+
+JsonValue::JsonValue(bool value) : mType(Type::Bool), mBool(value), mNumber(0.0) {}
+
+JsonValue::JsonValue(Float value) : mType(Type::Number), mBool(false), mNumber(value) {}
+
+JsonValue::JsonValue(const std::string& value) : mType(Type::String), mBool(false), mNumber(0.0), mString(value) {}
+
+JsonValue::JsonValue(const char* value) : JsonValue(std::string(value)) {}
+
+JsonValue::JsonValue(std::vector<JsonValue> array) : mType(Type::Array), mBool(false), mNumber(0.0), mArray(std::move(array)) {}
+
+JsonValue::JsonValue(std::map<std::string, JsonValue> object) : mType(Type::Object), mBool(false), mNumber(0.0), mObject(std::move(object)) {}
+
+JsonValue JsonValue::Parse(const std::string& text)
+{
+    return JsonParser(text).ParseDocument();
+}
+
+JsonValue JsonValue::ParseFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    try
+    {
+        return Parse(contents.str());
+    }
+    catch (const std::runtime_error& e)
+    {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+}
+
+JsonValue::Type JsonValue::GetType() const
+{
+    return mType;
+}
+
+bool JsonValue::IsNull() const
+{
+    return mType == Type::Null;
+}
+
+static void checkType(JsonValue::Type actual, JsonValue::Type expected)
+{
+    if (actual != expected)
+    {
+        throw std::runtime_error(std::string("Expected a JSON ") + JsonTypeName(expected) + ", got " + JsonTypeName(actual));
+    }
+}
+
+bool JsonValue::AsBool() const
+{
+    checkType(mType, Type::Bool);
+    return mBool;
+}
+
+Float JsonValue::AsNumber() const
+{
+    checkType(mType, Type::Number);
+    return mNumber;
+}
+
+const std::string& JsonValue::AsString() const
+{
+    checkType(mType, Type::String);
+    return mString;
+}
+
+const std::vector<JsonValue>& JsonValue::AsArray() const
+{
+    checkType(mType, Type::Array);
+    return mArray;
+}
+
+const std::map<std::string, JsonValue>& JsonValue::AsObject() const
+{
+    checkType(mType, Type::Object);
+    return mObject;
+}
+
+bool JsonValue::Has(const std::string& key) const
+{
+    return AsObject().count(key) != 0;
+}
+
+const JsonValue& JsonValue::Get(const std::string& key) const
+{
+    const std::map<std::string, JsonValue>& object = AsObject();
+    auto it = object.find(key);
+    if (it == object.end())
+    {
+        throw std::runtime_error("Missing JSON key \"" + key + "\"");
+    }
+    return it->second;
+}
+
+const char* JsonTypeName(JsonValue::Type type)
+{
+    switch (type)
+    {
+    case JsonValue::Type::Null: return "null";
+    case JsonValue::Type::Bool: return "bool";
+    case JsonValue::Type::Number: return "number";
+    case JsonValue::Type::String: return "string";
+    case JsonValue::Type::Array: return "array";
+    case JsonValue::Type::Object: return "object";
+    }
+    return "unknown";
+}
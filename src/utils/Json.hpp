@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Minimal JSON document model, enough for scene and job files.  Numbers are always Floats and
+// objects don't keep the order of their keys.
+class JsonValue
+{
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    JsonValue();
+    explicit JsonValue(bool value);
+    explicit JsonValue(Float value);
+    explicit JsonValue(const std::string& value);
+    explicit JsonValue(const char* value); // Would pick the bool overload otherwise
+    explicit JsonValue(std::vector<JsonValue> array);
+    explicit JsonValue(std::map<std::string, JsonValue> object);
+
+    // Parses a whole document.  Throws std::runtime_error with the line and column of the first
+    // error.
+    static JsonValue Parse(const std::string& text);
+
+    // Parses the file at path (see Parse)
+    static JsonValue ParseFile(const std::string& path);
+
+    Type GetType() const;
+    bool IsNull() const;
+
+    // The accessors throw std::runtime_error if the value has a different type
+    bool AsBool() const;
+    Float AsNumber() const;
+    const std::string& AsString() const;
+    const std::vector<JsonValue>& AsArray() const;
+    const std::map<std::string, JsonValue>& AsObject() const;
+
+    // Object members.  Get throws std::runtime_error if the key is missing.
+    bool Has(const std::string& key) const;
+    const JsonValue& Get(const std::string& key) const;
+
+private:
+    Type mType;
+    bool mBool;
+    Float mNumber;
+    std::string mString;
+    std::vector<JsonValue> mArray;
+    std::map<std::string, JsonValue> mObject;
+};
+
+const char* JsonTypeName(JsonValue::Type type);
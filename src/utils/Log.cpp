@@ -0,0 +1,178 @@
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // A slot is stable while its sequence is even.  Writers of ticket t mark the slot 2t + 1 while
+    // they copy the record in and 2t + 2 once they are done, readers check the sequence before
+    // and after copying a record out (a seqlock per slot).
+    struct Slot
+    {
+        std::atomic<Uint> Sequence{ 0 };
+        Float Time = 0.0;
+        LogLevel Level = LogLevel::Info;
+        uint32_t Length = 0;
+        char Text[Log::MAX_MESSAGE];
+    };
+
+    Slot gRing[Log::RING_SIZE];
+    std::atomic<Uint> gNextTicket{ 0 };
+    std::atomic<int> gConsoleLevel{ int(LogLevel::Info) };
+    const std::chrono::steady_clock::time_point gStart = std::chrono::steady_clock::now();
+
+    Float secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<Float>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+const Uint Log::RING_SIZE;
+const Uint Log::MAX_MESSAGE;
+std::atomic<int> Log::sLevel{ int(LogLevel::Info) };
+
+void Log::SetLevel(LogLevel level)
+{
+    sLevel.store(int(level), std::memory_order_relaxed);
+}
+
+LogLevel Log::GetLevel()
+{
+    return LogLevel(sLevel.load(std::memory_order_relaxed));
+}
+
+void Log::SetConsoleLevel(LogLevel level)
+{
+    gConsoleLevel.store(int(level), std::memory_order_relaxed);
+}
+
+void Log::Write(LogLevel level, const std::string& message)
+{
+    const Float time = secondsSince(gStart);
+    const uint32_t length = uint32_t(std::min<Uint>(message.size(), MAX_MESSAGE));
+
+    const Uint ticket = gNextTicket.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = gRing[ticket % RING_SIZE];
+    slot.Sequence.store(2 * ticket + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.Time = time;
+    slot.Level = level;
+    slot.Length = length;
+    std::memcpy(slot.Text, message.data(), length);
+    slot.Sequence.store(2 * ticket + 2, std::memory_order_release);
+
+    if (int(level) >= gConsoleLevel.load(std::memory_order_relaxed))
+    {
+        // One fwrite per record so lines of different threads don't interleave, and no flush
+        char prefix[32];
+        const int prefixLength = std::snprintf(prefix, sizeof(prefix), "[%10.3f] %-7s ", time, LevelName(level));
+        std::string line(prefix, std::max(prefixLength, 0));
+        line += message;
+        line += '\n';
+        std::fwrite(line.data(), 1, line.size(), stdout);
+    }
+}
+
+std::vector<Log::Record> Log::Recent()
+{
+    const Uint end = gNextTicket.load(std::memory_order_acquire);
+    const Uint begin = end > RING_SIZE ? end - RING_SIZE : 0;
+
+    std::vector<Record> records;
+    records.reserve(end - begin);
+    for (Uint ticket = begin; ticket < end; ticket++)
+    {
+        const Slot& slot = gRing[ticket % RING_SIZE];
+        const Uint before = slot.Sequence.load(std::memory_order_acquire);
+        if (before != 2 * ticket + 2)
+        {
+            continue; // Still being written, or already overwritten
+        }
+
+        Record record;
+        record.Time = slot.Time;
+        record.Level = slot.Level;
+        record.Message.assign(slot.Text, std::min<Uint>(slot.Length, MAX_MESSAGE));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.Sequence.load(std::memory_order_relaxed) == before)
+        {
+            records.push_back(std::move(record));
+        }
+    }
+    return records;
+}
+
+const char* Log::LevelName(LogLevel level)
+{
+    switch (level)
+    {
+    case LogLevel::Trace: return "TRACE";
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO";
+    case LogLevel::Warning: return "WARNING";
+    case LogLevel::Error: return "ERROR";
+    case LogLevel::Off: return "OFF";
+    }
+    return "?";
+}
+
+ProgressReporter::ProgressReporter(Float intervalSeconds) :
+    mInterval(intervalSeconds),
+    mFirstStep(0),
+    mTotalSteps(0),
+    mStepsPerFrame(1),
+    mStart(Clock::now()),
+    mLastReport(mStart)
+{
+}
+
+void ProgressReporter::Start(Uint firstStep, Uint totalSteps, Uint stepsPerFrame)
+{
+    mFirstStep = firstStep;
+    mTotalSteps = totalSteps;
+    mStepsPerFrame = std::max<Uint>(stepsPerFrame, 1);
+    mStart = Clock::now();
+    mLastReport = mStart;
+}
+
+void ProgressReporter::Update(Uint step)
+{
+    if (!Log::Enabled(LogLevel::Info))
+    {
+        return;
+    }
+
+    const Clock::time_point now = Clock::now();
+    if (std::chrono::duration<Float>(now - mLastReport).count() < mInterval)
+    {
+        return;
+    }
+    mLastReport = now;
+
+    const Float elapsed = std::chrono::duration<Float>(now - mStart).count();
+    const Uint done = step > mFirstStep ? step - mFirstStep : 0;
+    const Float rate = elapsed > 0.0 ? Float(done) / elapsed : 0.0;
+
+    if (mTotalSteps == 0)
+    {
+        LOG_INFO("frame " << step / mStepsPerFrame << ", step " << step << ", " << rate << " substeps/s");
+        return;
+    }
+
+    const Uint remaining = mTotalSteps > step ? mTotalSteps - step : 0;
+    const Float percent = 100.0 * Float(std::min(step, mTotalSteps)) / Float(mTotalSteps);
+    std::ostringstream eta;
+    if (rate > 0.0)
+    {
+        eta << Float(remaining) / rate << " s";
+    }
+    else
+    {
+        eta << "unknown";
+    }
+    LOG_INFO("frame " << step / mStepsPerFrame << "/" << mTotalSteps / mStepsPerFrame << " (" << percent << "%), "
+             << rate << " substeps/s, ETA " << eta.str());
+}
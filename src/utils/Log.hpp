@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+enum class LogLevel : int { Trace, Debug, Info, Warning, Error, Off };
+
+// Records below this level are compiled out entirely (0 = Trace ... 4 = Error), so per-substep
+// tracing costs nothing in builds that don't want it.  Set by the SNOW_LOG_MIN_LEVEL cache
+// variable in CMake.
+#ifndef SNOW_LOG_MIN_LEVEL
+#define SNOW_LOG_MIN_LEVEL 0
+#endif
+
+// Logs a streamed message, e.g. SNOW_LOG(LogLevel::Debug, "step " << n).  The message is only
+// formatted if the level is enabled - otherwise this is a single relaxed load.
+#define SNOW_LOG(level, message)                                                    \
+    do {                                                                            \
+        if (int(level) >= SNOW_LOG_MIN_LEVEL && Log::Enabled(level)) {             \
+            std::ostringstream snowLogStream;                                       \
+            snowLogStream << message;                                               \
+            Log::Write(level, snowLogStream.str());                                 \
+        }                                                                           \
+    } while (0)
+
+#define LOG_TRACE(message) SNOW_LOG(LogLevel::Trace, message)
+#define LOG_DEBUG(message) SNOW_LOG(LogLevel::Debug, message)
+#define LOG_INFO(message) SNOW_LOG(LogLevel::Info, message)
+#define LOG_WARNING(message) SNOW_LOG(LogLevel::Warning, message)
+#define LOG_ERROR(message) SNOW_LOG(LogLevel::Error, message)
+
+// Process wide log.  Every record goes into a fixed size in-memory ring buffer that threads write
+// to without locks (the newest RING_SIZE records are kept, see Recent), and records at or above
+// the console level are also printed to stdout without flushing.
+class Log
+{
+public:
+    struct Record
+    {
+        Float Time; // Seconds since the start of the process
+        LogLevel Level;
+        std::string Message;
+    };
+
+    static const Uint RING_SIZE = 4096;
+    static const Uint MAX_MESSAGE = 232; // Longer messages are truncated
+
+    // Records below the level are dropped before they are formatted.  Defaults to Info.
+    static void SetLevel(LogLevel level);
+    static LogLevel GetLevel();
+
+    static bool Enabled(LogLevel level)
+    {
+        return int(level) >= sLevel.load(std::memory_order_relaxed);
+    }
+
+    // Which of the recorded levels are also printed.  Defaults to Info, Off keeps the console quiet.
+    static void SetConsoleLevel(LogLevel level);
+
+    static void Write(LogLevel level, const std::string& message);
+
+    // The records still in the ring buffer, oldest first.  Records that are being overwritten
+    // while this copies them are left out.
+    static std::vector<Record> Recent();
+
+    static const char* LevelName(LogLevel level);
+
+private:
+    static std::atomic<int> sLevel;
+};
+
+// Rate limited progress summaries (frame, percentage, substeps per second and ETA), logged at Info
+// at most once per interval.  Update is cheap enough to call every substep.
+class ProgressReporter
+{
+public:
+    ProgressReporter(Float intervalSeconds = 10.0);
+
+    // Starts timing a run of totalSteps substeps from firstStep (0 if the length isn't known, then
+    // the summaries have no percentage or ETA)
+    void Start(Uint firstStep, Uint totalSteps, Uint stepsPerFrame);
+
+    void Update(Uint step);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const Float mInterval;
+    Uint mFirstStep;
+    Uint mTotalSteps;
+    Uint mStepsPerFrame;
+    Clock::time_point mStart;
+    Clock::time_point mLastReport;
+};
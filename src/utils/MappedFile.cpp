@@ -0,0 +1,106 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX 1
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) :
+    mData(nullptr),
+    mSize(0),
+    mFile(INVALID_HANDLE_VALUE),
+    mMapping(nullptr)
+{
+    mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(mFile, &size);
+    mSize = size.QuadPart;
+
+    if (mSize > 0)
+    {
+        mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mMapping == nullptr)
+        {
+            CloseHandle(mFile);
+            throw std::runtime_error("Could not map " + path);
+        }
+        mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (mData != nullptr)
+    {
+        UnmapViewOfFile(mData);
+    }
+    if (mMapping != nullptr)
+    {
+        CloseHandle(mMapping);
+    }
+    CloseHandle(mFile);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) :
+    mData(nullptr),
+    mSize(0),
+    mFd(-1)
+{
+    mFd = open(path.c_str(), O_RDONLY);
+    if (mFd < 0)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    struct stat st;
+    fstat(mFd, &st);
+    mSize = st.st_size;
+
+    if (mSize > 0)
+    {
+        void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(mFd);
+            throw std::runtime_error("Could not map " + path);
+        }
+        mData = static_cast<const uint8_t*>(data);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (mData != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(mData), mSize);
+    }
+    close(mFd);
+}
+
+#endif
+
+const uint8_t* MappedFile::Data() const
+{
+    return mData;
+}
+
+Uint MappedFile::Size() const
+{
+    return mSize;
+}
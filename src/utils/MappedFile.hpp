@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    // Throws std::runtime_error if the file can't be opened or mapped
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* Data() const;
+    Uint Size() const;
+
+private:
+    const uint8_t* mData;
+    Uint mSize;
+
+#ifdef _WIN32
+    void* mFile;
+    void* mMapping;
+#else
+    int mFd;
+#endif
+};
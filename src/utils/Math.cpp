@@ -5,6 +5,10 @@
 #include <SVD>
 #include <glm/gtc/type_ptr.hpp>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 typedef Eigen::Matrix<Float, 3, 3> EMat3;
 typedef Eigen::Matrix<Float, 3, 1> EVec3;
 
@@ -106,6 +110,158 @@ Vec3 gridWeightGrad(Float h, Float x, Float ix, Float y, Float iy, Float z, Floa
     ) / h; // todo:  I should verify this derivative is right before I change H and everything goes to hell
 }
 
+// With fx = x - floor(x) the 4 nodes sit at distances 1 + fx, fx, 1 - fx and 2 - fx, which
+// fall into fixed pieces of N_x - so the weights are plain polynomials in fx and 1 - fx
+// with no branching on the distance.
+static void bsplineWeights(Float fx, Float w[4], Float dw[4])
+{
+    const Float t = 1.0 - fx;
+    const Float fx2 = fx * fx;
+    const Float t2 = t * t;
+
+    w[0] = t2 * t * (1.0 / 6.0);
+    w[1] = 0.5 * fx2 * fx - fx2 + (2.0 / 3.0);
+    w[2] = 0.5 * t2 * t - t2 + (2.0 / 3.0);
+    w[3] = fx2 * fx * (1.0 / 6.0);
+
+    dw[0] = -0.5 * t2;
+    dw[1] = 1.5 * fx2 - 2.0 * fx;
+    dw[2] = 2.0 * t - 1.5 * t2;
+    dw[3] = 0.5 * fx2;
+}
+
+void stencilWeights(const Vec3& x, StencilWeights& out)
+{
+    for (Uint axis = 0; axis < 3; axis++)
+    {
+        const Float cell = std::floor(x[axis]);
+        out.base[axis] = static_cast<int>(cell) - 1;
+        bsplineWeights(x[axis] - cell, out.w[axis], out.dw[axis]);
+    }
+}
+
+#ifdef __AVX2__
+
+void stencilWeights4(const Vec3 x[4], StencilWeights out[4])
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d oneHalf = _mm256_set1_pd(1.5);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d sixth = _mm256_set1_pd(1.0 / 6.0);
+    const __m256d twoThirds = _mm256_set1_pd(2.0 / 3.0);
+
+    alignas(32) Float w[4][4];
+    alignas(32) Float dw[4][4];
+    alignas(32) Float cells[4];
+
+    for (Uint axis = 0; axis < 3; axis++)
+    {
+        // One particle per lane
+        const __m256d pos = _mm256_set_pd(x[3][axis], x[2][axis], x[1][axis], x[0][axis]);
+        const __m256d cell = _mm256_floor_pd(pos);
+        const __m256d fx = _mm256_sub_pd(pos, cell);
+        const __m256d t = _mm256_sub_pd(one, fx);
+        const __m256d fx2 = _mm256_mul_pd(fx, fx);
+        const __m256d t2 = _mm256_mul_pd(t, t);
+
+        _mm256_store_pd(w[0], _mm256_mul_pd(_mm256_mul_pd(t2, t), sixth));
+        _mm256_store_pd(w[1], _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(half, _mm256_mul_pd(fx2, fx)), fx2), twoThirds));
+        _mm256_store_pd(w[2], _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(half, _mm256_mul_pd(t2, t)), t2), twoThirds));
+        _mm256_store_pd(w[3], _mm256_mul_pd(_mm256_mul_pd(fx2, fx), sixth));
+
+        _mm256_store_pd(dw[0], _mm256_sub_pd(_mm256_setzero_pd(), _mm256_mul_pd(half, t2)));
+        _mm256_store_pd(dw[1], _mm256_sub_pd(_mm256_mul_pd(oneHalf, fx2), _mm256_mul_pd(two, fx)));
+        _mm256_store_pd(dw[2], _mm256_sub_pd(_mm256_mul_pd(two, t), _mm256_mul_pd(oneHalf, t2)));
+        _mm256_store_pd(dw[3], _mm256_mul_pd(half, fx2));
+        _mm256_store_pd(cells, cell);
+
+        for (Uint p = 0; p < 4; p++)
+        {
+            out[p].base[axis] = static_cast<int>(cells[p]) - 1;
+            for (Uint node = 0; node < 4; node++)
+            {
+                out[p].w[axis][node] = w[node][p];
+                out[p].dw[axis][node] = dw[node][p];
+            }
+        }
+    }
+}
+
+#else
+
+void stencilWeights4(const Vec3 x[4], StencilWeights out[4])
+{
+    for (Uint p = 0; p < 4; p++)
+    {
+        stencilWeights(x[p], out[p]);
+    }
+}
+
+#endif
+
+Mat3 rotationFromAxisAngle(const Vec3& w)
+{
+    const Float angle = glm::length(w);
+    if (angle < 1e-12)
+    {
+        return Mat3(1.0);
+    }
+
+    const Vec3 k = w / angle;
+    const Float c = std::cos(angle);
+    const Float s = std::sin(angle);
+
+    // Columns are the rotated basis vectors:  v cos + (k x v) sin + k (k . v) (1 - cos)
+    Mat3 r;
+    for (int col = 0; col < 3; col++)
+    {
+        Vec3 e(0.0);
+        e[col] = 1.0;
+        r[col] = e * c + glm::cross(k, e) * s + k * (k[col] * (1.0 - c));
+    }
+    return r;
+}
+
+Vec3 axisAngleFromRotation(const Mat3& r)
+{
+    // glm is column major - r[col][row]
+    const Float cosAngle = glm::clamp((r[0][0] + r[1][1] + r[2][2] - 1.0) * 0.5, -1.0, 1.0);
+    const Float angle = std::acos(cosAngle);
+    const Vec3 skew(r[1][2] - r[2][1], r[2][0] - r[0][2], r[0][1] - r[1][0]);
+
+    if (angle < 1e-6)
+    {
+        return 0.5 * skew;
+    }
+
+    if (angle < 3.14159265358979323846 - 1e-4)
+    {
+        return skew * (angle / (2.0 * std::sin(angle)));
+    }
+
+    // Close to a half turn the skew part vanishes - recover the axis from the diagonal,
+    // R = cos I + (1 - cos) k k^T + sin [k]x
+    int i = 0;
+    if (r[1][1] > r[i][i]) i = 1;
+    if (r[2][2] > r[i][i]) i = 2;
+    Vec3 k;
+    k[i] = std::sqrt(std::max((r[i][i] - cosAngle) / (1.0 - cosAngle), 0.0));
+    for (int j = 0; j < 3; j++)
+    {
+        if (j != i)
+        {
+            k[j] = (r[i][j] + r[j][i]) / (2.0 * (1.0 - cosAngle) * k[i]);
+        }
+    }
+    // Pick the sign that agrees with the (small) skew part
+    if (glm::dot(k, skew) < 0.0)
+    {
+        k = -k;
+    }
+    return glm::normalize(k) * angle;
+}
+
 
 /*
 #define USE_SCALAR_IMPLEMENTATION
@@ -8,3 +8,26 @@
 void svd3(const Mat3& mat, Mat3& u, Mat3& s, Mat3& v);
 Vec3 gridWeightGrad(Float h, Float x, Float ix, Float y, Float iy, Float z, Float iz);
 Float gridWeight(Float h, Float x, Float ix, Float y, Float iy, Float z, Float iz);
+
+// Weights of the 4x4x4 block of nodes a particle's cubic B-spline reaches.  The block
+// starts at node base = floor(x) - 1, and the weight of node base + (a, b, c) is
+// w[0][a] * w[1][b] * w[2][c].  dw holds the derivatives of the per-axis weights in grid
+// units (divide by h for the world space gradient).
+struct StencilWeights
+{
+    IVec3 base;
+    Float w[3][4];
+    Float dw[3][4];
+};
+
+// x is the particle position in grid units (eg. divided by h)
+void stencilWeights(const Vec3& x, StencilWeights& out);
+
+// Same as stencilWeights for 4 particles at a time - vectorized with AVX2 where available
+void stencilWeights4(const Vec3 x[4], StencilWeights out[4]);
+
+// Rotation by length(w) radians around w (Rodrigues' formula)
+Mat3 rotationFromAxisAngle(const Vec3& w);
+
+// Inverse of rotationFromAxisAngle - the angle of the result is in [0, pi]
+Vec3 axisAngleFromRotation(const Mat3& r);
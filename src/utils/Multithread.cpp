@@ -1,5 +1,29 @@
 #include "Multithread.hpp"
 
-MTIterator::MTIterator(Uint numthreads) :
-    mNumThreads(numthreads)
-{}
\ No newline at end of file
+#include <cmath>
+
+MTIterator::MTIterator(Uint numthreads, bool pinned) :
+    mNumThreads(numthreads),
+    mPinned(pinned && NumaTopology::Get().NumNodes() > 1)
+{}
+
+Uint MTIterator::NumThreads() const
+{
+    return mNumThreads;
+}
+
+void MTIterator::ChunkRange(Uint count, Uint numThreads, Uint threadIdx, Uint& low, Uint& high)
+{
+    // Every thread takes the ceiling of its share of what's left
+    Uint idx = 0;
+    Uint partsLeft = count;
+    for (Uint t = 0; t < threadIdx; t++)
+    {
+        const Uint parts = std::ceil(Float(partsLeft) / Float(numThreads - t));
+        partsLeft -= parts;
+        idx += parts;
+    }
+
+    low = idx;
+    high = idx + Uint(std::ceil(Float(partsLeft) / Float(numThreads - threadIdx)));
+}
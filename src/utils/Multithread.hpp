@@ -1,21 +1,24 @@
 #pragma once
 
 #include "Common.hpp"
+#include "Numa.hpp"
+#include "Trace.hpp"
+#include <algorithm>
 #include <vector>
 #include <thread>
 #include <cmath> 
 #include <functional>
 
-template<typename T, typename Func>
-void IterateThread(std::vector<T>& data, Uint low, Uint high, Func f) {
+template<typename T, typename A, typename Func>
+void IterateThread(std::vector<T, A>& data, Uint low, Uint high, Func f) {
     for(Uint i = low; i < high; i++) 
     {
         f(data[i]);
     }
 }
 
-template<typename T, typename Func>
-void IterateThreadConst(const std::vector<T>& data, Uint low, Uint high, Func f) {
+template<typename T, typename A, typename Func>
+void IterateThreadConst(const std::vector<T, A>& data, Uint low, Uint high, Func f) {
     for(Uint i = low; i < high; i++) 
     {
         f(data[i]);
@@ -26,11 +29,12 @@ void IterateThreadConst(const std::vector<T>& data, Uint low, Uint high, Func f)
 class MTIterator
 {
 public:
-    MTIterator(Uint numthreads);
+    // With pinned every worker runs on the NUMA node of its chunk (see NumaTopology::WorkerNode)
+    MTIterator(Uint numthreads, bool pinned = false);
     
     // Todo:  Yeah, this should be able to use things other than vectors... but we're not for now
-    template<typename T, typename Func>
-    void IterateOverVector(std::vector<T>& data, Func f) {
+    template<typename T, typename A, typename Func>
+    void IterateOverVector(std::vector<T, A>& data, Func f) {
         // Split into NumThreads buckets without creating empty buckets 
         // (unless thre are less elements than there are buckets)
         std::vector<std::thread> threads;
@@ -41,7 +45,9 @@ public:
         {
             Uint parts = std::ceil(Float(partsLeft) / Float(threadsLeft));
             partsLeft -= parts;
-            threads.push_back(std::thread(IterateThread<T, Func>, std::ref(data), idx, idx + parts, f));
+            threads.push_back(startWorker(mNumThreads - threadsLeft, [&data, f, idx, parts]() mutable {
+                IterateThread<T, A, Func>(data, idx, idx + parts, f);
+            }));
             idx += parts;
         }
 
@@ -52,9 +58,70 @@ public:
         }
     }
 
+    // Splits [0, count) into one contiguous range per thread and calls f(low, high, threadIdx)
+    // on each range.  The split only depends on count and the number of threads.
+    template<typename Func>
+    void IterateOverChunks(Uint count, Func f) {
+        std::vector<std::thread> threads;
+
+        for (Uint threadIdx = 0; threadIdx < mNumThreads; threadIdx++)
+        {
+            Uint low, high;
+            ChunkRange(count, mNumThreads, threadIdx, low, high);
+            threads.push_back(startWorker(threadIdx, [f, low, high, threadIdx]() mutable {
+                f(low, high, threadIdx);
+            }));
+        }
+
+        for(std::thread& t : threads)
+        {
+            t.join();
+        }
+    }
+
+    // Calls f(i) for every i in [0, count)
+    template<typename Func>
+    void IterateOverIndices(Uint count, Func f) {
+        IterateOverChunks(count, [&f](Uint low, Uint high, Uint threadIdx) {
+            for (Uint i = low; i < high; i++)
+            {
+                f(i);
+            }
+        });
+    }
+
+    // Calls f(low, high, partial) for consecutive blocks of blockSize indices in [0, count), every
+    // block with its own value initialized partial, and merges the partials in block order with
+    // merge(total, partial).  The blocks don't depend on the number of threads and neither does
+    // the result.
+    template<typename T, typename Func, typename Merge>
+    T ReduceOverBlocks(Uint count, Uint blockSize, Func f, Merge merge) {
+        const Uint numBlocks = (count + blockSize - 1) / blockSize;
+        std::vector<T> partials(numBlocks);
+        IterateOverChunks(numBlocks, [&](Uint low, Uint high, Uint threadIdx) {
+            for (Uint b = low; b < high; b++)
+            {
+                f(b * blockSize, std::min(count, (b + 1) * blockSize), partials[b]);
+            }
+        });
+
+        T total{};
+        for (const T& partial : partials)
+        {
+            merge(total, partial);
+        }
+        return total;
+    }
+
+    Uint NumThreads() const;
+
+    // The range [low, high) of [0, count) that IterateOverChunks and IterateOverVector hand to
+    // worker threadIdx out of numThreads
+    static void ChunkRange(Uint count, Uint numThreads, Uint threadIdx, Uint& low, Uint& high);
+
     // Todo:  Remove this
-    template<typename T, typename Func>
-    void IterateOverVector(const std::vector<T>& data, Func f) {
+    template<typename T, typename A, typename Func>
+    void IterateOverVector(const std::vector<T, A>& data, Func f) {
         // Split into NumThreads buckets without creating empty buckets 
         // (unless thre are less elements than there are buckets)
         std::vector<std::thread> threads;
@@ -65,7 +132,9 @@ public:
         {
             Uint parts = std::ceil(Float(partsLeft) / Float(threadsLeft));
             partsLeft -= parts;
-            threads.push_back(std::thread(IterateThreadConst<T, Func>, std::ref(data), idx, idx + parts, f));
+            threads.push_back(startWorker(mNumThreads - threadsLeft, [&data, f, idx, parts]() mutable {
+                IterateThreadConst<T, A, Func>(data, idx, idx + parts, f);
+            }));
             idx += parts;
         }
 
@@ -77,5 +146,44 @@ public:
     }
 
 private:
+    // Starts a worker running f(), pinned to its NUMA node if the iterator is pinned.  The workers
+    // are new threads on every call, so pinning costs one sched_setaffinity (and with libnuma one
+    // set_mempolicy) per worker and phase - around a microsecond next to the ~10 us of starting
+    // the thread itself, so it isn't worth a pool of persistent pinned workers on its own.
+    template<typename Func>
+    std::thread startWorker(Uint threadIdx, Func f)
+    {
+        if (!mPinned)
+        {
+            return startTracedWorker(threadIdx, f);
+        }
+
+        const Uint node = NumaTopology::Get().WorkerNode(threadIdx, mNumThreads);
+        return startTracedWorker(threadIdx, [f, node]() mutable {
+            NumaTopology::Get().PinCurrentThread(node);
+            f();
+        });
+    }
+
+    // While tracing, the run of the worker is recorded on its lane under the name of what the
+    // calling thread is doing (see Trace::CurrentName)
+    template<typename Func>
+    std::thread startTracedWorker(Uint threadIdx, Func f)
+    {
+        if (!Trace::Enabled())
+        {
+            return std::thread(f);
+        }
+
+        const char* name = Trace::CurrentName();
+        return std::thread([f, name, threadIdx]() mutable {
+            Trace::SetThreadLane(threadIdx + 1);
+            const Float start = Trace::Now();
+            f();
+            Trace::Record(name, "worker", start, Trace::Now());
+        });
+    }
+
     const Uint mNumThreads;
+    const bool mPinned;
 };
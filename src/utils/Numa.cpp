@@ -0,0 +1,236 @@
+#include "Numa.hpp"
+
+#include "Log.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#ifdef SNOW_LIBNUMA
+#include <numa.h>
+#include <numaif.h>
+#elif defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(__linux__) && !defined(SNOW_LIBNUMA)
+    // "0-3,8-11"
+    std::vector<int> parseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        std::stringstream ranges(list);
+        std::string range;
+        while (std::getline(ranges, range, ','))
+        {
+            if (range.empty() || range == "\n")
+            {
+                continue;
+            }
+
+            const size_t dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<std::vector<int>> readSysfsNodes(std::vector<int>& ids)
+    {
+        std::vector<int> nodeIds;
+        if (DIR* dir = opendir("/sys/devices/system/node"))
+        {
+            while (dirent* entry = readdir(dir))
+            {
+                const std::string name = entry->d_name;
+                if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                    std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                {
+                    nodeIds.push_back(std::stoi(name.substr(4)));
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(nodeIds.begin(), nodeIds.end());
+
+        std::vector<std::vector<int>> nodes;
+        for (int id : nodeIds)
+        {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string list;
+            if (std::getline(file, list))
+            {
+                std::vector<int> cpus = parseCpuList(list);
+                if (!cpus.empty())
+                {
+                    nodes.push_back(cpus);
+                    ids.push_back(id);
+                }
+            }
+        }
+        return nodes;
+    }
+#endif
+
+#ifdef SNOW_LIBNUMA
+    std::vector<std::vector<int>> readLibnumaNodes(std::vector<int>& ids)
+    {
+        std::vector<std::vector<int>> nodes;
+        if (numa_available() < 0)
+        {
+            return nodes;
+        }
+
+        bitmask* mask = numa_allocate_cpumask();
+        for (int node = 0; node <= numa_max_node(); node++)
+        {
+            std::vector<int> cpus;
+            if (numa_node_to_cpus(node, mask) == 0)
+            {
+                for (int cpu = 0; cpu < numa_num_configured_cpus(); cpu++)
+                {
+                    if (numa_bitmask_isbitset(mask, cpu))
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+            if (!cpus.empty())
+            {
+                nodes.push_back(cpus);
+                ids.push_back(node);
+            }
+        }
+        numa_free_cpumask(mask);
+        return nodes;
+    }
+#endif
+
+#if defined(__linux__) && !defined(SNOW_LIBNUMA)
+    // What libnuma's numaif.h wraps, glibc doesn't
+    long mbind(void* addr, unsigned long len, int mode, const unsigned long* nodemask, unsigned long maxnode, unsigned flags)
+    {
+        return syscall(SYS_mbind, addr, len, mode, nodemask, maxnode, flags);
+    }
+
+    long move_pages(int pid, unsigned long count, void** pages, const int* nodes, int* status, int flags)
+    {
+        return syscall(SYS_move_pages, pid, count, pages, nodes, status, flags);
+    }
+#endif
+}
+
+const NumaTopology& NumaTopology::Get()
+{
+    static const NumaTopology topology;
+    return topology;
+}
+
+NumaTopology::NumaTopology()
+{
+#if defined(SNOW_LIBNUMA)
+    mNodeCpus = readLibnumaNodes(mNodeIds);
+#elif defined(__linux__)
+    mNodeCpus = readSysfsNodes(mNodeIds);
+#endif
+
+    if (mNodeCpus.empty())
+    {
+        mNodeCpus.emplace_back();
+        mNodeIds.assign(1, 0);
+    }
+}
+
+Uint NumaTopology::NumNodes() const
+{
+    return mNodeCpus.size();
+}
+
+const std::vector<int>& NumaTopology::NodeCpus(Uint node) const
+{
+    return mNodeCpus[node];
+}
+
+Uint NumaTopology::WorkerNode(Uint threadIdx, Uint numThreads) const
+{
+    return numThreads == 0 ? 0 : threadIdx * NumNodes() / numThreads;
+}
+
+void NumaTopology::PinCurrentThread(Uint node) const
+{
+#ifdef __linux__
+    const std::vector<int>& cpus = mNodeCpus[node];
+    if (cpus.empty())
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        LOG_DEBUG("Can't pin a worker to NUMA node " << node);
+    }
+
+#ifdef SNOW_LIBNUMA
+    // Overrides a process wide policy like numactl --interleave, first touch places the pages
+    numa_set_localalloc();
+#endif
+#endif
+}
+
+void NumaTopology::MoveToNode(void* memory, Uint bytes, Uint node) const
+{
+#ifdef __linux__
+    if (NumNodes() < 2 || bytes == 0)
+    {
+        return;
+    }
+
+    const int id = mNodeIds[node];
+    const Uint bitsPerWord = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(id / bitsPerWord + 1, 0);
+    mask[id / bitsPerWord] |= 1ul << (id % bitsPerWord);
+    if (mbind(memory, bytes, MPOL_BIND, mask.data(), mask.size() * bitsPerWord + 1, MPOL_MF_MOVE) != 0)
+    {
+        LOG_DEBUG("Can't move " << bytes << " bytes to NUMA node " << node);
+    }
+#endif
+}
+
+int NumaTopology::PageNode(const void* address) const
+{
+#ifdef __linux__
+    void* page = const_cast<void*>(address);
+    int status = -1;
+    if (move_pages(0, 1, &page, nullptr, &status, 0) != 0 || status < 0)
+    {
+        return -1;
+    }
+
+    const auto id = std::find(mNodeIds.begin(), mNodeIds.end(), status);
+    return id == mNodeIds.end() ? -1 : int(id - mNodeIds.begin());
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <vector>
+
+// NUMA nodes of the machine and the CPUs on each, from libnuma when the build found it
+// (SNOW_LIBNUMA), otherwise from /sys/devices/system/node on Linux.  Everywhere else (and on
+// machines without NUMA) there is a single node and pinning does nothing.
+//
+// The workers of an MTIterator are spread over the nodes in contiguous blocks, the same way it
+// splits its work into contiguous chunks:  with NUMA placement (see
+// SimulationParameters::NUMA_PLACEMENT) every worker runs on its node and first touches its chunk
+// of the large arrays, so each node holds the particles and cells its own workers process.
+class NumaTopology
+{
+public:
+    static const NumaTopology& Get();
+
+    Uint NumNodes() const;
+
+    // Empty if the CPUs of the node are unknown
+    const std::vector<int>& NodeCpus(Uint node) const;
+
+    // Node of worker threadIdx out of numThreads
+    Uint WorkerNode(Uint threadIdx, Uint numThreads) const;
+
+    // Restricts the calling thread to the CPUs of the node (and its memory allocations to the
+    // local node with libnuma).  Does nothing if the CPUs aren't known or pinning isn't allowed.
+    void PinCurrentThread(Uint node) const;
+
+    // Binds the pages of [memory, memory + bytes) to the node and moves those that are already
+    // elsewhere (mbind with MPOL_MF_MOVE).  memory has to be page aligned.  Does nothing on a
+    // single node.
+    void MoveToNode(void* memory, Uint bytes, Uint node) const;
+
+    // Node of the page holding address, or -1 if it isn't known (or the page isn't faulted in)
+    int PageNode(const void* address) const;
+
+private:
+    NumaTopology();
+
+    std::vector<std::vector<int>> mNodeCpus; // Nodes without CPUs are left out
+    std::vector<int> mNodeIds; // Of the kernel, which has gaps where nodes were left out
+};
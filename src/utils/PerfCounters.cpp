@@ -0,0 +1,120 @@
+#include "PerfCounters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+#ifdef __linux__
+namespace
+{
+    struct CounterConfig
+    {
+        uint32_t Type;
+        uint64_t Config;
+    };
+
+    const CounterConfig COUNTER_CONFIGS[PerfCounters::NUM_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }, // Last level cache
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        // Data TLB load misses
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+
+    int openCounter(const CounterConfig& counter)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter.Type;
+        attr.config = counter.Config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // Threads started later count into this counter
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+}
+#endif
+
+const Uint PerfCounters::NUM_COUNTERS;
+
+PerfCounters::PerfCounters()
+{
+    mFds.fill(-1);
+#ifdef __linux__
+    for (Uint i = 0; i < NUM_COUNTERS; i++)
+    {
+        mFds[i] = openCounter(COUNTER_CONFIGS[i]);
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int fd : mFds)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::Available(PerfCounter counter) const
+{
+    return mFds[Uint(counter)] >= 0;
+}
+
+bool PerfCounters::AnyAvailable() const
+{
+    for (int fd : mFds)
+    {
+        if (fd >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+PerfCounters::Values PerfCounters::Read() const
+{
+    Values values;
+    values.fill(0);
+#ifdef __linux__
+    for (Uint i = 0; i < NUM_COUNTERS; i++)
+    {
+        // Value, time enabled, time running
+        uint64_t data[3];
+        if (mFds[i] < 0 || read(mFds[i], data, sizeof(data)) != ssize_t(sizeof(data)) || data[2] == 0)
+        {
+            continue;
+        }
+        values[i] = data[2] < data[1] ? Uint(Float(data[0]) * Float(data[1]) / Float(data[2])) : data[0];
+    }
+#endif
+    return values;
+}
+
+const char* PerfCounters::CounterName(PerfCounter counter)
+{
+    switch (counter)
+    {
+    case PerfCounter::Cycles: return "cycles";
+    case PerfCounter::Instructions: return "instructions";
+    case PerfCounter::CacheMisses: return "LLC misses";
+    case PerfCounter::BranchMisses: return "branch misses";
+    case PerfCounter::TLBMisses: return "dTLB misses";
+    case PerfCounter::Count: break;
+    }
+    return "?";
+}
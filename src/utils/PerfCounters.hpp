@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <array>
+
+enum class PerfCounter : int { Cycles, Instructions, CacheMisses, BranchMisses, TLBMisses, Count };
+
+// Hardware event counters (Linux perf_event_open) of the thread that creates them and of every
+// thread it starts afterwards - the workers of MTIterator are started per call, so their events
+// are included once they are joined.  Only user space events are counted, which most systems
+// allow without privileges.
+//
+// Counters the system doesn't provide (other platforms, perf_event_paranoid, virtual machines
+// without a PMU) stay unavailable and read as zero, the others keep working.
+class PerfCounters
+{
+public:
+    static const Uint NUM_COUNTERS = Uint(PerfCounter::Count);
+    using Values = std::array<Uint, NUM_COUNTERS>;
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool Available(PerfCounter counter) const;
+    bool AnyAvailable() const;
+
+    // Totals since the counters were opened, indexed by PerfCounter.  Scaled up for the time a
+    // counter was multiplexed out when there are more events than hardware counters.
+    Values Read() const;
+
+    static const char* CounterName(PerfCounter counter);
+
+private:
+    std::array<int, NUM_COUNTERS> mFds;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Common.hpp"
+
+// Counter based random numbers.  Every value is a pure function of (seed, counter), so work can be
+// split over any number of threads in any order and still draw exactly the same numbers.
+
+// splitmix64 finalizer
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+inline uint64_t randomBits(uint64_t seed, uint64_t counter)
+{
+    return mix64(mix64(seed + 0x9e3779b97f4a7c15ull) ^ (counter * 0x9e3779b97f4a7c15ull));
+}
+
+// Uniform in [0, 1)
+inline Float randomUniform(uint64_t seed, uint64_t counter)
+{
+    return Float(randomBits(seed, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
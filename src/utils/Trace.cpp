@@ -0,0 +1,197 @@
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    struct Event
+    {
+        const char* Name;
+        const char* Category;
+        Float Start;
+        Float Duration;
+        Uint Lane;
+    };
+
+    void handOver(std::vector<Event>& events);
+
+    struct ThreadBuffer
+    {
+        std::vector<Event> Events;
+        Uint Lane = 0;
+        const char* CurrentName = "";
+
+        ~ThreadBuffer()
+        {
+            handOver(Events);
+        }
+    };
+
+    thread_local ThreadBuffer tBuffer;
+
+    // Everything below is guarded by gMutex
+    std::mutex gMutex;
+    std::FILE* gFile = nullptr;
+    bool gFirstEvent = true;
+    std::vector<Event> gHandedOver;
+    std::set<Uint> gNamedLanes;
+
+    const std::chrono::steady_clock::time_point gStart = std::chrono::steady_clock::now();
+
+    void handOver(std::vector<Event>& events)
+    {
+        if (events.empty())
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(gMutex);
+        gHandedOver.insert(gHandedOver.end(), events.begin(), events.end());
+        events.clear();
+    }
+
+    void writeSeparator()
+    {
+        std::fputs(gFirstEvent ? "" : ",\n", gFile);
+        gFirstEvent = false;
+    }
+
+    // Metadata event naming the lane in the viewers
+    void nameLane(Uint lane)
+    {
+        if (!gNamedLanes.insert(lane).second)
+        {
+            return;
+        }
+
+        writeSeparator();
+        if (lane == 0)
+        {
+            std::fprintf(gFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"solver\"}}");
+        }
+        else if (lane == Trace::IO_LANE)
+        {
+            std::fprintf(gFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"args\":{\"name\":\"io\"}}",
+                         (unsigned long long)lane);
+        }
+        else
+        {
+            std::fprintf(gFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"args\":{\"name\":\"worker %llu\"}}",
+                         (unsigned long long)lane, (unsigned long long)(lane - 1));
+        }
+    }
+
+    void writeEvents(const std::vector<Event>& events)
+    {
+        for (const Event& e : events)
+        {
+            nameLane(e.Lane);
+            writeSeparator();
+            std::fprintf(gFile, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%llu}",
+                         e.Name, e.Category, e.Start, e.Duration, (unsigned long long)e.Lane);
+        }
+    }
+}
+
+const Uint Trace::IO_LANE;
+std::atomic<bool> Trace::sEnabled{ false };
+
+void Trace::Open(const std::string& path)
+{
+    Close();
+
+    std::lock_guard<std::mutex> lock(gMutex);
+    gFile = std::fopen(path.c_str(), "w");
+    if (gFile == nullptr)
+    {
+        throw std::runtime_error("Can't write the trace to " + path);
+    }
+    std::fputs("{\"traceEvents\":[\n", gFile);
+    gFirstEvent = true;
+    gNamedLanes.clear();
+}
+
+void Trace::Close()
+{
+    SetEnabled(false);
+    Flush();
+
+    std::lock_guard<std::mutex> lock(gMutex);
+    if (gFile != nullptr)
+    {
+        std::fputs("\n]}\n", gFile);
+        std::fclose(gFile);
+        gFile = nullptr;
+    }
+}
+
+void Trace::SetEnabled(bool enabled)
+{
+    sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+Float Trace::Now()
+{
+    return std::chrono::duration<Float, std::micro>(std::chrono::steady_clock::now() - gStart).count();
+}
+
+void Trace::Record(const char* name, const char* category, Float start, Float end)
+{
+    tBuffer.Events.push_back({ name, category, start, end - start, tBuffer.Lane });
+}
+
+const char* Trace::CurrentName()
+{
+    return tBuffer.CurrentName;
+}
+
+void Trace::SetCurrentName(const char* name)
+{
+    tBuffer.CurrentName = name;
+}
+
+void Trace::SetThreadLane(Uint lane)
+{
+    tBuffer.Lane = lane;
+}
+
+void Trace::Flush()
+{
+    handOver(tBuffer.Events);
+
+    std::lock_guard<std::mutex> lock(gMutex);
+    if (gFile != nullptr)
+    {
+        writeEvents(gHandedOver);
+        std::fflush(gFile);
+    }
+    gHandedOver.clear();
+}
+
+TraceScope::TraceScope(const char* name, const char* category) :
+    mName(name),
+    mCategory(category),
+    mOuterName(nullptr),
+    mStart(0.0)
+{
+    if (Trace::Enabled())
+    {
+        mOuterName = Trace::CurrentName();
+        Trace::SetCurrentName(name);
+        mStart = Trace::Now();
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if (mOuterName != nullptr)
+    {
+        Trace::Record(mName, mCategory, mStart, Trace::Now());
+        Trace::SetCurrentName(mOuterName);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <atomic>
+#include <string>
+
+// Timeline of the process in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// The trace goes to one file and recording is switched on and off at runtime, eg. for a range of
+// frames - while it's off every recording point costs a relaxed load.
+//
+// Every thread records into its own buffer without locks.  The workers of MTIterator hand theirs
+// over when they exit, Flush appends everything handed over (and the buffer of the calling thread)
+// to the file.  Event names aren't copied and have to outlive the trace (string literals).
+class Trace
+{
+public:
+    // Lanes (tids) of the timeline:  the solver thread records on lane 0 and MTIterator worker n on
+    // lane 1 + n, unless a thread picks another one (see SetThreadLane)
+    static const Uint IO_LANE = 1000;
+
+    // Starts a new trace file, replacing one that is open.  Recording stays off until SetEnabled.
+    // Throws std::runtime_error if the file can't be created.
+    static void Open(const std::string& path);
+
+    // Flushes and finishes the file, turning recording off
+    static void Close();
+
+    static void SetEnabled(bool enabled);
+
+    static bool Enabled()
+    {
+        return sEnabled.load(std::memory_order_relaxed);
+    }
+
+    // Microseconds since the start of the process
+    static Float Now();
+
+    // Records an event from start to end (see Now) on the calling thread's lane
+    static void Record(const char* name, const char* category, Float start, Float end);
+
+    // Name of what the calling thread is doing (its innermost TraceScope or solver phase), the
+    // chunks of the MTIterator workers it starts are recorded under it
+    static const char* CurrentName();
+    static void SetCurrentName(const char* name);
+
+    static void SetThreadLane(Uint lane);
+
+    // Appends the events recorded so far to the file (the ones of threads that are still running
+    // follow with a later flush)
+    static void Flush();
+
+private:
+    static std::atomic<bool> sEnabled;
+};
+
+// Records its lifetime as one event when tracing is enabled
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* category = "solver");
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* mName;
+    const char* mCategory;
+    const char* mOuterName;
+    Float mStart;
+};
@@ -0,0 +1,162 @@
+#include "gtest/gtest.h"
+#include "Collider.hpp"
+#include "CPUSolver.hpp"
+#include "Math.hpp"
+#include "Mesh.hpp"
+#include "Multithread.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+    const Float PI = 3.14159265358979323846;
+
+    // Axis aligned box [min, max] baked with some room around it
+    std::shared_ptr<ColliderSDF> MakeBox(const Vec3& min, const Vec3& max, MTIterator& mt)
+    {
+        return std::make_shared<ColliderSDF>(min - Vec3(1.0), max + Vec3(1.0), 0.25, [&](const Vec3& p) {
+            const Vec3 d = glm::max(min - p, p - max);
+            const Vec3 outside = glm::max(d, Vec3(0.0));
+            return glm::length(outside) + std::min(std::max(d.x, std::max(d.y, d.z)), 0.0);
+        }, mt);
+    }
+
+    Mesh MakeSphere(Float radius, int rings, int segments)
+    {
+        auto point = [&](int ring, int segment) {
+            Float theta = PI * Float(ring) / Float(rings);
+            Float phi = 2.0 * PI * Float(segment % segments) / Float(segments);
+            return radius * Vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+        };
+
+        std::vector<Triangle> triangles;
+        for (int r = 0; r < rings; r++) {
+            for (int s = 0; s < segments; s++) {
+                if (r > 0) {
+                    triangles.push_back({ point(r, s), point(r + 1, s), point(r, s + 1) });
+                }
+                if (r < rings - 1) {
+                    triangles.push_back({ point(r, s + 1), point(r + 1, s), point(r + 1, s + 1) });
+                }
+            }
+        }
+        return Mesh(triangles);
+    }
+}
+
+TEST(ColliderTests, MeshSDFMatchesSphere) {
+    MTIterator mt(4);
+    const Float radius = 2.0;
+    ColliderSDF sdf(MakeSphere(radius, 48, 96), 0.1, 0.5, mt);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<Float> coord(-2.5, 2.5); // Inside the baked box
+    for (int i = 0; i < 500; i++) {
+        const Vec3 p(coord(rng), coord(rng), coord(rng));
+        EXPECT_NEAR(sdf.Distance(p), glm::length(p) - radius, 0.02);
+        if (std::abs(glm::length(p) - radius) < 0.5 && glm::length(p) > 0.5) {
+            EXPECT_GT(glm::dot(sdf.Normal(p), glm::normalize(p)), 0.99);
+        }
+    }
+}
+
+TEST(ColliderTests, AxisAngleRoundTrip) {
+    for (const Vec3& w : { Vec3(0.0), Vec3(1e-8, 0.0, 0.0), Vec3(0.3, -0.2, 0.9), Vec3(0.0, 0.0, PI - 1e-6), Vec3(PI, 0.0, 0.0) }) {
+        const Vec3 back = axisAngleFromRotation(rotationFromAxisAngle(w));
+        // A half turn around -w is the same rotation as around w
+        const bool halfTurn = std::abs(glm::length(w) - PI) < 1e-3;
+        EXPECT_NEAR(glm::length(halfTurn ? glm::abs(back) - glm::abs(w) : back - w), 0.0, 1e-6);
+    }
+}
+
+TEST(ColliderTests, KeyframedMotion) {
+    MTIterator mt(2);
+    std::vector<ColliderKeyframe> keys = {
+        { 1.0, Vec3(0.0), Mat3(1.0) },
+        { 2.0, Vec3(4.0, 0.0, 0.0), rotationFromAxisAngle(Vec3(0.0, 0.0, PI / 2.0)) },
+    };
+    Collider collider(MakeBox(Vec3(-1.0), Vec3(1.0), mt), keys, 0.0);
+
+    // Halfway through the keys:  translated by 2 and rotated by 45 degrees
+    collider.SetTime(1.5);
+    const Vec3 corner = Vec3(2.0, 0.0, 0.0) + rotationFromAxisAngle(Vec3(0.0, 0.0, PI / 4.0)) * Vec3(1.0, 0.0, 0.0);
+    EXPECT_NEAR(collider.Distance(corner), 0.0, 1e-9);
+    EXPECT_LT(collider.Distance(Vec3(2.0, 0.0, 0.0)), -0.9);
+    EXPECT_GT(collider.Distance(Vec3(0.0)), 0.5);
+
+    const Vec3 v = collider.VelocityAt(Vec3(2.0, 1.0, 0.0));
+    EXPECT_NEAR(v.x, 4.0 - PI / 2.0, 1e-9);
+    EXPECT_NEAR(v.y, 0.0, 1e-9);
+
+    // Rests after the last key
+    collider.SetTime(3.0);
+    EXPECT_EQ(collider.VelocityAt(Vec3(5.0, 1.0, 0.0)), Vec3(0.0));
+    EXPECT_LT(collider.Distance(Vec3(4.0, 0.0, 0.0)), -0.9);
+}
+
+TEST(ColliderTests, RelativeVelocityFriction) {
+    MTIterator mt(2);
+    std::shared_ptr<ColliderSDF> box = MakeBox(Vec3(-4.0, -4.0, -4.0), Vec3(4.0, 4.0, 0.0), mt);
+    const Vec3 inside(0.0, 0.0, -0.1);
+
+    // The ground slides along x at 1 while snow hits it going down
+    Collider slippery(box, Vec3(0.0), Mat3(1.0), Vec3(1.0, 0.0, 0.0), Vec3(0.0), 0.0);
+    Collider rough(box, Vec3(0.0), Mat3(1.0), Vec3(1.0, 0.0, 0.0), Vec3(0.0), 0.5);
+    Collider sticky(box, Vec3(0.0), Mat3(1.0), Vec3(1.0, 0.0, 0.0), Vec3(0.0), 2.0);
+
+    Vec3 v(0.0, 0.0, -1.0);
+    EXPECT_TRUE(slippery.Collide(inside, v));
+    EXPECT_NEAR(glm::length(v - Vec3(0.0)), 0.0, 1e-9);
+
+    v = Vec3(0.0, 0.0, -1.0);
+    EXPECT_TRUE(rough.Collide(inside, v));
+    EXPECT_NEAR(glm::length(v - Vec3(0.5, 0.0, 0.0)), 0.0, 1e-9);
+
+    v = Vec3(0.0, 0.0, -1.0);
+    EXPECT_TRUE(sticky.Collide(inside, v));
+    EXPECT_NEAR(glm::length(v - Vec3(1.0, 0.0, 0.0)), 0.0, 1e-9);
+
+    // Separating and non-touching material is left alone
+    v = Vec3(0.0, 0.0, 1.0);
+    EXPECT_TRUE(sticky.Collide(inside, v));
+    EXPECT_EQ(v, Vec3(0.0, 0.0, 1.0));
+    v = Vec3(0.0, 0.0, -1.0);
+    EXPECT_FALSE(sticky.Collide(Vec3(0.0, 0.0, 0.5), v));
+    EXPECT_EQ(v, Vec3(0.0, 0.0, -1.0));
+}
+
+// A moving plow pushes the snow it touches and wakes up the resting snow it runs into
+TEST(ColliderTests, MovingColliderPushesAndWakesSnow) {
+    SimulationParameters params;
+    params.GRAVITY = 0.0;
+    params.SLEEPING = true;
+    params.SLEEP_SUBSTEPS = 5;
+
+    CPUSolver solver(IVec3(32, 16, 16), 0.001, params);
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 6; y++) {
+            for (int z = 0; z < 6; z++) {
+                solver.AddParticle(Vec3(8.0 + x * 0.5, 6.0 + y * 0.5, 6.0 + z * 0.5), Vec3(0.0), 1.0);
+            }
+        }
+    }
+
+    solver.NextFrame();
+    EXPECT_EQ(solver.GetStats().SleepingParticles, 288u);
+
+    MTIterator mt(2);
+    solver.AddCollider(Collider(MakeBox(Vec3(4.0, 4.0, 4.0), Vec3(8.6, 12.0, 12.0), mt), Vec3(0.0), Mat3(1.0), Vec3(20.0, 0.0, 0.0), Vec3(0.0), 1.0));
+
+    solver.NextFrame();
+    EXPECT_EQ(solver.GetStats().SleepingParticles, 0u);
+
+    solver.NextFrame();
+    std::shared_ptr<SimulationOutput> output = solver.GetOutput();
+    Float pushed = 0.0;
+    for (const Particle& p : output->GetParticles()) {
+        pushed = std::max(pushed, Float(p.velocity.x));
+    }
+    EXPECT_GT(pushed, 1.0);
+}
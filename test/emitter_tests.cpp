@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+#include "Emitter.hpp"
+#include "Multithread.hpp"
+
+#include <vector>
+
+// Lattice sampling without jitter reproduces the hand written scene setup loops
+TEST(EmitterTests, LatticeCounts) {
+    MTIterator mt(3);
+    EmitterSettings settings;
+    settings.Spacing = 0.5;
+
+    Uint expectedSphere = 0;
+    for (int x = -30; x < 30; x++) {
+        for (int y = -30; y < 30; y++) {
+            for (int z = -30; z < 30; z++) {
+                expectedSphere += (x * x + y * y + z * z <= 9) ? 1 : 0;
+            }
+        }
+    }
+
+    EXPECT_EQ(SphereEmitter(Vec3(40, 90, 90), 1.5, settings).Sample(mt).size(), expectedSphere);
+    EXPECT_EQ(BoxEmitter(Vec3(128.5, 45, 45), Vec3(130, 135, 135), settings).Sample(mt).size(), 3u * 180u * 180u);
+}
+
+// The sampled particles only depend on the seed, not on the number of threads
+TEST(EmitterTests, DeterministicAcrossThreadCounts) {
+    EmitterSettings settings;
+    settings.Spacing = 0.25;
+    settings.Jitter = 0.9;
+    settings.Seed = 42;
+    SphereEmitter emitter(Vec3(5.0, 5.0, 5.0), 2.0, settings);
+
+    MTIterator single(1);
+    std::vector<ParticleSeed> expected = emitter.Sample(single);
+    ASSERT_GT(expected.size(), 0u);
+
+    for (Uint threads : { 2, 5, 16 }) {
+        MTIterator mt(threads);
+        std::vector<ParticleSeed> actual = emitter.Sample(mt);
+        ASSERT_EQ(actual.size(), expected.size());
+        for (Uint i = 0; i < actual.size(); i++) {
+            EXPECT_EQ(actual[i].pos, expected[i].pos);
+        }
+    }
+
+    settings.Seed = 43;
+    std::vector<ParticleSeed> reseeded = SphereEmitter(Vec3(5.0, 5.0, 5.0), 2.0, settings).Sample(single);
+    EXPECT_NE(reseeded[0].pos, expected[0].pos);
+}
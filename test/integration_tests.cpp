@@ -3,9 +3,571 @@
 
 #include <iostream>
 #include <vector>
+#include <cstdio>
+#include <stdexcept>
 
 #include "ParticleSystem.hpp"
+#include "Multithread.hpp"
+
+#include <limits>
+#include <memory>
+#include <thread>
+
+namespace
+{
+    // The scene the comparisons below run in different configurations: a block of snow falling
+    // to the floor and one thrown down next to it, each n^3 particles half a cell apart
+    std::unique_ptr<CPUSolver> makeTwoBlocks(const SimulationParameters& params, const IVec3& gridDims, int n)
+    {
+        std::unique_ptr<CPUSolver> solver(new CPUSolver(gridDims, 0.001, params));
+        const Float offset = 0.5 * n + 0.5;
+        for (int x = 0; x < n; x++) {
+            for (int y = 0; y < n; y++) {
+                for (int z = 0; z < n; z++) {
+                    solver->AddParticle(Vec3(3.0 + x * 0.5, 5.0 + y * 0.5, 0.25 + z * 0.5), Vec3(0.0), 1.0);
+                    solver->AddParticle(Vec3(3.0 + offset + x * 0.5, 5.0 + y * 0.5, 3.0 + z * 0.5), Vec3(5.0, 0.0, -10.0), 1.0);
+                }
+            }
+        }
+        return solver;
+    }
+
+    // Compares every run against the first one particle by particle, bitwise unless tolerances
+    // are given
+    void expectSameParticles(const std::vector<std::vector<Particle>>& runs, Float posTolerance = 0.0, Float velocityTolerance = 0.0)
+    {
+        for (Uint r = 1; r < runs.size(); r++) {
+            ASSERT_EQ(runs[r].size(), runs[0].size());
+            for (Uint i = 0; i < runs[0].size(); i++) {
+                const Particle& actual = runs[r][i];
+                const Particle& expected = runs[0][i];
+                if (posTolerance == 0.0 && velocityTolerance == 0.0) {
+                    EXPECT_EQ(actual.pos, expected.pos) << "run " << r << ", particle " << i;
+                    EXPECT_EQ(actual.velocity, expected.velocity) << "run " << r << ", particle " << i;
+                    EXPECT_EQ(actual.m_F_e, expected.m_F_e) << "run " << r << ", particle " << i;
+                } else {
+                    EXPECT_LT(glm::length(Vec3(actual.pos) - Vec3(expected.pos)), posTolerance) << "run " << r << ", particle " << i;
+                    EXPECT_LT(glm::length(Vec3(actual.velocity) - Vec3(expected.velocity)), velocityTolerance) << "run " << r << ", particle " << i;
+                }
+            }
+        }
+    }
+}
 
 TEST(IntegrationTests, Basic) {
 
-}
\ No newline at end of file
+}
+
+// A resting block of snow goes to sleep while a moving one far away stays awake
+TEST(IntegrationTests, RestingSnowSleeps) {
+    SimulationParameters params;
+    params.GRAVITY = 0.0;
+    params.SLEEPING = true;
+    params.SLEEP_SUBSTEPS = 5;
+
+    // 10 substeps per frame
+    CPUSolver solver(IVec3(32, 16, 16), 0.001, params);
+
+    for (int x = 0; x < 6; x++) {
+        for (int y = 0; y < 6; y++) {
+            for (int z = 0; z < 6; z++) {
+                solver.AddParticle(Vec3(4.0 + x * 0.5, 6.0 + y * 0.5, 6.0 + z * 0.5), Vec3(0.0), 1.0);
+                solver.AddParticle(Vec3(24.0 + x * 0.5, 6.0 + y * 0.5, 6.0 + z * 0.5), Vec3(5.0, 0.0, 0.0), 1.0);
+            }
+        }
+    }
+
+    solver.NextFrame();
+
+    const SolverStats& stats = solver.GetStats();
+    EXPECT_EQ(stats.NumParticles, 432u);
+    EXPECT_EQ(stats.SleepingParticles, 216u);
+    EXPECT_DOUBLE_EQ(stats.SleepingFraction, 0.5);
+
+    std::shared_ptr<SimulationOutput> output = solver.GetOutput();
+    for (const Particle& p : output->GetParticles()) {
+        EXPECT_EQ(p.asleep, p.pos.x < 16.0);
+    }
+}
+
+// The sleeping blocks add their cached sums to the grid instead of their particles, which still
+// puts all of the mass and momentum on the grid
+TEST(IntegrationTests, SleepingBlocksKeepTheirGridContribution) {
+    for (P2GMode mode : { P2GMode::Scatter, P2GMode::Gather, P2GMode::Partitioned }) {
+        SimulationParameters params;
+        params.GRAVITY = 0.0;
+        params.NUM_THREADS = 3;
+        params.P2G_MODE = mode;
+        params.DIAGNOSTICS = true;
+        params.SLEEPING = true;
+        params.SLEEP_SUBSTEPS = 5;
+
+        CPUSolver solver(IVec3(32, 16, 16), 0.001, params);
+        for (int x = 0; x < 6; x++) {
+            for (int y = 0; y < 6; y++) {
+                for (int z = 0; z < 6; z++) {
+                    solver.AddParticle(Vec3(4.0 + x * 0.5, 6.0 + y * 0.5, 6.0 + z * 0.5), Vec3(0.0), 1.0);
+                    solver.AddParticle(Vec3(24.0 + x * 0.5, 6.0 + y * 0.5, 6.0 + z * 0.5), Vec3(5.0, 0.0, 0.0), 1.0);
+                }
+            }
+        }
+
+        solver.NextFrame();
+        solver.NextFrame();
+
+        const SolverStats& stats = solver.GetStats();
+        EXPECT_EQ(stats.SleepingParticles, 216u);
+        EXPECT_NEAR(stats.Diagnostics.Grid.Mass, stats.Diagnostics.ParticlesBefore.Mass, 1e-9 * stats.Diagnostics.ParticlesBefore.Mass);
+        EXPECT_LT(glm::length(stats.Diagnostics.Grid.Momentum - stats.Diagnostics.ParticlesBefore.Momentum), 1e-9);
+    }
+}
+
+// Particles decide to sleep after they moved, so the ones crossing into another block in the
+// substep they fall asleep in need their weights recomputed at the new position - otherwise their
+// stencil reaches outside their block's sum
+TEST(IntegrationTests, ParticlesFallAsleepAcrossBlockBoundaries) {
+    SimulationParameters params;
+    params.GRAVITY = 0.0;
+    params.NUM_THREADS = 3;
+    params.DIAGNOSTICS = true;
+    params.SLEEPING = true;
+    params.SLEEP_SUBSTEPS = 1;
+    params.SLEEP_BLOCK_SIZE = 4;
+
+    // Slow enough to sleep right away, fast enough to cross the block faces at x = 4 and x = 8
+    // (from below and from above) in the first substep
+    const Float speed = 0.5 * params.SLEEP_VELOCITY;
+    const Float gap = 0.1 * speed * 1e-4;
+    CPUSolver solver(IVec3(16, 16, 16), 0.001, params);
+    for (Float y : { 0.25, 0.75, 6.25, 6.75 }) {
+        for (Float z : { 0.25, 0.75, 6.25, 6.75 }) {
+            solver.AddParticle(Vec3(4.0 - gap, y, z), Vec3(speed, 0.0, 0.0), 1.0);
+            solver.AddParticle(Vec3(8.0 + gap, y, z), Vec3(-speed, 0.0, 0.0), 1.0);
+        }
+    }
+
+    solver.NextFrame();
+
+    const SolverStats& stats = solver.GetStats();
+    EXPECT_EQ(stats.SleepingParticles, 32u);
+    EXPECT_NEAR(stats.Diagnostics.Grid.Mass, stats.Diagnostics.ParticlesBefore.Mass, 1e-9 * stats.Diagnostics.ParticlesBefore.Mass);
+
+    std::shared_ptr<SimulationOutput> output = solver.GetOutput();
+    for (const Particle& p : output->GetParticles()) {
+        EXPECT_TRUE(p.asleep);
+        EXPECT_EQ(p.stencil.base, IVec3(glm::floor(Vec3(p.pos) / params.H)) - IVec3(1)) << "particle at " << p.pos.x;
+    }
+}
+
+// A restored checkpoint carries on exactly where the original solver was - the state recomputed
+// from the checkpointed fields is bitwise the same (single precision builds round F_e before the
+// rotation is recomputed from it, so they only stay close)
+TEST(IntegrationTests, CheckpointRoundTrip) {
+    SimulationParameters params;
+    params.DETERMINISTIC = true;
+    params.SLEEPING = true;
+    const std::string path = "checkpoint_roundtrip_test.snowckpt";
+
+    CPUSolver solver(IVec3(16, 16, 16), 0.001, params);
+    for (int x = 0; x < 5; x++) {
+        for (int y = 0; y < 5; y++) {
+            for (int z = 0; z < 5; z++) {
+                solver.AddParticle(Vec3(6.0 + x * 0.5, 6.0 + y * 0.5, 6.0 + z * 0.5), Vec3(1.0, 0.0, -2.0), 1.0);
+            }
+        }
+    }
+
+    solver.NextFrame();
+    solver.Checkpoint(path);
+    solver.WaitForCheckpoint();
+
+    std::unique_ptr<CPUSolver> restored = CPUSolver::FromCheckpoint(path);
+    std::remove(path.c_str());
+
+    EXPECT_EQ(restored->GetStats().StepNum, solver.GetStats().StepNum);
+
+    solver.NextFrame();
+    restored->NextFrame();
+
+    std::shared_ptr<SimulationOutput> expected = solver.GetOutput();
+    std::shared_ptr<SimulationOutput> actual = restored->GetOutput();
+    ASSERT_EQ(expected->GetParticles().size(), actual->GetParticles().size());
+
+    for (Uint i = 0; i < expected->GetParticles().size(); i++) {
+        const Particle& a = expected->GetParticles()[i];
+        const Particle& b = actual->GetParticles()[i];
+#ifdef SNOW_FLOAT_PARTICLES
+        EXPECT_LT(glm::length(Vec3(a.pos) - Vec3(b.pos)), 1e-6);
+        EXPECT_NEAR(a.m_F_e[0][0], b.m_F_e[0][0], 1e-5);
+#else
+        EXPECT_EQ(a.pos, b.pos);
+        EXPECT_EQ(a.velocity, b.velocity);
+        EXPECT_EQ(a.m_F_e, b.m_F_e);
+        EXPECT_EQ(a.m_F_p, b.m_F_p);
+        EXPECT_EQ(a.stress, b.stress);
+#endif
+        EXPECT_EQ(a.volume, b.volume);
+        EXPECT_EQ(a.asleep, b.asleep);
+    }
+}
+
+TEST(IntegrationTests, CheckpointRejectsOtherFiles) {
+    const std::string path = "checkpoint_garbage_test.snowckpt";
+    FILE* f = std::fopen(path.c_str(), "wb");
+    std::fputs("definitely not a checkpoint, but long enough to hold a header .........................................................................................................................................................................", f);
+    std::fclose(f);
+
+    EXPECT_THROW(CPUSolver::FromCheckpoint(path), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+// Deterministic mode gives bitwise identical particles (and diagnostics) for any number of threads
+TEST(IntegrationTests, DeterministicAcrossThreadCounts) {
+    std::vector<std::vector<Particle>> results;
+    std::vector<StepDiagnostics> diagnostics;
+
+    for (Uint threads : { 1, 3, 8 }) {
+        SimulationParameters params;
+        params.DETERMINISTIC = true;
+        params.DIAGNOSTICS = true;
+        params.NUM_THREADS = threads;
+
+        CPUSolver solver(IVec3(16, 16, 16), 0.001, params);
+        for (int x = 0; x < 7; x++) {
+            for (int y = 0; y < 7; y++) {
+                for (int z = 0; z < 7; z++) {
+                    solver.AddParticle(Vec3(5.0 + x * 0.5, 5.0 + y * 0.5, 3.0 + z * 0.5), Vec3(10.0, -5.0, -20.0), 1.0);
+                }
+            }
+        }
+
+        // Long enough to hit the floor
+        for (int frame = 0; frame < 3; frame++) {
+            solver.NextFrame();
+        }
+
+        std::shared_ptr<SimulationOutput> output = solver.GetOutput();
+        results.push_back(output->GetParticles());
+        diagnostics.push_back(solver.GetStats().Diagnostics);
+    }
+
+    for (Uint r = 1; r < results.size(); r++) {
+        ASSERT_EQ(results[r].size(), results[0].size());
+        for (Uint i = 0; i < results[0].size(); i++) {
+            EXPECT_EQ(results[r][i].pos, results[0][i].pos);
+            EXPECT_EQ(results[r][i].velocity, results[0][i].velocity);
+            EXPECT_EQ(results[r][i].m_F_e, results[0][i].m_F_e);
+        }
+
+        for (auto member : { &StepDiagnostics::ParticlesBefore, &StepDiagnostics::Grid, &StepDiagnostics::ParticlesAfter }) {
+            const DiagnosticSums& a = diagnostics[r].*member;
+            const DiagnosticSums& b = diagnostics[0].*member;
+            EXPECT_EQ(a.Mass, b.Mass);
+            EXPECT_EQ(a.Momentum, b.Momentum);
+            EXPECT_EQ(a.KineticEnergy, b.KineticEnergy);
+            EXPECT_EQ(a.ElasticEnergy, b.ElasticEnergy);
+            EXPECT_EQ(a.MaxSpeed, b.MaxSpeed);
+        }
+    }
+}
+
+// The transfers keep mass and momentum, and the grid never ends up with more kinetic energy
+// than the particles had
+TEST(IntegrationTests, DiagnosticsTrackTransfers) {
+    SimulationParameters params;
+    params.DIAGNOSTICS = true;
+    params.NUM_THREADS = 3;
+
+    CPUSolver solver(IVec3(16, 16, 16), 0.002, params);
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 8; y++) {
+            for (int z = 0; z < 8; z++) {
+                solver.AddParticle(Vec3(5.0 + x * 0.5, 5.0 + y * 0.5, 0.25 + z * 0.5), Vec3(1.0, 0.5, -3.0), 0.5);
+            }
+        }
+    }
+
+    std::vector<StepDiagnostics> steps;
+    solver.SetStepCallback([&](const SolverStats& stats) { steps.push_back(stats.Diagnostics); });
+    solver.NextFrame();
+    ASSERT_EQ(steps.size(), 20u);
+
+    // Nothing is deformed yet and everything moves the same way
+    const DiagnosticSums& first = steps[0].ParticlesBefore;
+    EXPECT_DOUBLE_EQ(first.Mass, 256.0);
+    EXPECT_NEAR(first.Momentum.z, -768.0, 1e-9);
+    EXPECT_NEAR(first.KineticEnergy, 0.5 * 256.0 * 10.25, 1e-9);
+    EXPECT_DOUBLE_EQ(first.MaxSpeed, std::sqrt(10.25));
+    EXPECT_EQ(first.ElasticEnergy, 0.0);
+
+    for (const StepDiagnostics& step : steps) {
+        EXPECT_NEAR(step.Grid.Mass, step.ParticlesBefore.Mass, 1e-9);
+        for (int a = 0; a < 3; a++) {
+            EXPECT_NEAR(step.Grid.Momentum[a], step.ParticlesBefore.Momentum[a], 1e-9);
+        }
+        EXPECT_LE(step.Grid.KineticEnergy, step.ParticlesBefore.KineticEnergy + 1e-9);
+        EXPECT_EQ(step.ParticlesAfter.Mass, step.ParticlesBefore.Mass);
+    }
+
+    // The block is thrown onto the floor, which squashes it and slows it down
+    EXPECT_GT(steps.back().ParticlesAfter.ElasticEnergy, 0.0);
+    EXPECT_LT(steps.back().ParticlesAfter.Momentum.z, 0.0);
+    EXPECT_GT(steps.back().ParticlesAfter.Momentum.z, -768.0);
+}
+
+// The validation sweep finds the first particle that went NaN/Inf
+TEST(IntegrationTests, FindsInvalidParticles) {
+    SimulationParameters params;
+    ParticleSystem ps(params);
+    MTIterator mt(3);
+    for (int i = 0; i < 100; i++) {
+        ps.AddParticle(Vec3(1.0 + 0.1 * i, 2.0, 3.0), Vec3(0.0, -1.0, 0.0), 1.0);
+    }
+    EXPECT_EQ(ps.FindInvalidParticle(mt), 100u);
+
+    ps.GetParticles()[70].m_F_e[1][2] = std::numeric_limits<Float>::quiet_NaN();
+    EXPECT_EQ(ps.FindInvalidParticle(mt), 70u);
+
+    ps.GetParticles()[20].velocity.y = -std::numeric_limits<Float>::infinity();
+    EXPECT_EQ(ps.FindInvalidParticle(mt), 20u);
+}
+
+// Every phase of the substeps is timed, the hardware counters are either summed over the worker
+// threads or reported as unavailable
+TEST(IntegrationTests, PhaseStatsCoverSubsteps) {
+    auto run = [](Uint threads) {
+        SimulationParameters params;
+        params.NUM_THREADS = threads;
+        params.PERF_COUNTERS = true;
+        CPUSolver solver(IVec3(16, 16, 16), 0.002, params);
+        for (int x = 0; x < 8; x++) {
+            for (int y = 0; y < 8; y++) {
+                for (int z = 0; z < 8; z++) {
+                    solver.AddParticle(Vec3(5.0 + x * 0.5, 5.0 + y * 0.5, 0.25 + z * 0.5), Vec3(0.0), 0.5);
+                }
+            }
+        }
+        solver.NextFrame();
+        return solver.GetStats();
+    };
+
+    const SolverStats single = run(1);
+    for (SolverPhase phase : { SolverPhase::Weights, SolverPhase::Rasterize, SolverPhase::Volumes, SolverPhase::GridForces,
+                               SolverPhase::DeformationUpdate, SolverPhase::ParticleVelocities, SolverPhase::Positions }) {
+        EXPECT_GT(single.Phases[Uint(phase)].Seconds, 0.0) << SolverPhaseName(phase);
+    }
+
+    const Uint instructions = Uint(PerfCounter::Instructions);
+    const Uint deformation = Uint(SolverPhase::DeformationUpdate);
+    for (Uint c = 0; c < PerfCounters::NUM_COUNTERS; c++) {
+        if (!single.CountersAvailable[c]) {
+            EXPECT_EQ(single.Phases[deformation].Counters[c], 0u) << PerfCounters::CounterName(PerfCounter(c));
+        }
+    }
+    if (!single.CountersAvailable[instructions]) {
+        return;
+    }
+
+    // The work is done by the workers either way, so splitting it up barely changes the count
+    const SolverStats split = run(4);
+    EXPECT_GT(single.Phases[deformation].Counters[instructions], 0u);
+    EXPECT_GT(Float(split.Phases[deformation].Counters[instructions]), 0.8 * Float(single.Phases[deformation].Counters[instructions]));
+}
+
+// The compact weight cache multiplies the weights out in the same order as the full one, so the
+// results are bitwise the same in every transfer mode (sleeping exercises the kept stencils).
+// Single precision builds round the cached gradients, so they only stay close.
+TEST(IntegrationTests, CompactWeightCacheMatchesFull) {
+    for (P2GMode mode : { P2GMode::Scatter, P2GMode::Gather, P2GMode::Partitioned }) {
+        std::vector<std::vector<Particle>> results;
+
+        for (WeightCache cache : { WeightCache::Full, WeightCache::Compact }) {
+            SimulationParameters params;
+            params.NUM_THREADS = 1;
+            params.P2G_MODE = mode;
+            params.WEIGHT_CACHE = cache;
+            params.SLEEPING = true;
+            params.SLEEP_SUBSTEPS = 5;
+
+            std::unique_ptr<CPUSolver> solver = makeTwoBlocks(params, IVec3(16, 16, 16), 6);
+            for (int frame = 0; frame < 2; frame++) {
+                solver->NextFrame();
+            }
+
+            EXPECT_EQ(solver->GetWeightCache(), cache);
+            EXPECT_EQ(solver->GetMemoryUsage().WeightCache == 0, cache == WeightCache::Compact);
+            results.push_back(solver->GetOutput()->GetParticles());
+        }
+
+#ifdef SNOW_FLOAT_PARTICLES
+        expectSameParticles(results, 1e-5, 1e-3);
+#else
+        expectSameParticles(results);
+#endif
+    }
+}
+
+// Solvers switch to the compact weight cache when the full one doesn't fit the memory budget,
+// refuse particles (and grids) that don't fit at all, and write checkpoints without a copy
+TEST(IntegrationTests, MemoryBudgetPicksWeightCache) {
+    SimulationParameters params;
+    params.MEMORY_BUDGET_MB = 4;
+    const Uint budget = 4 * 1024 * 1024;
+    const std::string path = "memory_budget_test.snowckpt";
+
+    EXPECT_THROW(CPUSolver(IVec3(128, 128, 128), 0.001, params), std::runtime_error);
+
+    auto seeds = [](Uint count) {
+        std::vector<ParticleSeed> result;
+        for (Uint i = 0; i < count; i++) {
+            result.push_back({ Vec3(4.0 + (i % 16) * 0.5, 4.0 + (i / 16 % 16) * 0.5, 1.0 + i / 256 * 0.5), Vec3(0.0), 1.0 });
+        }
+        return result;
+    };
+
+    CPUSolver solver(IVec3(16, 16, 16), 0.001, params);
+    EXPECT_EQ(solver.GetWeightCache(), WeightCache::Full);
+
+    const std::vector<ParticleSeed> tooMany = seeds(10000);
+    EXPECT_THROW(solver.AddParticles(tooMany.data(), tooMany.size()), std::runtime_error);
+    EXPECT_EQ(solver.GetMemoryUsage().Particles, 0u);
+
+    const std::vector<ParticleSeed> fitting = seeds(4000);
+    solver.AddParticles(fitting.data(), fitting.size());
+    EXPECT_EQ(solver.GetWeightCache(), WeightCache::Compact);
+
+    solver.NextFrame();
+    const MemoryUsage usage = solver.GetMemoryUsage();
+    EXPECT_EQ(usage.WeightCache, 0u);
+    EXPECT_GT(usage.Particles, 0u);
+    EXPECT_GT(usage.GridCells, 0u);
+    EXPECT_LE(usage.Total(), budget);
+
+    // A single particle more would double the particle storage, which doesn't fit
+    EXPECT_THROW(solver.AddParticle(Vec3(2.0), Vec3(0.0), 1.0), std::runtime_error);
+    EXPECT_EQ(solver.GetMemoryUsage().Particles, usage.Particles);
+
+    // The checkpoint only copies the particle state when the copy fits next to the particles
+    // (it does with single precision particles), otherwise it's written before continuing
+    const Uint copyBytes = 4000 * sizeof(ParticleState);
+    const bool copyFits = usage.Total() + copyBytes <= budget;
+    solver.Checkpoint(path);
+    EXPECT_EQ(solver.GetMemoryUsage().Snapshots, copyFits ? copyBytes : 0u);
+    EXPECT_EQ(solver.GetOutput()->GetParticles().size(), 4000u);
+    solver.WaitForCheckpoint();
+
+    std::unique_ptr<CPUSolver> restored = CPUSolver::FromCheckpoint(path);
+    std::remove(path.c_str());
+    EXPECT_EQ(restored->GetWeightCache(), WeightCache::Compact);
+    ASSERT_EQ(restored->GetOutput()->GetParticles().size(), 4000u);
+    EXPECT_EQ(restored->GetOutput()->GetParticles()[1234].pos, solver.GetOutput()->GetParticles()[1234].pos);
+}
+
+// Huge pages only change where the arrays live, the results stay bitwise the same (Reserved falls
+// back to transparent huge pages when the system has none reserved)
+TEST(IntegrationTests, HugePagesMatchRegularPages) {
+    std::vector<std::vector<Particle>> results;
+
+    for (HugePages pages : { HugePages::Off, HugePages::Transparent, HugePages::Reserved }) {
+        SimulationParameters params;
+        params.DETERMINISTIC = true;
+        params.NUM_THREADS = 3;
+        params.HUGE_PAGES = pages;
+
+        // The cells and the weight cache are large enough to be mapped separately
+        std::unique_ptr<CPUSolver> solver = makeTwoBlocks(params, IVec3(48, 16, 16), 10);
+        EXPECT_GE(Grid::EstimateCellBytes(IVec3(48, 16, 16)), HUGE_PAGE_SIZE);
+
+        solver->NextFrame();
+        EXPECT_GE(solver->GetMemoryUsage().WeightCache, HUGE_PAGE_SIZE);
+        results.push_back(solver->GetOutput()->GetParticles());
+    }
+    expectSameParticles(results);
+
+#ifdef __linux__
+    // Separate mappings start on a huge page boundary
+    void* memory = AllocateLarge(3 * HUGE_PAGE_SIZE + 100, HugePages::Transparent, 2);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(memory) % HUGE_PAGE_SIZE, 0u);
+    static_cast<char*>(memory)[3 * HUGE_PAGE_SIZE + 99] = 1;
+    FreeLarge(memory, 3 * HUGE_PAGE_SIZE + 100, HugePages::Transparent);
+#endif
+}
+
+// The workers' pages are the ones whose first byte is in their chunk, for the split of
+// IterateOverChunks as well as of IterateOverVector, so first touch and PlaceOnWorkerNodes put
+// every page on the node of the worker processing it
+TEST(IntegrationTests, WorkerPagesMatchTheChunks) {
+    const NumaTopology& topology = NumaTopology::Get();
+    ASSERT_GE(topology.NumNodes(), 1u);
+
+    for (Uint threads : { 1, 3, 8, 12 }) {
+        // Workers are spread over the nodes in contiguous blocks, starting at the first one
+        EXPECT_EQ(topology.WorkerNode(0, threads), 0u);
+        for (Uint t = 1; t < threads; t++) {
+            const Uint node = topology.WorkerNode(t, threads);
+            const Uint previous = topology.WorkerNode(t - 1, threads);
+            EXPECT_TRUE(node == previous || node == previous + 1);
+            EXPECT_LT(node, topology.NumNodes());
+        }
+
+        for (Uint count : { 1, 1000, 4097, 100003 }) {
+            MTIterator mt(threads);
+            std::vector<std::thread::id> worker(count);
+            mt.IterateOverVector(worker, [](std::thread::id& id) { id = std::this_thread::get_id(); });
+            std::vector<Uint> chunkLow(threads), chunkHigh(threads);
+            mt.IterateOverChunks(count, [&](Uint low, Uint high, Uint threadIdx) {
+                chunkLow[threadIdx] = low;
+                chunkHigh[threadIdx] = high;
+            });
+
+            for (Uint t = 0; t < threads; t++) {
+                Uint low, high;
+                MTIterator::ChunkRange(count, threads, t, low, high);
+                EXPECT_EQ(low, chunkLow[t]);
+                EXPECT_EQ(high, chunkHigh[t]);
+                for (Uint i = low; i < high; i++) {
+                    EXPECT_EQ(worker[i], worker[low]) << "element " << i << " of chunk " << t;
+                }
+            }
+
+            for (Uint elementSize : { Uint(1), Uint(24), Uint(sizeof(Particle)), Uint(sizeof(StencilCache)) }) {
+                Uint nextPage = 0;
+                for (Uint t = 0; t < threads; t++) {
+                    Uint low, high;
+                    MTIterator::ChunkRange(count, threads, t, low, high);
+                    const PageRange pages = WorkerPages(elementSize, count, t, threads);
+                    EXPECT_EQ(pages.First, nextPage);
+                    for (Uint page = pages.First; page < pages.End; page++) {
+                        const Uint element = page * SMALL_PAGE_SIZE / elementSize;
+                        EXPECT_TRUE(element >= low && element < high) << "page " << page << " of worker " << t;
+                    }
+                    nextPage = std::max(nextPage, pages.End);
+                }
+                EXPECT_EQ(nextPage, (count * elementSize + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE);
+            }
+        }
+    }
+}
+
+// A vector that grew holds its elements in the first half of its capacity, which the first touch
+// gave to the first half of the workers - PlaceOnWorkerNodes moves every worker's chunk to its node
+TEST(IntegrationTests, NumaPlacementFollowsTheWorkers) {
+    const NumaTopology& topology = NumaTopology::Get();
+    if (topology.NumNodes() < 2) {
+        GTEST_SKIP() << "single NUMA node";
+    }
+
+    const Uint threads = 2 * topology.NumNodes();
+    std::vector<StencilCache, HugePageAllocator<StencilCache>> grown(HugePageAllocator<StencilCache>(HugePages::Off, threads, true));
+    grown.reserve(2 * threads * HUGE_PAGE_SIZE / sizeof(StencilCache));
+    grown.resize(grown.capacity() / 2);
+    PlaceOnWorkerNodes(grown, threads);
+
+    for (Uint t = 0; t < threads; t++) {
+        const PageRange pages = WorkerPages(sizeof(StencilCache), grown.size(), t, threads);
+        for (Uint page = pages.First; page < pages.End; page++) {
+            const char* address = reinterpret_cast<const char*>(grown.data()) + page * SMALL_PAGE_SIZE;
+            EXPECT_EQ(topology.PageNode(address), int(topology.WorkerNode(t, threads))) << "page " << page << " of worker " << t;
+        }
+    }
+}
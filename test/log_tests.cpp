@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+#include "Log.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Restores the process wide log settings after a test
+    struct LogSettings
+    {
+        LogSettings() : mLevel(Log::GetLevel())
+        {
+            Log::SetConsoleLevel(LogLevel::Off);
+        }
+
+        ~LogSettings()
+        {
+            Log::SetLevel(mLevel);
+            Log::SetConsoleLevel(LogLevel::Info);
+        }
+
+        LogLevel mLevel;
+    };
+
+    int countTagged(const std::vector<Log::Record>& records, const std::string& tag)
+    {
+        int count = 0;
+        for (const Log::Record& r : records) {
+            count += r.Message.compare(0, tag.size(), tag) == 0;
+        }
+        return count;
+    }
+}
+
+TEST(LogTests, FiltersByLevel) {
+    LogSettings settings;
+    Log::SetLevel(LogLevel::Info);
+
+    int formatted = 0;
+    auto expensive = [&]() { formatted++; return 42; };
+
+    LOG_DEBUG("filter-test debug " << expensive());
+    LOG_INFO("filter-test info " << expensive());
+    LOG_ERROR("filter-test error " << expensive());
+
+    // Disabled records aren't even formatted
+    EXPECT_EQ(formatted, 2);
+
+    std::vector<Log::Record> records = Log::Recent();
+    ASSERT_GE(records.size(), 2u);
+    EXPECT_EQ(records[records.size() - 2].Message, "filter-test info 42");
+    EXPECT_EQ(records[records.size() - 2].Level, LogLevel::Info);
+    EXPECT_EQ(records.back().Message, "filter-test error 42");
+    EXPECT_EQ(records.back().Level, LogLevel::Error);
+    EXPECT_LE(records[records.size() - 2].Time, records.back().Time);
+}
+
+TEST(LogTests, RingKeepsNewestRecords) {
+    LogSettings settings;
+    Log::SetLevel(LogLevel::Info);
+
+    for (Uint i = 0; i < Log::RING_SIZE + 100; i++) {
+        LOG_INFO("ring-test " << i);
+    }
+    LOG_INFO("ring-test long " << std::string(2 * Log::MAX_MESSAGE, 'x'));
+
+    std::vector<Log::Record> records = Log::Recent();
+    ASSERT_EQ(records.size(), Log::RING_SIZE);
+    EXPECT_EQ(records.front().Message, "ring-test 101");
+    EXPECT_EQ(records[records.size() - 2].Message, "ring-test " + std::to_string(Log::RING_SIZE + 99));
+    EXPECT_EQ(records.back().Message.size(), Log::MAX_MESSAGE);
+}
+
+TEST(LogTests, ConcurrentWritersDontLoseRecords) {
+    LogSettings settings;
+    Log::SetLevel(LogLevel::Info);
+
+    const int numThreads = 4;
+    const int perThread = 500; // All of them fit into the ring
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < perThread; i++) {
+                LOG_INFO("concurrent-test " << t << " " << i);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<Log::Record> records = Log::Recent();
+    EXPECT_EQ(countTagged(records, "concurrent-test "), numThreads * perThread);
+    for (int t = 0; t < numThreads; t++) {
+        EXPECT_EQ(countTagged(records, "concurrent-test " + std::to_string(t) + " "), perThread);
+    }
+}
+
+TEST(LogTests, ProgressIsRateLimited) {
+    LogSettings settings;
+    Log::SetLevel(LogLevel::Info);
+
+    ProgressReporter everyCall(0.0);
+    everyCall.Start(0, 100, 10);
+    everyCall.Update(50);
+    std::vector<Log::Record> records = Log::Recent();
+    EXPECT_EQ(records.back().Message.compare(0, 17, "frame 5/10 (50%),"), 0) << records.back().Message;
+
+    // The ring is full by now, so new records would replace old ones rather than add to its size
+    ProgressReporter hourly(3600.0);
+    hourly.Start(0, 100, 10);
+    const int before = countTagged(Log::Recent(), "frame ");
+    for (Uint step = 0; step < 100; step++) {
+        hourly.Update(step);
+    }
+    records = Log::Recent();
+    EXPECT_EQ(countTagged(records, "frame "), before);
+    EXPECT_EQ(records.back().Message.compare(0, 17, "frame 5/10 (50%),"), 0) << records.back().Message;
+}
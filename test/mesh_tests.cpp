@@ -0,0 +1,162 @@
+#include "gtest/gtest.h"
+#include "Mesh.hpp"
+#include "MeshVolume.hpp"
+#include "MeshBVH.hpp"
+#include "Emitter.hpp"
+#include "Multithread.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // Closed UV sphere with outward facing triangles
+    Mesh MakeSphere(const Vec3& center, Float radius, int rings, int segments)
+    {
+        const Float pi = 3.14159265358979323846;
+        auto point = [&](int ring, int segment) {
+            Float theta = pi * Float(ring) / Float(rings);
+            Float phi = 2.0 * pi * Float(segment % segments) / Float(segments);
+            return center + radius * Vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+        };
+
+        std::vector<Triangle> triangles;
+        for (int r = 0; r < rings; r++) {
+            for (int s = 0; s < segments; s++) {
+                if (r > 0) {
+                    triangles.push_back({ point(r, s), point(r + 1, s), point(r, s + 1) });
+                }
+                if (r < rings - 1) {
+                    triangles.push_back({ point(r, s + 1), point(r + 1, s), point(r + 1, s + 1) });
+                }
+            }
+        }
+        return Mesh(triangles);
+    }
+}
+
+TEST(MeshTests, LoadsObj) {
+    const std::string path = "mesh_test_cube.obj";
+    {
+        std::ofstream obj(path);
+        obj << "v 0 0 0\nv 2 0 0\nv 2 2 0\nv 0 2 0\nv 0 0 2\nv 2 0 2\nv 2 2 2\nv 0 2 2\n"
+            << "f 1 4 3 2\nf 5 6 7 8\nf 1 2 6 5\nf 2 3 7 6\nf 3 4 8 7\nf 4 1 5 8\n";
+    }
+
+    Mesh mesh(path);
+    std::remove(path.c_str());
+
+    EXPECT_EQ(mesh.Triangles().size(), 12u);
+    EXPECT_EQ(mesh.Min(), Vec3(0.0));
+    EXPECT_EQ(mesh.Max(), Vec3(2.0));
+
+    MTIterator mt(2);
+    MeshVolume volume(mesh, 0.25, mt);
+    EXPECT_EQ(volume.NumInside(), 8u * 8u * 8u);
+    EXPECT_TRUE(volume.Inside(Vec3(1.0, 1.0, 1.0)));
+    EXPECT_FALSE(volume.Inside(Vec3(3.0, 1.0, 1.0)));
+}
+
+TEST(MeshTests, MissingObjThrows) {
+    EXPECT_THROW(Mesh("does_not_exist.obj"), std::runtime_error);
+}
+
+TEST(MeshTests, VoxelizedSphereVolume) {
+    const Float radius = 4.0;
+    Mesh sphere = MakeSphere(Vec3(1.0, 2.0, 3.0), radius, 64, 128);
+
+    MTIterator mt(4);
+    const Float voxelSize = 0.125;
+    MeshVolume volume(sphere, voxelSize, mt);
+
+    const Float expected = 4.0 / 3.0 * 3.14159265358979323846 * radius * radius * radius;
+    const Float actual = Float(volume.NumInside()) * voxelSize * voxelSize * voxelSize;
+    EXPECT_NEAR(actual / expected, 1.0, 0.01);
+
+    EXPECT_TRUE(volume.Inside(Vec3(1.0, 2.0, 3.0)));
+    EXPECT_FALSE(volume.Inside(Vec3(1.0 + 0.9 * radius, 2.0 + 0.9 * radius, 3.0)));
+}
+
+TEST(MeshTests, PoissonDiskSamplingInsideMesh) {
+    Mesh sphere = MakeSphere(Vec3(5.0), 3.0, 32, 64);
+    MTIterator mt(3);
+    MeshVolume volume(sphere, 0.1, mt);
+
+    EmitterSettings settings;
+    settings.Sampling = EmitterSampling::PoissonDisk;
+    settings.Spacing = 0.5;
+    settings.Seed = 7;
+    MeshEmitter emitter(volume, settings);
+
+    std::vector<ParticleSeed> seeds = emitter.Sample(mt);
+    ASSERT_GT(seeds.size(), 100u);
+
+    for (Uint i = 0; i < seeds.size(); i++) {
+        EXPECT_TRUE(volume.Inside(seeds[i].pos));
+        for (Uint j = i + 1; j < seeds.size(); j++) {
+            ASSERT_GE(glm::length(seeds[i].pos - seeds[j].pos), settings.Spacing);
+        }
+    }
+
+    MTIterator single(1);
+    std::vector<ParticleSeed> serial = emitter.Sample(single);
+    ASSERT_EQ(serial.size(), seeds.size());
+    for (Uint i = 0; i < seeds.size(); i++) {
+        EXPECT_EQ(serial[i].pos, seeds[i].pos);
+    }
+}
+
+TEST(MeshTests, BVHClosestPointMatchesBruteForce) {
+    Mesh sphere = MakeSphere(Vec3(0.5, -1.0, 2.0), 3.0, 24, 48);
+    MTIterator mt(4);
+    MeshBVH bvh(sphere, mt);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<Float> coord(-6.0, 6.0);
+    for (int q = 0; q < 200; q++) {
+        const Vec3 pos(coord(rng), coord(rng), coord(rng));
+
+        Float expected = std::numeric_limits<Float>::infinity();
+        for (const Triangle& t : sphere.Triangles()) {
+            // Dense sampling of the triangle is close enough for a reference
+            for (int i = 0; i <= 16; i++) {
+                for (int j = 0; i + j <= 16; j++) {
+                    const Vec3 p = t.v1 + (t.v2 - t.v1) * (i / 16.0) + (t.v3 - t.v1) * (j / 16.0);
+                    expected = std::min(expected, glm::length(p - pos));
+                }
+            }
+        }
+
+        MeshBVH::ClosestHit hit = bvh.ClosestPoint(pos);
+        EXPECT_LE(hit.Distance, expected + 1e-9);
+        EXPECT_NEAR(hit.Distance, expected, 0.02);
+        EXPECT_NEAR(glm::length(hit.Point - pos), hit.Distance, 1e-9);
+    }
+}
+
+TEST(MeshTests, BVHInsideMatchesVoxelization) {
+    Mesh sphere = MakeSphere(Vec3(2.0), 2.5, 64, 128);
+    MTIterator mt(3);
+    MeshBVH bvh(sphere, mt);
+    MeshVolume volume(sphere, 0.1, mt);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<Float> coord(-1.0, 5.0);
+    int mismatches = 0;
+    for (int q = 0; q < 2000; q++) {
+        const Vec3 pos(coord(rng), coord(rng), coord(rng));
+        // Away from the surface both tests have to agree exactly
+        if (std::abs(glm::length(pos - Vec3(2.0)) - 2.5) > 0.2) {
+            mismatches += bvh.Inside(pos) != volume.Inside(pos) ? 1 : 0;
+        }
+    }
+    EXPECT_EQ(mismatches, 0);
+
+    // The tree doesn't depend on the number of threads used to build it
+    MTIterator single(1);
+    MeshBVH serial(sphere, single);
+    EXPECT_EQ(serial.NumNodes(), bvh.NumNodes());
+}
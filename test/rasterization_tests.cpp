@@ -1,6 +1,8 @@
 #include "gtest/gtest.h"
 #include "CPUSolver.hpp"
 #include "Math.hpp"
+#include "Grid.hpp"
+#include "Multithread.hpp"
 
 #include <iostream>
 
@@ -25,4 +27,180 @@ TEST(IntegrationTests, ConstantEnergy) {
               << matdiff[0][1] << " " << matdiff[1][1] << " " << matdiff[2][1] << std::endl
               << matdiff[0][2] << " " << matdiff[1][2] << " " << matdiff[2][2] << std::endl;
      
-}
\ No newline at end of file
+}
+
+// Both P2G engines have to produce the same grid
+TEST(RasterizationTests, GatherMatchesScatter) {
+    SimulationParameters scatterParams;
+    scatterParams.P2G_MODE = P2GMode::Scatter;
+    SimulationParameters gatherParams;
+    gatherParams.P2G_MODE = P2GMode::Gather;
+
+    const IVec3 dims(12, 10, 8);
+    Grid scatterGrid(scatterParams, dims);
+    Grid gatherGrid(gatherParams, dims);
+    ParticleSystem ps(scatterParams);
+    MTIterator mt(4);
+
+    // Some particles sit on the border so that part of their kernel falls outside the grid
+    for (Uint i = 0; i < 500; i++) {
+        Vec3 pos(
+            Float((i * 37) % 120) / 10.0,
+            Float((i * 53) % 100) / 10.0,
+            Float((i * 71) % 80) / 10.0
+        );
+        ps.AddParticle(pos, Vec3(Float(i % 7), -1.0, 0.5), 1.0 + Float(i % 3));
+    }
+
+    ps.CacheParticleGrads(scatterGrid, mt);
+    scatterGrid.RasterizeParticlesToGrid(ps, mt);
+    gatherGrid.RasterizeParticlesToGrid(ps, mt);
+
+    for (int i = 0; i < dims.x; i++) {
+        for (int j = 0; j < dims.y; j++) {
+            for (int k = 0; k < dims.z; k++) {
+                const Cell& a = scatterGrid.Get(i, j, k);
+                const Cell& b = gatherGrid.Get(i, j, k);
+                EXPECT_NEAR(a.Mass, b.Mass, 1e-9);
+                EXPECT_NEAR(a.Velocity.x, b.Velocity.x, 1e-9);
+                EXPECT_NEAR(a.Velocity.y, b.Velocity.y, 1e-9);
+                EXPECT_NEAR(a.Velocity.z, b.Velocity.z, 1e-9);
+            }
+        }
+    }
+}
+
+// Partitioned transfers (lock free slab interiors plus the locked border path) and the gathers
+// produce the same mass, momentum and forces as the fully locked scatter, for any number of threads
+TEST(RasterizationTests, TransferModesMatchScatter) {
+    SimulationParameters scatterParams;
+    scatterParams.P2G_MODE = P2GMode::Scatter;
+    SimulationParameters partitionedParams;
+    partitionedParams.P2G_MODE = P2GMode::Partitioned;
+    partitionedParams.PARTITION_REBALANCE_SUBSTEPS = 1;
+    SimulationParameters gatherParams;
+    gatherParams.P2G_MODE = P2GMode::Gather;
+
+    const IVec3 dims(24, 10, 8);
+    ParticleSystem ps(scatterParams);
+
+    // Clustered on one side so the rebalanced slabs end up uneven
+    for (Uint i = 0; i < 2000; i++) {
+        Vec3 pos(
+            Float((i * 37) % 240) / 10.0 * (i % 3 == 0 ? 1.0 : 0.3),
+            Float((i * 53) % 100) / 10.0,
+            Float((i * 71) % 80) / 10.0
+        );
+        ps.AddParticle(pos, Vec3(Float(i % 7), -1.0, 0.5), 1.0 + Float(i % 3));
+    }
+    for (Uint i = 0; i < ps.GetParticles().size(); i++) {
+        Particle& p = ps.GetParticles()[i];
+        p.volume = 0.1;
+        p.stress = PMat3(1.0 + Float(i % 5), 0.5, 0.0, 0.5, 2.0, 0.25, 0.0, 0.25, Float(i % 3));
+    }
+
+    MTIterator single(1);
+    Grid scatterGrid(scatterParams, dims);
+    ps.CacheParticleGrads(scatterGrid, single);
+    scatterGrid.RasterizeParticlesToGrid(ps, single);
+    scatterGrid.ComputeGridForces(ps, single);
+
+    for (const SimulationParameters* params : { &partitionedParams, &gatherParams }) {
+        for (Uint threads : { 1, 3, 8 }) {
+            MTIterator mt(threads);
+            Grid grid(*params, dims);
+            grid.RasterizeParticlesToGrid(ps, mt);
+            grid.ComputeGridForces(ps, mt);
+
+            for (int i = -Grid::HALO; i < dims.x + Grid::HALO; i++) {
+                for (int j = -Grid::HALO; j < dims.y + Grid::HALO; j++) {
+                    for (int k = -Grid::HALO; k < dims.z + Grid::HALO; k++) {
+                        const Cell& a = scatterGrid.Get(i, j, k);
+                        const Cell& b = grid.Get(i, j, k);
+                        EXPECT_NEAR(a.Mass, b.Mass, 1e-9);
+                        EXPECT_NEAR(glm::length(a.Velocity - b.Velocity), 0.0, 1e-9);
+                        EXPECT_NEAR(glm::length(a.Force - b.Force), 0.0, 1e-9);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The polynomial stencil weights have to agree with the piecewise kernel
+TEST(RasterizationTests, StencilWeightsMatchKernel) {
+    const Vec3 positions[6] = {
+        Vec3(3.25, 4.5, 5.75),
+        Vec3(7.0, 2.0, 1.0),
+        Vec3(0.999, 10.001, 3.5),
+        Vec3(12.3, 0.2, 8.8),
+        Vec3(5.5, 5.5, 5.5),
+        Vec3(1.125, 9.875, 2.0625)
+    };
+
+    StencilWeights vectorized[4];
+    stencilWeights4(positions, vectorized);
+
+    for (Uint n = 0; n < 6; n++) {
+        const Vec3& x = positions[n];
+        StencilWeights sw;
+        stencilWeights(x, sw);
+
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                for (int k = 0; k < 4; k++) {
+                    IVec3 node = sw.base + IVec3(i, j, k);
+                    Float w = sw.w[0][i] * sw.w[1][j] * sw.w[2][k];
+                    Vec3 grad(
+                        sw.dw[0][i] * sw.w[1][j] * sw.w[2][k],
+                        sw.w[0][i] * sw.dw[1][j] * sw.w[2][k],
+                        sw.w[0][i] * sw.w[1][j] * sw.dw[2][k]
+                    );
+                    Vec3 expectedGrad = gridWeightGrad(1.0, x.x, node.x, x.y, node.y, x.z, node.z);
+
+                    EXPECT_NEAR(w, gridWeight(1.0, x.x, node.x, x.y, node.y, x.z, node.z), 1e-12);
+                    EXPECT_NEAR(grad.x, expectedGrad.x, 1e-12);
+                    EXPECT_NEAR(grad.y, expectedGrad.y, 1e-12);
+                    EXPECT_NEAR(grad.z, expectedGrad.z, 1e-12);
+                }
+            }
+        }
+
+        if (n < 4) {
+            EXPECT_EQ(vectorized[n].base, sw.base);
+            for (int axis = 0; axis < 3; axis++) {
+                for (int node = 0; node < 4; node++) {
+                    EXPECT_NEAR(vectorized[n].w[axis][node], sw.w[axis][node], 1e-15);
+                    EXPECT_NEAR(vectorized[n].dw[axis][node], sw.dw[axis][node], 1e-15);
+                }
+            }
+        }
+    }
+}
+
+// Particles on and outside the domain border rasterize into the halo without losing mass
+TEST(RasterizationTests, HaloKeepsBorderMass) {
+    SimulationParameters params;
+    const IVec3 dims(6, 6, 6);
+    Grid grid(params, dims);
+    ParticleSystem ps(params);
+    MTIterator mt(2);
+
+    ps.AddParticle(Vec3(0.0, 0.0, 0.0), Vec3(0.0), 2.0);
+    ps.AddParticle(Vec3(5.99, 3.0, 0.5), Vec3(0.0), 3.0);
+    ps.AddParticle(Vec3(-4.0, 9.0, 2.5), Vec3(0.0), 5.0); // Gets clamped back into the domain
+
+    ps.CacheParticleGrads(grid, mt);
+    grid.RasterizeParticlesToGrid(ps, mt);
+
+    Float total = 0.0;
+    for (int i = -Grid::HALO; i < dims.x + Grid::HALO; i++) {
+        for (int j = -Grid::HALO; j < dims.y + Grid::HALO; j++) {
+            for (int k = -Grid::HALO; k < dims.z + Grid::HALO; k++) {
+                total += grid.Get(i, j, k).Mass;
+            }
+        }
+    }
+
+    EXPECT_NEAR(total, 10.0, 1e-9);
+}
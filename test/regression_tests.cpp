@@ -0,0 +1,287 @@
+#include "gtest/gtest.h"
+#include "Collider.hpp"
+#include "CPUSolver.hpp"
+#include "Emitter.hpp"
+#include "Multithread.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Golden scenes.  Each scene is run for a few frames and the particles are compared against the
+// state stored in test/golden/<scene>.golden, so changes to the kernels that alter the physics show
+// up here even when the unit tests still pass.  The scenes run with DETERMINISTIC set, so the
+// particles only move away from the golden when the arithmetic changes.  A missing golden fails the
+// test; setting SNOW_UPDATE_GOLDEN=1 (re)writes all of them after an intended change to the physics.
+
+#ifndef SNOW_GOLDEN_DIR
+#define SNOW_GOLDEN_DIR "golden"
+#endif
+
+namespace
+{
+    // Positions are allowed to drift this far (in m).  The deterministic transfers take the thread
+    // count out of the result, what is left is rounding that differs between compilers and math
+    // libraries - and, with float particles, the rounding of the particle state itself.  The
+    // aggregate statistics get a tolerance relative to the scene's extent and speed.
+#ifdef SNOW_FLOAT_PARTICLES
+    const Float POSITION_TOLERANCE = 5e-5;
+    const Float VELOCITY_TOLERANCE = 2e-3;
+    const Float STATS_TOLERANCE = 1e-4;
+#else
+    const Float POSITION_TOLERANCE = 1e-8;
+    const Float VELOCITY_TOLERANCE = 1e-6;
+    const Float STATS_TOLERANCE = 1e-8;
+#endif
+
+    const char GOLDEN_MAGIC[8] = { 'S', 'N', 'O', 'W', 'G', 'O', 'L', 'D' };
+    const uint32_t GOLDEN_VERSION = 1;
+
+    struct GoldenHeader
+    {
+        char Magic[8];
+        uint32_t Version;
+        uint32_t NumFrames;
+        uint64_t NumParticles;
+    };
+
+    // What is kept of every particle
+    struct GoldenParticle
+    {
+        Float Pos[3];
+        Float Velocity[3];
+    };
+
+    struct Golden
+    {
+        uint32_t NumFrames = 0;
+        std::vector<GoldenParticle> Particles;
+    };
+
+    struct GoldenStats
+    {
+        Vec3 Centroid = Vec3(0.0);
+        Vec3 Min = Vec3(0.0);
+        Vec3 Max = Vec3(0.0);
+        Vec3 MeanVelocity = Vec3(0.0);
+        Float KineticEnergy = 0.0; // Per unit mass
+    };
+
+    std::string goldenPath(const std::string& scene)
+    {
+        return std::string(SNOW_GOLDEN_DIR) + "/" + scene + ".golden";
+    }
+
+    bool readGolden(const std::string& path, Golden& golden)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+
+        GoldenHeader header;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1;
+        ok = ok && std::memcmp(header.Magic, GOLDEN_MAGIC, sizeof(GOLDEN_MAGIC)) == 0 && header.Version == GOLDEN_VERSION;
+        if (ok) {
+            golden.NumFrames = header.NumFrames;
+            golden.Particles.resize(header.NumParticles);
+            ok = std::fread(golden.Particles.data(), sizeof(GoldenParticle), golden.Particles.size(), file) == golden.Particles.size();
+        }
+        std::fclose(file);
+
+        if (!ok) {
+            throw std::runtime_error("Golden file " + path + " is corrupt");
+        }
+        return true;
+    }
+
+    void writeGolden(const std::string& path, const Golden& golden)
+    {
+        GoldenHeader header;
+        std::memcpy(header.Magic, GOLDEN_MAGIC, sizeof(GOLDEN_MAGIC));
+        header.Version = GOLDEN_VERSION;
+        header.NumFrames = golden.NumFrames;
+        header.NumParticles = golden.Particles.size();
+
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("Could not open " + path + " for writing");
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && std::fwrite(golden.Particles.data(), sizeof(GoldenParticle), golden.Particles.size(), file) == golden.Particles.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok) {
+            throw std::runtime_error("Could not write " + path);
+        }
+    }
+
+    GoldenStats computeStats(const std::vector<GoldenParticle>& particles)
+    {
+        GoldenStats stats;
+        if (particles.empty()) {
+            return stats;
+        }
+
+        stats.Min = Vec3(particles[0].Pos[0], particles[0].Pos[1], particles[0].Pos[2]);
+        stats.Max = stats.Min;
+        for (const GoldenParticle& p : particles) {
+            const Vec3 pos(p.Pos[0], p.Pos[1], p.Pos[2]);
+            const Vec3 velocity(p.Velocity[0], p.Velocity[1], p.Velocity[2]);
+            stats.Centroid += pos;
+            stats.Min = glm::min(stats.Min, pos);
+            stats.Max = glm::max(stats.Max, pos);
+            stats.MeanVelocity += velocity;
+            stats.KineticEnergy += 0.5 * glm::dot(velocity, velocity);
+        }
+
+        const Float n = Float(particles.size());
+        stats.Centroid /= n;
+        stats.MeanVelocity /= n;
+        stats.KineticEnergy /= n;
+        return stats;
+    }
+
+    // |actual - expected| within a relative tolerance of scale (so values near zero don't need to
+    // match to the last bit)
+    void expectClose(const Vec3& actual, const Vec3& expected, Float scale, const char* what)
+    {
+        for (int a = 0; a < 3; a++) {
+            EXPECT_NEAR(actual[a], expected[a], STATS_TOLERANCE * scale) << what << " axis " << a;
+        }
+    }
+
+    // Runs the scene for numFrames frames and checks the particles against the scene's golden
+    void runScene(const std::string& scene, CPUSolver& solver, uint32_t numFrames)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < numFrames; frame++) {
+            solver.NextFrame();
+        }
+        const Float wallMs = std::chrono::duration<Float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::shared_ptr<SimulationOutput> output = solver.GetOutput();
+        const std::vector<Particle>& particles = output->GetParticles();
+
+        std::cout << "[ " << scene << " ] " << particles.size() << " particles, " << numFrames
+                  << " frames in " << wallMs << " ms" << std::endl;
+        ::testing::Test::RecordProperty("WallTimeMs", std::to_string(wallMs));
+
+        Golden actual;
+        actual.NumFrames = numFrames;
+        for (const Particle& p : particles) {
+            actual.Particles.push_back({ { p.pos.x, p.pos.y, p.pos.z }, { p.velocity.x, p.velocity.y, p.velocity.z } });
+        }
+
+        const std::string path = goldenPath(scene);
+        const char* update = std::getenv("SNOW_UPDATE_GOLDEN");
+        if (update != nullptr && std::strcmp(update, "0") != 0) {
+            writeGolden(path, actual);
+            std::cout << "[ " << scene << " ] wrote golden " << path << std::endl;
+            return;
+        }
+
+        Golden expected;
+        if (!readGolden(path, expected)) {
+            FAIL() << "missing golden " << path << " (run with SNOW_UPDATE_GOLDEN=1 to record it)";
+        }
+
+        ASSERT_EQ(expected.NumFrames, numFrames) << "golden of " << scene << " was recorded for a different run length";
+        ASSERT_EQ(expected.Particles.size(), actual.Particles.size());
+
+        const GoldenStats e = computeStats(expected.Particles);
+        const GoldenStats a = computeStats(actual.Particles);
+        const Float extent = std::max(glm::length(e.Max - e.Min), 1.0);
+        const Float speed = std::max(std::sqrt(2.0 * e.KineticEnergy), 1.0);
+        expectClose(a.Centroid, e.Centroid, extent, "centroid");
+        expectClose(a.Min, e.Min, extent, "min");
+        expectClose(a.Max, e.Max, extent, "max");
+        expectClose(a.MeanVelocity, e.MeanVelocity, speed, "mean velocity");
+        EXPECT_NEAR(a.KineticEnergy, e.KineticEnergy, STATS_TOLERANCE * speed * speed) << "kinetic energy";
+
+        // Per particle, only reporting the worst one so a broken kernel doesn't print thousands of lines
+        Float maxPosError = 0.0;
+        Float maxVelocityError = 0.0;
+        Uint worst = 0;
+        for (Uint i = 0; i < actual.Particles.size(); i++) {
+            for (int c = 0; c < 3; c++) {
+                const Float posError = std::abs(actual.Particles[i].Pos[c] - expected.Particles[i].Pos[c]);
+                if (posError > maxPosError) {
+                    maxPosError = posError;
+                    worst = i;
+                }
+                maxVelocityError = std::max(maxVelocityError, std::abs(actual.Particles[i].Velocity[c] - expected.Particles[i].Velocity[c]));
+            }
+        }
+        std::cout << "[ " << scene << " ] max drift from the golden: position " << maxPosError
+                  << " m, velocity " << maxVelocityError << " m/s" << std::endl;
+        ::testing::Test::RecordProperty("MaxPositionError", std::to_string(maxPosError));
+        ::testing::Test::RecordProperty("MaxVelocityError", std::to_string(maxVelocityError));
+        EXPECT_LE(maxPosError, POSITION_TOLERANCE) << "worst particle " << worst;
+        EXPECT_LE(maxVelocityError, VELOCITY_TOLERANCE);
+    }
+}
+
+// The ball of snow from main.cpp hitting the wall, scaled down
+TEST(RegressionTests, SphereImpact) {
+    SimulationParameters params;
+    params.DETERMINISTIC = true;
+    CPUSolver solver(IVec3(24, 16, 16), 0.002, params);
+
+    EmitterSettings ball;
+    ball.Spacing = 0.25;
+    ball.Velocity = Vec3(250.0, 0.0, 0.0);
+    ball.Mass = 25.0;
+    solver.Emit(SphereEmitter(Vec3(6.0, 8.0, 8.0), 1.5, ball));
+
+    EmitterSettings wall;
+    wall.Spacing = 0.5;
+    wall.Velocity = Vec3(-15.0, 1.0, -0.5);
+    wall.Mass = 1.0;
+    solver.Emit(BoxEmitter(Vec3(9.5, 4.0, 4.0), Vec3(10.5, 12.0, 12.0), wall));
+
+    runScene("sphere_impact", solver, 5);
+}
+
+// A column of snow standing on the floor, settling under its own weight
+TEST(RegressionTests, SettlingColumn) {
+    SimulationParameters params;
+    params.DETERMINISTIC = true;
+    CPUSolver solver(IVec3(14, 14, 14), 0.005, params);
+
+    EmitterSettings column;
+    column.Spacing = 0.4;
+    column.Jitter = 0.25;
+    column.Seed = 7;
+    solver.Emit(BoxEmitter(Vec3(5.5, 0.25, 5.5), Vec3(8.5, 7.25, 8.5), column));
+
+    runScene("settling_column", solver, 4);
+}
+
+// A box collider sliding into a block of snow resting on the floor
+TEST(RegressionTests, ColliderPush) {
+    SimulationParameters params;
+    params.DETERMINISTIC = true;
+    MTIterator mt(params.NUM_THREADS);
+    CPUSolver solver(IVec3(20, 12, 12), 0.004, params);
+
+    EmitterSettings block;
+    block.Spacing = 0.5;
+    solver.Emit(BoxEmitter(Vec3(8.0, 2.5, 3.5), Vec3(12.0, 5.5, 8.5), block));
+
+    const Vec3 halfSize(1.0, 1.5, 3.0);
+    auto sdf = std::make_shared<ColliderSDF>(-halfSize - Vec3(1.0), halfSize + Vec3(1.0), 0.25, [&](const Vec3& p) {
+        const Vec3 d = glm::abs(p) - halfSize;
+        return glm::length(glm::max(d, Vec3(0.0))) + std::min(std::max(d.x, std::max(d.y, d.z)), 0.0);
+    }, mt);
+    solver.AddCollider(Collider(sdf, Vec3(6.5, 4.0, 6.0), Mat3(1.0), Vec3(20.0, 0.0, 0.0), Vec3(0.0), 0.3));
+
+    runScene("collider_push", solver, 4);
+}
@@ -0,0 +1,146 @@
+#include "gtest/gtest.h"
+#include "Json.hpp"
+#include "Scene.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#ifndef SNOW_SCENE_DIR
+#define SNOW_SCENE_DIR "scenes"
+#endif
+
+namespace
+{
+    // Writes text to a scene file in the working directory and loads it
+    Scene loadText(const std::string& text)
+    {
+        const std::string path = "scene_test.json";
+        {
+            std::ofstream file(path);
+            file << text;
+        }
+        try {
+            Scene scene = LoadScene(path);
+            std::remove(path.c_str());
+            return scene;
+        }
+        catch (...) {
+            std::remove(path.c_str());
+            throw;
+        }
+    }
+
+    // Message of the runtime_error thrown by f
+    template<typename Func>
+    std::string errorOf(Func f)
+    {
+        try {
+            f();
+        }
+        catch (const std::runtime_error& e) {
+            return e.what();
+        }
+        return "";
+    }
+}
+
+TEST(SceneTests, ParsesJson) {
+    JsonValue doc = JsonValue::Parse(R"( { "a": [1, -2.5e3, true, null], "b": { "c": "x\"é😀" }, "d": false } )");
+
+    const std::vector<JsonValue>& a = doc.Get("a").AsArray();
+    ASSERT_EQ(a.size(), 4u);
+    EXPECT_EQ(a[0].AsNumber(), 1.0);
+    EXPECT_EQ(a[1].AsNumber(), -2500.0);
+    EXPECT_TRUE(a[2].AsBool());
+    EXPECT_TRUE(a[3].IsNull());
+    EXPECT_EQ(doc.Get("b").Get("c").AsString(), "x\"\xC3\xA9\xF0\x9F\x98\x80");
+    EXPECT_FALSE(doc.Get("d").AsBool());
+    EXPECT_FALSE(doc.Has("e"));
+    EXPECT_THROW(doc.Get("e"), std::runtime_error);
+    EXPECT_THROW(doc.Get("d").AsNumber(), std::runtime_error);
+}
+
+TEST(SceneTests, RejectsInvalidJson) {
+    for (const char* text : { "", "{", "[1,]", "{\"a\" 1}", "01", "1.", "\"abc", "{\"a\":1,\"a\":2}", "tru", "[1] 2", "{'a':1}" }) {
+        EXPECT_THROW(JsonValue::Parse(text), std::runtime_error) << text;
+    }
+    EXPECT_NE(errorOf([] { JsonValue::Parse("{\n  \"a\": [1,\n  ]\n}"); }).find("line 3"), std::string::npos);
+}
+
+TEST(SceneTests, LoadsScene) {
+    Scene scene = loadText(R"({
+        "grid": [32, 16, 8],
+        "frameLength": 0.01,
+        "frames": 3,
+        "parameters": { "H": 0.5, "NUM_THREADS": 3, "P2G_MODE": "Partitioned", "SLEEPING": true, "SLEEP_BLOCK_SIZE": 2 },
+        "emitters": [
+            { "shape": "box", "min": [1, 1, 1], "max": [2, 2, 2], "sampling": "poissonDisk", "seed": 4, "velocity": [1, 0, 0] },
+            { "shape": "sphere", "center": [5, 5, 3], "radius": 1 }
+        ],
+        "colliders": [
+            { "shape": "sphere", "radius": 1, "voxelSize": 0.25, "position": [8, 4, 4], "velocity": [-1, 0, 0], "friction": 0.5 },
+            { "shape": "box", "halfSize": [1, 1, 1], "voxelSize": 0.25, "friction": 0,
+              "keyframes": [{ "time": 0, "position": [10, 4, 4] }, { "time": 1, "position": [12, 4, 4], "rotation": [0, 0, 1.5] }] }
+        ],
+        "output": { "positions": "pos_", "checkpoint": "job.snowckpt", "checkpointInterval": 2 }
+    })");
+
+    EXPECT_EQ(scene.GridDims, IVec3(32, 16, 8));
+    EXPECT_EQ(scene.FrameLength, 0.01);
+    EXPECT_EQ(scene.NumFrames, 3u);
+    EXPECT_EQ(scene.Params.H, 0.5);
+    EXPECT_EQ(scene.Params.NUM_THREADS, 3u);
+    EXPECT_EQ(scene.Params.P2G_MODE, P2GMode::Partitioned);
+    EXPECT_TRUE(scene.Params.SLEEPING);
+    EXPECT_EQ(scene.Params.SLEEP_BLOCK_SIZE, 2);
+    EXPECT_EQ(scene.Params.MU_0, SimulationParameters().MU_0);
+
+    EXPECT_EQ(scene.Emitters.size(), 2u);
+    ASSERT_EQ(scene.Colliders.size(), 2u);
+    EXPECT_NEAR(scene.Colliders[0].Distance(Vec3(8.0, 4.0, 5.5)), 0.5, 0.01);
+    EXPECT_NEAR(scene.Colliders[0].VelocityAt(Vec3(8.0, 4.0, 5.0)).x, -1.0, 1e-12);
+    scene.Colliders[1].SetTime(0.5);
+    EXPECT_NEAR(scene.Colliders[1].Distance(Vec3(11.0, 4.0, 4.0)), -1.0, 0.01);
+
+    EXPECT_EQ(scene.Output.PositionsPrefix, "pos_");
+    EXPECT_EQ(scene.Output.VdbPrefix, "");
+    EXPECT_EQ(scene.Output.CheckpointPath, "job.snowckpt");
+    EXPECT_EQ(scene.Output.CheckpointInterval, 2u);
+}
+
+TEST(SceneTests, RejectsInvalidScenes) {
+    const std::string base = R"("grid": [8, 8, 8], "frameLength": 0.01, "frames": 1)";
+
+    // Misspelled keys are errors rather than silently using the defaults
+    EXPECT_NE(errorOf([&] { loadText("{" + base + R"(, "parameters": { "MU0": 1 } })"); }).find("unknown key \"MU0\""), std::string::npos);
+    EXPECT_NE(errorOf([&] { loadText("{" + base + R"(, "emitters": [{ "shape": "box", "min": [0, 0, 0], "max": [1, 1, 1], "spaceing": 1 }] })"); })
+        .find("emitters[0]: unknown key \"spaceing\""), std::string::npos);
+
+    EXPECT_THROW(loadText(R"({ "grid": [8, 8], "frameLength": 0.01, "frames": 1 })"), std::runtime_error);
+    EXPECT_THROW(loadText(R"({ "grid": [8, 8, 8.5], "frameLength": 0.01, "frames": 1 })"), std::runtime_error);
+    EXPECT_THROW(loadText(R"({ "grid": [8, 8, 8], "frameLength": 0.01 })"), std::runtime_error);
+    EXPECT_THROW(loadText("{" + base + R"(, "parameters": { "P2G_MODE": "Fast" } })"), std::runtime_error);
+    EXPECT_THROW(loadText("{" + base + R"(, "parameters": { "NUM_THREADS": 0 } })"), std::runtime_error);
+    EXPECT_THROW(loadText("{" + base + R"(, "emitters": [{ "shape": "cone" }] })"), std::runtime_error);
+    EXPECT_THROW(loadText("{" + base + R"(, "colliders": [{ "shape": "sphere", "radius": 1, "voxelSize": 0.5 }] })"), std::runtime_error);
+
+    // Values the solver would crash on rather than throw
+    EXPECT_NE(errorOf([&] { loadText("{" + base + R"(, "parameters": { "SLEEP_BLOCK_SIZE": 0 } })"); }).find("\"SLEEP_BLOCK_SIZE\" has to be at least 1"), std::string::npos);
+    EXPECT_THROW(loadText("{" + base + R"(, "parameters": { "SLEEP_BLOCK_SIZE": -4 } })"), std::runtime_error);
+    const std::string collider = R"("shape": "sphere", "radius": 1, "voxelSize": 0.5, "friction": 0)";
+    EXPECT_NE(errorOf([&] { loadText("{" + base + R"(, "colliders": [{ )" + collider + R"(, "keyframes": [{ "time": 1 }, { "time": 0 }] }] })"); })
+        .find("colliders[0].keyframes[1]: \"time\" has to be after the time of the previous keyframe"), std::string::npos);
+    EXPECT_THROW(loadText("{" + base + R"(, "colliders": [{ )" + collider + R"(, "keyframes": [{ "time": 0.5 }, { "time": 0.5 }] }] })"), std::runtime_error);
+    EXPECT_THROW(LoadScene("no_such_scene.json"), std::runtime_error);
+}
+
+// The scenes shipped with the repo stay loadable
+TEST(SceneTests, LoadsShippedScenes) {
+    Scene scene = LoadScene(std::string(SNOW_SCENE_DIR) + "/sphere_impact.json");
+    EXPECT_EQ(scene.GridDims, IVec3(300, 180, 180));
+    EXPECT_EQ(scene.NumFrames, 48u);
+    EXPECT_EQ(scene.Emitters.size(), 2u);
+    EXPECT_EQ(scene.Output.CheckpointInterval, 4u);
+}
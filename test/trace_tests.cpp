@@ -0,0 +1,72 @@
+#include "gtest/gtest.h"
+#include "CPUSolver.hpp"
+#include "Json.hpp"
+#include "Trace.hpp"
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+
+// Only the frame with recording enabled ends up in the trace, with the solver phases on lane 0 and
+// every worker's chunks on its own lane under the name of the phase that started them
+TEST(TraceTests, RecordsPhasesAndWorkers) {
+    const std::string path = "trace_test.json";
+
+    SimulationParameters params;
+    params.NUM_THREADS = 3;
+    CPUSolver solver(IVec3(16, 16, 16), 0.001, params);
+    for (int x = 0; x < 6; x++) {
+        for (int y = 0; y < 6; y++) {
+            for (int z = 0; z < 6; z++) {
+                solver.AddParticle(Vec3(6.0 + x * 0.5, 6.0 + y * 0.5, 2.0 + z * 0.5), Vec3(0.0), 1.0);
+            }
+        }
+    }
+
+    Trace::Open(path);
+    solver.NextFrame();
+    Trace::Flush();
+    Trace::SetEnabled(true);
+    solver.NextFrame();
+    Trace::SetEnabled(false);
+    Trace::Flush();
+    solver.NextFrame();
+    Trace::Close();
+
+    const JsonValue trace = JsonValue::ParseFile(path);
+    std::remove(path.c_str());
+
+    std::map<std::string, int> phases;
+    std::map<Uint, std::set<std::string>> workerNames;
+    int frames = 0;
+    for (const JsonValue& event : trace.Get("traceEvents").AsArray()) {
+        if (event.Get("ph").AsString() != "X") {
+            continue;
+        }
+        const std::string name = event.Get("name").AsString();
+        const std::string category = event.Get("cat").AsString();
+        const Uint lane = Uint(event.Get("tid").AsNumber());
+        EXPECT_GE(event.Get("dur").AsNumber(), 0.0);
+
+        if (category == "phase") {
+            EXPECT_EQ(lane, 0u);
+            phases[name]++;
+        } else if (category == "worker") {
+            workerNames[lane].insert(name);
+        } else if (name == "frame") {
+            frames++;
+        }
+    }
+
+    EXPECT_EQ(frames, 1);
+    EXPECT_EQ(phases["rasterize"], 10);
+    EXPECT_EQ(phases["deformation update"], 10);
+    EXPECT_EQ(phases.count("volumes"), 0u); // First substep only, in the frame that wasn't traced
+
+    ASSERT_EQ(workerNames.size(), 3u);
+    for (Uint lane = 1; lane <= 3; lane++) {
+        EXPECT_EQ(workerNames[lane].count("rasterize"), 1u) << "worker " << lane - 1;
+        EXPECT_EQ(workerNames[lane].count("deformation update"), 1u) << "worker " << lane - 1;
+    }
+}